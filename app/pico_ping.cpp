@@ -8,7 +8,10 @@
  * Distributed under the Apache license and can be found in LICENSE.txt
  */
 
+#include <random>
+
 #include "ping_service.h"
+#include "ping_workers.h"
 #include "cli.h"
 
 using namespace pico_ping;
@@ -17,8 +20,37 @@ int main(int argc, char** argv){
 
   try {
     auto params = cli::get_input(argc, argv);
-    auto p = Ping_Service(params.host, params.timeout);
-    p.start();
+    Ping_Options options;
+    options.kernel_timestamps = params.kernel_timestamps;
+    if (params.io_backend == "uring") {
+      options.io_backend = IO_Backend::io_uring;
+    }
+    options.interval = params.interval;
+    options.flood = params.flood;
+    options.stamp_payload = params.stamp_payload;
+    options.payload_size = params.payload_size;
+    options.pattern = params.pattern;
+    options.dns_ttl = params.dns_ttl;
+    options.count = params.count;
+    options.permute = params.permute;
+    options.seed = std::random_device()();
+    options.target_file = params.target_file;
+    parse_output_format(params.output_format, options.output_format);
+    if (params.drop_output) {
+      options.output_backpressure = Backpressure::drop;
+    }
+
+    // Like ping, hosts that cannot be resolved fail the run with status 2
+    if (params.threads > 1) {
+      Ping_Workers workers(params.hosts, params.timeout, options,
+                           params.threads);
+      workers.start();
+      return workers.unresolved() > 0 ? 2 : 0;
+    } else {
+      auto p = Ping_Service(params.hosts, params.timeout, options);
+      p.start();
+      return p.unresolved() > 0 ? 2 : 0;
+    }
 
   } catch (const std::invalid_argument& e) {
     cli::show_usage();
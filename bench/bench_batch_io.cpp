@@ -0,0 +1,155 @@
+/**
+ * @file bench_batch_io.cpp
+ * @ingroup Ping_Service
+ * @brief Loopback throughput of per-packet versus batched echo exchange
+ *
+ * Sends echo requests to 127.0.0.1 over an ICMP datagram socket, one batch at
+ * a time, and waits for every reply before sending the next batch. The
+ * per-packet path uses one sendto and one recvfrom per probe, the batched path
+ * one sendmmsg and as few recvmmsg calls as the replies allow.
+ *
+ * Usage: bench_batch_io [probes] [batch size]
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "batch_io.h"
+
+using namespace std::chrono;
+using namespace pico_ping;
+
+static constexpr size_t packet_size = 64;
+
+struct Result {
+  size_t sent = 0;
+  size_t received = 0;
+  duration<double> elapsed;
+};
+
+static int open_socket() {
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+  if (sock < 0) {
+    std::cerr << "Unable to create socket - check net.ipv4.ping_group_range\n";
+    std::exit(1);
+  }
+  return sock;
+}
+
+static void build_echo(unsigned char *data, uint16_t sequence) {
+  struct icmphdr header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = ICMP_ECHO;
+  header.un.echo.sequence = sequence;
+  std::memcpy(data, &header, sizeof(header));
+  std::memcpy(data + sizeof(header), "PingPong", 8);
+}
+
+// Block until the socket is readable, false if replies stopped arriving
+static bool wait_readable(int sock) {
+  struct pollfd pfd = {sock, POLLIN, 0};
+  return poll(&pfd, 1, 100) > 0;
+}
+
+static Result run_per_packet(const Socket_Address &dest, size_t probes,
+                             size_t batch) {
+  int sock = open_socket();
+  unsigned char data[packet_size];
+  Result result;
+
+  auto start = steady_clock::now();
+  while (result.sent < probes) {
+    size_t round = std::min(batch, probes - result.sent);
+    for (size_t i = 0; i < round; ++i) {
+      build_echo(data, static_cast<uint16_t>(result.sent + i));
+      sendto(sock, data, sizeof(struct icmphdr) + 8, 0,
+             &dest.any, sizeof(dest.v4));
+    }
+    result.sent += round;
+
+    for (size_t i = 0; i < round;) {
+      if (recvfrom(sock, data, sizeof(data), MSG_DONTWAIT, nullptr, nullptr) >
+          0) {
+        ++result.received;
+        ++i;
+      } else if (!wait_readable(sock)) {
+        break;
+      }
+    }
+  }
+  result.elapsed = steady_clock::now() - start;
+
+  close(sock);
+  return result;
+}
+
+static Result run_batched(const Socket_Address &dest, size_t probes,
+                          size_t batch) {
+  int sock = open_socket();
+  Batch_IO io(sock, batch, packet_size);
+  unsigned char data[packet_size];
+  Result result;
+
+  auto start = steady_clock::now();
+  while (result.sent < probes) {
+    size_t round = std::min(batch, probes - result.sent);
+    for (size_t i = 0; i < round; ++i) {
+      build_echo(data, static_cast<uint16_t>(result.sent + i));
+      io.queue(data, sizeof(struct icmphdr) + 8, dest);
+    }
+    io.flush();
+    result.sent += round;
+
+    for (size_t i = 0; i < round;) {
+      size_t received = io.receive();
+      if (received > 0) {
+        result.received += received;
+        i += received;
+      } else if (!wait_readable(sock)) {
+        break;
+      }
+    }
+  }
+  result.elapsed = steady_clock::now() - start;
+
+  close(sock);
+  return result;
+}
+
+static double report(const char *name, const Result &result) {
+  double pps = result.received / result.elapsed.count();
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(12) << std::fixed << std::setprecision(0) << pps
+            << " pps  (" << result.received << "/" << result.sent
+            << " replies in " << std::setprecision(3)
+            << result.elapsed.count() << " s)\n";
+  return pps;
+}
+
+int main(int argc, char **argv) {
+  size_t probes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+
+  Socket_Address dest;
+  std::memset(&dest, 0, sizeof(dest));
+  dest.v4.sin_family = AF_INET;
+  dest.v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  std::cout << probes << " probes to 127.0.0.1, " << batch
+            << " per batch\n";
+  double per_packet = report("per-packet", run_per_packet(dest, probes, batch));
+  double batched = report("batched", run_batched(dest, probes, batch));
+  std::cout << "speedup     " << std::setprecision(2) << batched / per_packet
+            << "x\n";
+  return 0;
+}
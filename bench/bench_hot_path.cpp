@@ -0,0 +1,189 @@
+/**
+ * @file bench_hot_path.cpp
+ * @ingroup Ping_Service
+ * @brief Per probe cost of every step between building a request and
+ * reporting its reply
+ *
+ * Runs each step of the probe path in isolation on the engine's own types,
+ * with no system calls involved, and reports its time and heap allocations
+ * per operation. Allocations are counted by replacing the global operator
+ * new, so a step that starts allocating shows up even when it stays fast.
+ *
+ * Usage: bench_hot_path [operations per benchmark]
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "output_buffer.h"
+#include "probe_record.h"
+#include "payload_stamp.h"
+#include "probe_window.h"
+#include "rtt_stats.h"
+#include "simulated_network.h"
+#include "socket_address.h"
+#include "timer_wheel.h"
+
+using namespace pico_ping;
+
+// Every heap allocation of the process, the benchmarks run single threaded
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *block = std::malloc(size == 0 ? 1 : size)) {
+    return block;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *block) noexcept { std::free(block); }
+void operator delete[](void *block) noexcept { std::free(block); }
+void operator delete(void *block, size_t) noexcept { std::free(block); }
+void operator delete[](void *block, size_t) noexcept { std::free(block); }
+
+// Keeps results alive so the compiler cannot drop the work producing them
+static volatile uint64_t sink;
+
+// Runs body once per operation after a short warm up and prints the cost
+template <typename Body>
+static void measure(const char *name, size_t operations, Body body) {
+  for (size_t i = 0; i < operations / 10; ++i) {
+    body(i);
+  }
+
+  auto allocated = allocations;
+  auto begin = steady_clock::now();
+  for (size_t i = 0; i < operations; ++i) {
+    body(i);
+  }
+  duration<double> elapsed = steady_clock::now() - begin;
+  allocated = allocations - allocated;
+
+  std::cout << std::left << std::setw(20) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << elapsed.count() * 1e9 / operations << " ns/op "
+            << std::setw(8) << std::setprecision(3)
+            << static_cast<double>(allocated) / operations << " allocs/op\n";
+}
+
+static Socket_Address target_address(uint32_t index) {
+  Socket_Address address;
+  std::memset(&address, 0, sizeof(address));
+  address.v4.sin_family = AF_INET;
+  address.v4.sin_addr.s_addr = htonl(0x0a000000u + index);
+  return address;
+}
+
+int main(int argc, char **argv) {
+  size_t operations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  constexpr size_t targets = 1024;
+  constexpr size_t payload_size = 56;
+
+  std::vector<Socket_Address> addresses;
+  std::unordered_map<Socket_Address, size_t, Address_Hash, Address_Equal>
+      index;
+  index.reserve(targets);
+  for (size_t i = 0; i < targets; ++i) {
+    addresses.push_back(target_address(static_cast<uint32_t>(i)));
+    index[addresses.back()] = i;
+  }
+  std::vector<unsigned char> payload(payload_size, 'P');
+  auto now = steady_clock::now();
+
+  std::cout << operations << " operations per benchmark, " << targets
+            << " targets\n";
+
+  // Header, stamp and a queued copy as send_echo builds them; the simulated
+  // endpoint loses every request so flushing a full batch costs next to
+  // nothing
+  Network_Profile discard;
+  discard.loss = 1;
+  Simulated_IO io(AF_INET, discard, 64, sizeof(icmphdr) + payload_size, 1);
+  icmphdr header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = ICMP_ECHO;
+  measure("packet construction", operations, [&](size_t i) {
+    unsigned char head[sizeof(icmphdr) + payload_stamp_size];
+    header.un.echo.sequence = static_cast<uint16_t>(i);
+    std::memcpy(head, &header, sizeof(header));
+    write_payload_stamp(head + sizeof(header),
+                        {static_cast<uint32_t>(i % targets), now});
+    if (io.full()) {
+      io.flush();
+    }
+    io.queue(head, sizeof(head), payload.data() + payload_stamp_size,
+             payload.size() - payload_stamp_size, addresses[i % targets], i);
+  });
+
+  // Type check, source lookup and stamp read as process_reply does them
+  std::vector<unsigned char> reply(sizeof(icmphdr) + payload_size);
+  header.type = ICMP_ECHOREPLY;
+  std::memcpy(reply.data(), &header, sizeof(header));
+  write_payload_stamp(reply.data() + sizeof(header), {7, now});
+  measure("reply parsing", operations, [&](size_t i) {
+    icmphdr parsed;
+    std::memcpy(&parsed, reply.data(), sizeof(parsed));
+    auto it = index.find(addresses[i % targets]);
+    Payload_Stamp stamp;
+    if (parsed.type == ICMP_ECHOREPLY && it != index.end() &&
+        read_payload_stamp(reply.data() + sizeof(parsed),
+                           reply.size() - sizeof(parsed), stamp)) {
+      sink = it->second + stamp.target;
+    }
+  });
+
+  // log_echo_sent_time and get_packet_rtt are thin wrappers of these
+  Probe_Window window(64);
+  measure("sequence lookup", operations, [&](size_t) {
+    auto tag = window.log_sent(now);
+    time_point<steady_clock> sent;
+    sink = static_cast<uint64_t>(
+        window.complete(static_cast<uint16_t>(tag), sent));
+  });
+
+  Timer_Wheel wheel(targets * 64, milliseconds(1), now);
+  measure("timeout arm/cancel", operations, [&](size_t i) {
+    sink = wheel.cancel(wheel.arm(now + seconds(1), i));
+  });
+
+  Rtt_Stats stats;
+  measure("stats update", operations, [&](size_t i) {
+    stats.record_sent();
+    stats.record_rtt(10.0 + static_cast<double>(i % 1000) / 100);
+  });
+
+  // The reply as process_reply reports it in each format, flushed into the
+  // void
+  Output_Buffer output(-1);
+  std::string address = address_to_string(addresses[7]);
+  Probe_Event event;
+  event.target = 7;
+  event.length = sizeof(icmphdr) + payload_size;
+  event.addr = &addresses[7];
+  event.host = address;
+  event.address = address;
+  event.ttl = 64;
+  for (auto format : {std::make_pair("output formatting", Output_Format::text),
+                      std::make_pair("json record", Output_Format::json),
+                      std::make_pair("binary record", Output_Format::binary)}) {
+    measure(format.first, operations, [&](size_t i) {
+      event.sequence = static_cast<uint16_t>(i);
+      event.sent_ns = static_cast<int64_t>(i) * 1000000;
+      event.received_ns = event.sent_ns + 10000000 + i % 1000 * 10000;
+      event.rtt_ms = 10.0 + static_cast<double>(i % 1000) / 100;
+      write_probe_event(output, format.second, event);
+    });
+  }
+
+  return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file bench_io_backends.cpp
+ * @ingroup Ping_Service
+ * @brief Loopback throughput and latency of the packet I/O backends
+ *
+ * Keeps a window of echo requests in flight to 127.0.0.1 through each
+ * backend, waiting on its event descriptor with epoll the way Ping_Service
+ * does, and reports replies per second together with the latency percentiles
+ * from queueing a probe to handling its reply.
+ *
+ * Usage: bench_io_backends [probes] [batch size] [window]
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "batch_io.h"
+#include "uring_io.h"
+
+using namespace std::chrono;
+using namespace pico_ping;
+
+static constexpr size_t packet_size = 64;
+
+static int open_socket() {
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_ICMP);
+  if (sock < 0) {
+    std::cerr << "Unable to create socket - check net.ipv4.ping_group_range\n";
+    std::exit(1);
+  }
+  return sock;
+}
+
+static void run(const char *name, Packet_IO &io, size_t probes,
+                size_t window) {
+  Socket_Address dest;
+  std::memset(&dest, 0, sizeof(dest));
+  dest.v4.sin_family = AF_INET;
+  dest.v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int epoll_fd = epoll_create1(0);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, io.event_fd(), &event);
+
+  std::vector<time_point<steady_clock>> sent_at(probes);
+  std::vector<double> latencies;
+  latencies.reserve(probes);
+
+  unsigned char data[packet_size];
+  struct icmphdr header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = ICMP_ECHO;
+
+  size_t sent = 0;
+  auto start = steady_clock::now();
+  while (latencies.size() < probes) {
+    // Top the window up one batch at a time
+    if (sent < probes && sent - latencies.size() + io.batch_size() <= window) {
+      size_t round = std::min(io.batch_size(), probes - sent);
+      for (size_t i = 0; i < round; ++i) {
+        uint32_t index = static_cast<uint32_t>(sent + i);
+        std::memcpy(data, &header, sizeof(header));
+        std::memcpy(data + sizeof(header), &index, sizeof(index));
+        sent_at[index] = steady_clock::now();
+        io.queue(data, sizeof(header) + sizeof(index), dest);
+      }
+      io.flush();
+      sent += round;
+    }
+
+    size_t received = io.receive();
+    auto now = steady_clock::now();
+    for (size_t i = 0; i < received; ++i) {
+      auto reply = io.packet(i);
+      uint32_t index;
+      if (reply.length < sizeof(header) + sizeof(index)) {
+        continue;
+      }
+      std::memcpy(&index, reply.data + sizeof(header), sizeof(index));
+      if (index < probes) {
+        latencies.push_back(
+            duration<double, std::micro>(now - sent_at[index]).count());
+      }
+    }
+
+    // Only block once the window is full and nothing is waiting
+    bool window_full = sent == probes ||
+                       sent - latencies.size() + io.batch_size() > window;
+    if (received == 0 && window_full && !io.receive_pending() &&
+        epoll_wait(epoll_fd, &event, 1, 100) == 0) {
+      break;
+    }
+  }
+  duration<double> elapsed = steady_clock::now() - start;
+  close(epoll_fd);
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies.empty()
+               ? 0.0
+               : latencies[std::min(latencies.size() - 1,
+                                    static_cast<size_t>(p * latencies.size()))];
+  };
+
+  std::cout << std::left << std::setw(10) << name << std::right << std::fixed
+            << std::setprecision(0) << std::setw(10)
+            << latencies.size() / elapsed.count() << " pps"
+            << std::setprecision(1)
+            << "  p50 " << std::setw(7) << percentile(0.5) << " us"
+            << "  p99 " << std::setw(7) << percentile(0.99) << " us"
+            << "  p99.9 " << std::setw(7) << percentile(0.999) << " us"
+            << "  max " << std::setw(8) << percentile(1.0) << " us  ("
+            << latencies.size() << "/" << probes << ")\n";
+}
+
+int main(int argc, char **argv) {
+  size_t probes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+  size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+  size_t window = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 256;
+  window = std::max(window, batch);
+
+  std::cout << probes << " probes to 127.0.0.1, " << batch << " per batch, "
+            << window << " in flight\n";
+
+  int sock = open_socket();
+  {
+    Batch_IO io(sock, batch, packet_size);
+    run("epoll", io, probes, window);
+  }
+  close(sock);
+
+  sock = open_socket();
+  auto uring = Uring_IO::create(sock, batch, packet_size);
+  if (uring == nullptr) {
+    std::cout << "io_uring  unavailable on this kernel\n";
+  } else {
+    run("io_uring", *uring, probes, window);
+  }
+  uring.reset();
+  close(sock);
+  return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file bench_simulation.cpp
+ * @ingroup Ping_Service
+ * @brief Scheduler cost of a large sweep run on simulated time
+ *
+ * Sweeps a range of addresses through a simulated network on a virtual
+ * clock, so the pacer, the timeout wheel and the event loop run exactly as
+ * they would against the network while simulated hours pass in seconds.
+ * Per packet output goes to /dev/null, everything else is the real engine.
+ * The wall time divided by the probes sent is the scheduling overhead per
+ * probe.
+ *
+ * Usage: bench_simulation [targets] [probes per target] [interval ms]
+ *                         [loss percentage]
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include "ping_service.h"
+#include "simulated_network.h"
+#include "virtual_clock.h"
+
+using namespace pico_ping;
+
+int main(int argc, char **argv) {
+  uint64_t targets = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 65536;
+  size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+  auto interval =
+      milliseconds(argc > 3 ? std::strtol(argv[3], nullptr, 10) : 1000);
+  double loss = argc > 4 ? std::strtod(argv[4], nullptr) / 100 : 0.01;
+  if (targets == 0 || targets >= (uint64_t(1) << 24) || count == 0) {
+    std::cerr << "targets must be in 1..16777215 and count at least 1\n";
+    return 1;
+  }
+
+  // One contiguous range starting at 10.0.0.1
+  auto last = 0x0a000000u + static_cast<uint32_t>(targets);
+  auto range = "10.0.0.1-" + std::to_string(last >> 24) + "." +
+               std::to_string((last >> 16) & 0xff) + "." +
+               std::to_string((last >> 8) & 0xff) + "." +
+               std::to_string(last & 0xff);
+
+  // A wide area like spread of latencies with some loss and reordering
+  Network_Profile profile;
+  profile.latency_model = Latency_Model::normal;
+  profile.latency = milliseconds(40);
+  profile.jitter = milliseconds(10);
+  profile.loss = loss;
+  profile.reorder = 0.01;
+  profile.capacity = 1 << 16;
+  profile.seed = 1;
+
+  auto clock = std::make_shared<Virtual_Clock>();
+  Ping_Options options;
+  options.interval = interval;
+  options.count = count;
+  options.clock = clock;
+  options.transport = std::make_shared<Simulated_Network>(profile, clock);
+  // Lines are still formatted and written, just not to the terminal
+  options.output_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  std::cout << targets << " targets, " << count << " probes each, "
+            << interval.count() << " ms interval, " << loss * 100
+            << "% loss\n";
+
+  Ping_Service service({range}, seconds(1), options);
+  auto begin = steady_clock::now();
+  service.run();
+  duration<double> wall = steady_clock::now() - begin;
+  close(options.output_fd);
+
+  auto stats = service.range_stats().front();
+  auto probes = stats.stats.transmitted();
+  duration<double> simulated = clock->elapsed();
+  std::cout << std::fixed << std::setprecision(1) << "simulated "
+            << std::setw(12) << simulated.count() << " s in "
+            << std::setprecision(3) << wall.count() << " s wall, "
+            << std::setprecision(0) << simulated / wall << "x real time\n"
+            << "probes    " << std::setw(12) << probes << " sent, "
+            << stats.stats.received() << " answered, " << stats.stats.lost()
+            << " timed out, " << stats.alive << " of " << stats.probed
+            << " alive\n"
+            << "overhead  " << std::setw(12) << std::setprecision(1)
+            << wall.count() * 1e9 / probes << " ns/probe, "
+            << std::setprecision(2)
+            << static_cast<double>(clock->advances()) / probes
+            << " clock advances/probe\n";
+
+  return stats.probed == targets ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file bench_timer_wheel.cpp
+ * @ingroup Ping_Service
+ * @brief Arm, cancel and expire throughput of the probe timer wheel
+ *
+ * Arms one timeout per probe as if probes were sent at a fixed rate with a
+ * shared timeout, cancels the share of them that would be answered, then
+ * advances the wheel one tick at a time until the rest has expired.
+ *
+ * Usage: bench_timer_wheel [timers] [reply percentage]
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "timer_wheel.h"
+
+using namespace pico_ping;
+
+static void report(const char *name, size_t operations,
+                   duration<double> elapsed) {
+  std::cout << std::left << std::setw(8) << name << std::right
+            << std::setw(12) << operations << " ops " << std::setw(10)
+            << std::fixed << std::setprecision(1)
+            << elapsed.count() * 1e9 / operations << " ns/op "
+            << std::setw(12) << std::setprecision(0)
+            << operations / elapsed.count() << " ops/s\n";
+}
+
+int main(int argc, char **argv) {
+  size_t timers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  size_t replied = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 90;
+
+  // A million probes sent over one second, each with a 5s timeout
+  auto start = steady_clock::now();
+  auto spacing = nanoseconds(seconds(1)) / static_cast<int64_t>(timers);
+  auto timeout = seconds(5);
+
+  Timer_Wheel wheel(timers, milliseconds(1), start);
+  std::vector<Timer_Wheel::Handle> handles(timers);
+
+  std::cout << timers << " timers, " << replied << "% cancelled\n";
+
+  auto begin = steady_clock::now();
+  for (size_t i = 0; i < timers; ++i) {
+    handles[i] = wheel.arm(start + timeout + spacing * i, i);
+  }
+  report("arm", timers, steady_clock::now() - begin);
+
+  // Spread the cancellations over the whole range like scattered replies
+  size_t cancelled = 0;
+  begin = steady_clock::now();
+  for (size_t i = 0; i < timers; ++i) {
+    if (i * 2654435761u % 100 < replied) {
+      cancelled += wheel.cancel(handles[i]);
+    }
+  }
+  report("cancel", cancelled, steady_clock::now() - begin);
+
+  size_t fired = 0;
+  auto now = start;
+  begin = steady_clock::now();
+  while (!wheel.empty()) {
+    now += wheel.tick();
+    fired += wheel.expire(now, [](uint64_t) {});
+  }
+  report("expire", fired, steady_clock::now() - begin);
+
+  return fired + cancelled == timers ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file async_writer.cpp
+ * @ingroup Ping_Service
+ * @brief Output written by a thread of its own, fed through a lock-free ring
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "async_writer.h"
+#include "event_fd.h"
+
+namespace pico_ping {
+
+// Times the writer looks for more output before going to sleep
+static constexpr size_t max_idle_polls = 64;
+
+// Longest sleep on an eventfd. Both sides look at the ring again after
+// waking, so a wake-up that was lost only delays them by this much
+static constexpr int max_wait_ms = 100;
+
+// Sleeps until fd is signalled or max_wait_ms passed, false on failure
+static bool wait_fd(int fd) {
+  struct pollfd signalled = {fd, POLLIN, 0};
+  int rc;
+  do {
+    rc = poll(&signalled, 1, max_wait_ms);
+  } while (rc < 0 && errno == EINTR);
+  uint64_t count;
+  return rc == 0 || (rc > 0 && read_eventfd(fd, count));
+}
+
+Async_Writer::Async_Writer(int fd, size_t capacity, Backpressure policy)
+    : fd_(fd), policy_(policy) {
+  size_t size = 64;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  ring_.resize(size);
+  mask_ = size - 1;
+
+  // Each side sleeps in poll on one of them until the other signals it
+  data_fd_ = eventfd(0, EFD_CLOEXEC);
+  space_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (data_fd_ < 0 || space_fd_ < 0) {
+    close(data_fd_);
+    close(space_fd_);
+    throw std::runtime_error("Unable to create writer eventfd");
+  }
+
+  // Started with every signal blocked so signals reach the caller's thread
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  thread_ = std::thread([this] { drain(); });
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+Async_Writer::~Async_Writer() {
+  // Unchecked, the writer wakes up on its own within max_wait_ms
+  stopping_ = true;
+  signal_eventfd(data_fd_);
+  thread_.join();
+  close(data_fd_);
+  close(space_fd_);
+}
+
+bool Async_Writer::push(std::string_view bytes) {
+  auto head = head_.load(std::memory_order_relaxed);
+  if (policy_ == Backpressure::drop &&
+      bytes.size() > ring_.size() - (head - tail_.load())) {
+    dropped_.fetch_add(bytes.size(), std::memory_order_relaxed);
+    dropped_batches_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  bool waited = false;
+  while (!bytes.empty()) {
+    auto room = ring_.size() - (head - tail_.load());
+    if (room == 0) {
+      // Announce first, so the writer either sees it or had freed room
+      // before the check below
+      waited = true;
+      producer_waiting_ = true;
+      if (head - tail_.load() == ring_.size() && !wait_fd(space_fd_)) {
+        producer_waiting_ = false;
+        throw std::runtime_error("Unable to wait for the writer thread");
+      }
+      producer_waiting_ = false;
+      continue;
+    }
+
+    // Up to two copies when the bytes wrap around the end of the ring
+    auto length = std::min<size_t>(room, bytes.size());
+    auto offset = static_cast<size_t>(head & mask_);
+    auto first = std::min(length, ring_.size() - offset);
+    std::memcpy(ring_.data() + offset, bytes.data(), first);
+    std::memcpy(ring_.data(), bytes.data() + first, length - first);
+    head += length;
+    head_ = head;
+    bytes.remove_prefix(length);
+
+    if (writer_sleeping_.exchange(false) && !signal_eventfd(data_fd_)) {
+      throw std::runtime_error("Unable to wake the writer thread");
+    }
+  }
+  if (waited) {
+    waits_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void Async_Writer::sync() {
+  auto head = head_.load(std::memory_order_relaxed);
+  while (tail_.load() != head) {
+    producer_waiting_ = true;
+    if (tail_.load() != head && !wait_fd(space_fd_)) {
+      producer_waiting_ = false;
+      throw std::runtime_error("Unable to wait for the writer thread");
+    }
+    producer_waiting_ = false;
+  }
+}
+
+Writer_Counters Async_Writer::counters() const {
+  Writer_Counters counters;
+  counters.written = written_.load(std::memory_order_relaxed);
+  counters.dropped = dropped_.load(std::memory_order_relaxed);
+  counters.dropped_batches = dropped_batches_.load(std::memory_order_relaxed);
+  counters.waits = waits_.load(std::memory_order_relaxed);
+  return counters;
+}
+
+// Everything pushed before stopping is written before the thread returns
+void Async_Writer::drain() {
+  size_t idle = 0;
+  while (true) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load();
+    if (tail == head) {
+      if (stopping_) {
+        return;
+      }
+      // A busy producer pushes again shortly, waiting for it a little saves
+      // it the system call that wakes a sleeping writer
+      if (++idle < max_idle_polls) {
+        std::this_thread::yield();
+        continue;
+      }
+      idle = 0;
+      // Failures are not reported from here, the producer sees them when
+      // it signals or waits itself, and neither side sleeps for good
+      writer_sleeping_ = true;
+      if (head_.load() == tail && !stopping_) {
+        wait_fd(data_fd_);
+      }
+      writer_sleeping_ = false;
+      continue;
+    }
+
+    idle = 0;
+    write_out(tail, head);
+    tail_ = head;
+    if (producer_waiting_.exchange(false)) {
+      signal_eventfd(space_fd_);
+    }
+  }
+}
+
+// Output that cannot be written, e.g. to a closed pipe, is skipped
+void Async_Writer::write_out(uint64_t from, uint64_t to) {
+  while (from < to) {
+    auto offset = static_cast<size_t>(from & mask_);
+    auto length = static_cast<size_t>(to - from);
+    auto first = std::min(length, ring_.size() - offset);
+    struct iovec parts[2] = {{ring_.data() + offset, first},
+                             {ring_.data(), length - first}};
+
+    auto rc = writev(fd_, parts, length > first ? 2 : 1);
+    if (rc < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rc < 0 && errno == EAGAIN) {
+      struct pollfd writable = {fd_, POLLOUT, 0};
+      poll(&writable, 1, -1);
+      continue;
+    }
+    if (rc < 0) {
+      return;
+    }
+    from += static_cast<uint64_t>(rc);
+    written_.fetch_add(static_cast<uint64_t>(rc), std::memory_order_relaxed);
+  }
+}
+} // namespace pico_ping
@@ -0,0 +1,123 @@
+/**
+ * @file async_writer.h
+ * @ingroup Ping_Service
+ * @brief Output written by a thread of its own, fed through a lock-free ring
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace pico_ping {
+
+/**
+ * @brief What a push does when the ring has no room for it
+ */
+enum class Backpressure {
+  block, ///< Wait for the writer thread to catch up, nothing is lost
+  drop   ///< Discard the bytes and count them, the caller never waits
+};
+
+/**
+ * @brief Bytes through an Async_Writer so far
+ */
+struct Writer_Counters {
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  // Pushes that were dropped, each a batch of whole lines or records
+  uint64_t dropped_batches = 0;
+  // Pushes that had to wait for room under Backpressure::block
+  uint64_t waits = 0;
+};
+
+/**
+ * @brief Single producer, single consumer byte ring drained into a
+ * descriptor by a dedicated thread
+ *
+ * The producer copies bytes into the ring and publishes them by advancing
+ * its position, the writer thread writes them out and advances its own, so
+ * neither ever takes a lock and a slow terminal or a full pipe only ever
+ * stalls the writer thread. Each side sleeps on an eventfd only after it
+ * announced so and found nothing to do, and the other side signals it only
+ * when it announced so, which keeps system calls off the producer while the
+ * writer keeps up.
+ *
+ * Push, sync and counters may only be called from one thread at a time.
+ */
+class Async_Writer {
+public:
+  /**
+   * @brief Starts the writer thread
+   *
+   * @param[in] fd Descriptor written to, not owned
+   * @param[in] capacity Bytes the ring holds, rounded up to a power of two
+   * @param[in] policy Behaviour of push when the ring is full
+   *
+   * @throw std::runtime_error if the eventfds cannot be created
+   */
+  Async_Writer(int fd, size_t capacity = 1 << 20,
+               Backpressure policy = Backpressure::block);
+
+  /**
+   * @brief Writes out everything pushed so far and stops the thread
+   */
+  ~Async_Writer();
+
+  Async_Writer(const Async_Writer &) = delete;
+  Async_Writer &operator=(const Async_Writer &) = delete;
+
+  /**
+   * @brief Hands bytes to the writer thread
+   *
+   * Under Backpressure::drop the bytes are queued whole or not at all.
+   *
+   * @return false if the bytes were dropped
+   *
+   * @throw std::runtime_error if the writer thread cannot be woken or waited
+   * for
+   */
+  bool push(std::string_view bytes);
+
+  /**
+   * @brief Waits until every byte pushed so far has been written
+   *
+   * @throw std::runtime_error if the writer thread cannot be waited for
+   */
+  void sync();
+
+  Writer_Counters counters() const;
+  size_t capacity() const { return ring_.size(); }
+  int fd() const { return fd_; }
+
+private:
+  void drain();
+  void write_out(uint64_t from, uint64_t to);
+
+  int fd_;
+  Backpressure policy_;
+  std::vector<char> ring_;
+  uint64_t mask_;
+  int data_fd_ = -1;
+  int space_fd_ = -1;
+  std::atomic<bool> stopping_{false};
+  // Positions only ever grow, on cache lines of their own so the two sides
+  // do not invalidate each other's
+  alignas(64) std::atomic<uint64_t> head_{0};
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> dropped_batches_{0};
+  std::atomic<uint64_t> waits_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<bool> writer_sleeping_{false};
+  std::atomic<uint64_t> written_{0};
+  std::thread thread_;
+};
+} // namespace pico_ping
@@ -0,0 +1,115 @@
+/**
+ * @file batch_io.cpp
+ * @ingroup Ping_Service
+ * @brief Batched datagram I/O built on sendmmsg and recvmmsg
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "batch_io.h"
+
+namespace pico_ping {
+
+Batch_IO::Batch_IO(int sock, size_t batch_size, size_t packet_size,
+                   size_t control_size)
+    : sock_(sock), batch_size_(std::max(batch_size, size_t(1))),
+      packet_size_(packet_size), control_size_(control_size) {
+  init_messages(send_msgs_, send_iovs_, send_buffers_, send_addrs_, 2);
+  init_messages(recv_msgs_, recv_iovs_, recv_buffers_, recv_addrs_, 1);
+  send_cookies_.resize(batch_size_);
+  sent_cookies_.resize(batch_size_);
+  recv_control_.resize(batch_size_ * control_size_);
+}
+
+void Batch_IO::init_messages(std::vector<struct mmsghdr> &msgs,
+                             std::vector<struct iovec> &iovs,
+                             std::vector<unsigned char> &buffers,
+                             std::vector<Socket_Address> &addrs,
+                             size_t iov_count) {
+  msgs.assign(batch_size_, {});
+  iovs.assign(batch_size_ * iov_count, {});
+  buffers.resize(batch_size_ * packet_size_);
+  addrs.resize(batch_size_);
+
+  // Only the first io vector of a message points into the buffers, any
+  // further ones are set per datagram
+  for (size_t i = 0; i < batch_size_; ++i) {
+    iovs[i * iov_count].iov_base = buffers.data() + i * packet_size_;
+    iovs[i * iov_count].iov_len = packet_size_;
+    msgs[i].msg_hdr.msg_iov = &iovs[i * iov_count];
+    msgs[i].msg_hdr.msg_iovlen = iov_count;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+  }
+}
+
+void Batch_IO::queue(const void *head, size_t head_length, const void *tail,
+                     size_t tail_length, const Socket_Address &dest,
+                     uint64_t cookie) {
+  head_length = std::min(head_length, packet_size_);
+  tail_length = std::min(tail_length, packet_size_ - head_length);
+
+  auto iov = &send_iovs_[queued_ * 2];
+  std::memcpy(iov[0].iov_base, head, head_length);
+  iov[0].iov_len = head_length;
+  iov[1].iov_base = const_cast<void *>(tail);
+  iov[1].iov_len = tail_length;
+  send_addrs_[queued_] = dest;
+  send_msgs_[queued_].msg_hdr.msg_namelen = address_length(dest);
+  send_cookies_[queued_] = cookie;
+  ++queued_;
+}
+
+size_t Batch_IO::flush() {
+  size_t next = 0;
+  size_t failed = 0;
+  sent_count_ = 0;
+
+  while (next < queued_) {
+    int rc = sendmmsg(sock_, &send_msgs_[next],
+                      static_cast<unsigned int>(queued_ - next), 0);
+
+    // The datagram at the head of the remaining batch was refused, skip it
+    if (rc <= 0) {
+      ++failed;
+      ++next;
+      continue;
+    }
+
+    for (int i = 0; i < rc; ++i) {
+      sent_cookies_[sent_count_++] = send_cookies_[next++];
+    }
+  }
+
+  queued_ = 0;
+  return failed;
+}
+
+size_t Batch_IO::receive() {
+  // The kernel overwrites the address and control lengths, restore them
+  for (size_t i = 0; i < batch_size_; ++i) {
+    auto &header = recv_msgs_[i].msg_hdr;
+    header.msg_namelen = sizeof(recv_addrs_[i]);
+    if (control_size_ > 0) {
+      header.msg_control = recv_control_.data() + i * control_size_;
+      header.msg_controllen = control_size_;
+    }
+  }
+
+  int rc = recvmmsg(sock_, recv_msgs_.data(),
+                    static_cast<unsigned int>(batch_size_), MSG_DONTWAIT,
+                    nullptr);
+  return rc > 0 ? static_cast<size_t>(rc) : 0;
+}
+
+Received_Packet Batch_IO::packet(size_t index) const {
+  return {static_cast<const unsigned char *>(recv_iovs_[index].iov_base),
+          recv_msgs_[index].msg_len, &recv_addrs_[index],
+          &recv_msgs_[index].msg_hdr};
+}
+} // namespace pico_ping
@@ -0,0 +1,90 @@
+/**
+ * @file batch_io.h
+ * @ingroup Ping_Service
+ * @brief Batched datagram I/O built on sendmmsg and recvmmsg
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "packet_io.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Packet I/O backend built on sendmmsg and recvmmsg
+ *
+ * All message headers, io vectors and packet buffers are allocated once at
+ * construction. Outgoing packets are copied into a send slot, apart from a
+ * referenced tail, and written with a single sendmmsg when flush is called.
+ * Incoming packets are drained with recvmmsg into the receive slots,
+ * readiness is signalled by the socket itself.
+ */
+class Batch_IO : public Packet_IO {
+public:
+  /**
+   * @brief Construct batch buffers for the given socket
+   *
+   * @param[in] sock Socket to send and receive on, not owned
+   * @param[in] batch_size Number of datagrams per system call
+   * @param[in] packet_size Largest datagram that is sent or received
+   * @param[in] control_size Bytes of ancillary data kept per received
+   * datagram, zero if none is needed
+   */
+  Batch_IO(int sock, size_t batch_size, size_t packet_size,
+           size_t control_size = 0);
+
+  using Packet_IO::queue;
+  void queue(const void *head, size_t head_length, const void *tail,
+             size_t tail_length, const Socket_Address &dest,
+             uint64_t cookie) override;
+  bool full() const override { return queued_ == batch_size_; }
+  size_t flush() override;
+  size_t sent_count() const override { return sent_count_; }
+  uint64_t sent_cookie(size_t index) const override {
+    return sent_cookies_[index];
+  }
+  size_t receive() override;
+  Received_Packet packet(size_t index) const override;
+  size_t batch_size() const override { return batch_size_; }
+  int event_fd() const override { return sock_; }
+
+private:
+  /**
+   * @brief Points every message header at its buffers
+   *
+   * @param[in] iov_count Io vectors per message, two for sends so the tail of
+   * a datagram can be referenced rather than copied
+   */
+  void init_messages(std::vector<struct mmsghdr> &msgs,
+                     std::vector<struct iovec> &iovs,
+                     std::vector<unsigned char> &buffers,
+                     std::vector<Socket_Address> &addrs, size_t iov_count);
+
+  int sock_ = -1;
+  size_t batch_size_ = 0;
+  size_t packet_size_ = 0;
+  size_t control_size_ = 0;
+  size_t queued_ = 0;
+  size_t sent_count_ = 0;
+
+  std::vector<unsigned char> send_buffers_;
+  std::vector<struct iovec> send_iovs_;
+  std::vector<Socket_Address> send_addrs_;
+  std::vector<struct mmsghdr> send_msgs_;
+  std::vector<uint64_t> send_cookies_;
+  std::vector<uint64_t> sent_cookies_;
+
+  std::vector<unsigned char> recv_buffers_;
+  std::vector<struct iovec> recv_iovs_;
+  std::vector<Socket_Address> recv_addrs_;
+  std::vector<struct mmsghdr> recv_msgs_;
+  std::vector<unsigned char> recv_control_;
+};
+} // namespace pico_ping
@@ -12,31 +12,147 @@
  */
 
 #include "cli.h"
+#include "ping_service.h"
+#include <algorithm>
+#include <cctype>
 #include <iomanip>
 
 namespace pico_ping {
 namespace cli {
+
+// Decode pairs of hex digits like ping -p does
+static std::vector<unsigned char> parse_pattern(const std::string &hex) {
+  if (hex.size() % 2 != 0 || hex.size() > 32) {
+    throw(std::invalid_argument("Invalid command line parameters"));
+  }
+
+  std::vector<unsigned char> pattern;
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    auto byte = hex.substr(i, 2);
+    if (!std::isxdigit(static_cast<unsigned char>(byte[0])) ||
+        !std::isxdigit(static_cast<unsigned char>(byte[1]))) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+    pattern.push_back(
+        static_cast<unsigned char>(std::stoul(byte, nullptr, 16)));
+  }
+  return pattern;
+}
+
 command_parameters get_input(int argc, char **argv) {
 
   cxxopts::Options options("pico_ping", "IMCP echo sender");
   // Create option values for cxxopts object, ignore help strings since we take
   // care of them
-  options.add_options()("host", "", cxxopts::value<std::string>())(
+  options.add_options()("host", "",
+                        cxxopts::value<std::vector<std::string>>())(
       "W,timeout", "Response packet timeout [sec]",
-      cxxopts::value<int>()->default_value("5"));
+      cxxopts::value<int>()->default_value("5"))(
+      "K,kernel-timestamps", "Report wire RTT from kernel timestamps")(
+      "io", "Packet I/O backend: epoll or uring",
+      cxxopts::value<std::string>()->default_value("epoll"))(
+      "i,interval", "Time between probes to a destination [sec]",
+      cxxopts::value<double>())(
+      "f,flood", "Print a dot per probe and erase it on reply")(
+      "stamp", "Carry the send time in the echo payload")(
+      "s,size", "Echo payload size [bytes]",
+      cxxopts::value<int>()->default_value("56"))(
+      "p,pattern", "Up to 16 hex encoded bytes filling the payload",
+      cxxopts::value<std::string>()->default_value(""))(
+      "dns-ttl", "Re-resolve hostnames this often [sec]",
+      cxxopts::value<int>()->default_value("60"))(
+      "T,threads", "Worker threads each probing a shard of the destinations",
+      cxxopts::value<int>()->default_value("1"))(
+      "c,count", "Stop after this many probes per destination",
+      cxxopts::value<int>()->default_value("0"))(
+      "permute", "Sweep CIDR blocks and ranges in a pseudo random order")(
+      "F,file", "Read further destinations from a file, - for stdin",
+      cxxopts::value<std::string>()->default_value(""))(
+      "o,output", "Per probe output: text, json, csv or binary",
+      cxxopts::value<std::string>()->default_value("text"))(
+      "drop-output", "Drop output rather than wait when it falls behind");
 
   // Regardless of the type of argument parsing error, we print usage then throw
   try {
     options.parse_positional("host");
     auto result = options.parse(argc, argv);
 
-    if (result["host"].count() != 1) {
+    auto target_file = result["file"].as<std::string>();
+    if (result["host"].count() < 1 && target_file.empty()) {
       throw(std::invalid_argument("Invalid command line parameters"));
     }
 
     seconds timeout = seconds(result["timeout"].as<int>());
 
-    command_parameters params = {result["host"].as<std::string>(), timeout};
+    auto io_backend = result["io"].as<std::string>();
+    if (io_backend != "epoll" && io_backend != "uring") {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    Output_Format output_format;
+    auto output = result["output"].as<std::string>();
+    if (!parse_output_format(output, output_format)) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    // Flood mode probes as fast as is still useful unless told otherwise
+    auto flood = result["flood"].as<bool>();
+    nanoseconds interval = flood ? milliseconds(10) : milliseconds(500);
+    if (result["interval"].count()) {
+      auto interval_sec = result["interval"].as<double>();
+      if (!(interval_sec >= 1e-6 && interval_sec <= 3600)) {
+        throw(std::invalid_argument("Invalid command line parameters"));
+      }
+      interval = duration_cast<nanoseconds>(duration<double>(interval_sec));
+    }
+
+    auto size = result["size"].as<int>();
+    if (size < 0 || static_cast<size_t>(size) > max_payload_size) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    auto dns_ttl = result["dns-ttl"].as<int>();
+    if (dns_ttl < 1) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    auto threads = result["threads"].as<int>();
+    if (threads < 1) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    // Zero, the default, keeps probing until interrupted
+    auto count = result["count"].as<int>();
+    if (count < 0 || (result["count"].count() && count == 0)) {
+      throw(std::invalid_argument("Invalid command line parameters"));
+    }
+
+    // Lists may be given as one comma separated argument as well
+    std::vector<std::string> hosts;
+    std::vector<std::string> args;
+    if (result["host"].count()) {
+      args = result["host"].as<std::vector<std::string>>();
+    }
+    for (const auto &arg : args) {
+      size_t begin = 0;
+      while (begin <= arg.size()) {
+        auto end = std::min(arg.find(',', begin), arg.size());
+        if (end == begin) {
+          throw(std::invalid_argument("Invalid command line parameters"));
+        }
+        hosts.push_back(arg.substr(begin, end - begin));
+        begin = end + 1;
+      }
+    }
+
+    command_parameters params = {
+        hosts, timeout,
+        result["kernel-timestamps"].as<bool>(), io_backend, interval, flood,
+        result["stamp"].as<bool>(), static_cast<size_t>(size),
+        parse_pattern(result["pattern"].as<std::string>()), seconds(dns_ttl),
+        static_cast<size_t>(threads), static_cast<size_t>(count),
+        result["permute"].as<bool>(), target_file, output,
+        result["drop-output"].as<bool>()};
     return params;
   }
 
@@ -46,10 +162,39 @@ command_parameters get_input(int argc, char **argv) {
 }
 
 void show_usage() {
+  // Descriptions line up in one column after the longest option
+  static const char *const options[][2] = {
+      {"-W, --timeout arg", "Response packet timeout [sec] (default: 5)"},
+      {"-K, --kernel-timestamps", "Report wire RTT from kernel timestamps"},
+      {"    --io arg", "Packet I/O backend: epoll or uring (default: epoll)"},
+      {"-i, --interval arg", "Time between probes [sec] (default: 0.5)"},
+      {"-f, --flood", "Print a dot per probe and erase it on reply"},
+      {"    --stamp", "Carry the send time in the echo payload"},
+      {"-s, --size arg", "Echo payload size [bytes] (default: 56)"},
+      {"-p, --pattern arg", "Up to 16 hex encoded bytes filling the payload"},
+      {"    --dns-ttl arg",
+       "Re-resolve hostnames this often [sec] (default: 60)"},
+      {"-T, --threads arg", "Worker threads each probing a shard (default: 1)"},
+      {"-c, --count arg", "Stop after this many probes per destination"},
+      {"    --permute",
+       "Sweep CIDR blocks and ranges in a pseudo random order"},
+      {"-F, --file arg",
+       "Read further destinations from a file, - for stdin"},
+      {"-o, --output arg", "Per probe output: text, json, csv or binary"},
+      {"    --drop-output",
+       "Drop output rather than wait when it falls behind"}};
+
+  auto flags = std::cout.flags();
   std::cout << "\nUsage:\n";
-  std::cout << std::setw(8) << "pico_ping [OPTION...] destination\n";
-  std::cout << std::setw(64)
-            << "-W, --timeout arg Response packet timeout [sec] (default: 5)\n";
+  std::cout << "pico_ping [OPTION...] destination...\n";
+  for (const auto &option : options) {
+    std::cout << "  " << std::left << std::setw(25) << option[0] << option[1]
+              << "\n";
+  }
+  std::cout << "destination: host, address, CIDR block (10.0.0.0/24), range\n"
+            << "             (10.0.0.1-10.0.0.50 or 10.0.0.1-50) or a comma\n"
+            << "             separated list of those\n";
+  std::cout.flags(flags);
 }
 } // namespace cli
 } // namespace pico_ping
\ No newline at end of file
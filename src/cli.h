@@ -15,6 +15,7 @@
 #include <chrono>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "cxxopts.hpp"
 
@@ -28,22 +29,39 @@ namespace cli {
  *
  */
 struct command_parameters {
-  std::string host;
+  std::vector<std::string> hosts;
   seconds timeout;
+  bool kernel_timestamps;
+  std::string io_backend;
+  nanoseconds interval;
+  bool flood;
+  bool stamp_payload;
+  size_t payload_size;
+  std::vector<unsigned char> pattern;
+  seconds dns_ttl;
+  size_t threads;
+  size_t count;
+  bool permute;
+  std::string target_file;
+  std::string output_format;
+  bool drop_output;
 };
 
 /**
  * @brief Parse commandline input and generate converted parameter values
  * to pass to ping service
  *
- * This is what acts as a thin wrapper around cxxopts. If an invalid option flag
- * is provided, or if the positional host parameter is ommited, an exception
- * will be thrown.
+ * This is what acts as a thin wrapper around cxxopts. If an invalid option
+ * flag is provided, or if no positional host parameter is given, an exception
+ * will be thrown. Any number of hosts may be given and all of them will be
+ * probed. A host may also be a comma separated list, a CIDR block or an
+ * address range. No host is needed when a target file is given.
  *
  * @param[in] argc Argument count from the commandline
  * @param[in] argv Argument array from the commandline
  *
- * @throw std::invalid_argument if IP or hostname is invalid
+ * @throw std::invalid_argument if IP or hostname is invalid, or an option
+ * value is not recognized
  * @throw std::runtime_error if socket operations fail
  */
 command_parameters get_input(int argc, char **argv);
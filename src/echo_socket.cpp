@@ -0,0 +1,89 @@
+/**
+ * @file echo_socket.cpp
+ * @ingroup Ping_Service
+ * @brief Echo request sockets and packet layout shared by every engine
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <unistd.h>
+
+#include <cstring>
+
+#include "echo_socket.h"
+
+namespace pico_ping {
+
+Echo_Socket open_echo_socket(Transport &transport, Event_Loop &loop,
+                             int family, size_t packet_size,
+                             size_t control_size,
+                             Event_Loop::Handler readable) {
+  Echo_Socket socket;
+  socket.family = family;
+  if (family == AF_INET6) {
+    socket.echo_request = ICMP6_ECHO_REQUEST;
+    socket.echo_reply = ICMP6_ECHO_REPLY;
+  }
+  auto opened =
+      transport.open(family, echo_batch_size, packet_size, control_size);
+  socket.sock = opened.sock;
+  socket.io = std::move(opened.io);
+
+  if (socket.sock < 0) {
+    loop.add(dup(socket.io->event_fd()), EPOLLIN, std::move(readable));
+    return socket;
+  }
+
+  // The ring signals replies itself, the socket still reports error queue
+  // entries such as transmit timestamps
+  if (socket.io->event_fd() != socket.sock) {
+    loop.add(socket.sock, EPOLLET, readable);
+    loop.add(dup(socket.io->event_fd()), EPOLLIN, std::move(readable));
+  } else {
+    loop.add(socket.sock, EPOLLIN | EPOLLET, std::move(readable));
+  }
+  return socket;
+}
+
+std::vector<unsigned char>
+echo_payload(size_t size, const std::vector<unsigned char> &pattern) {
+  static const unsigned char default_pattern[] = "PingPong";
+  const unsigned char *bytes = default_pattern;
+  size_t pattern_size = 8;
+  if (!pattern.empty()) {
+    bytes = pattern.data();
+    pattern_size = pattern.size();
+  }
+  std::vector<unsigned char> payload(size);
+  for (size_t i = 0; i < payload.size(); ++i) {
+    payload[i] = bytes[i % pattern_size];
+  }
+  return payload;
+}
+
+void write_echo_request(unsigned char *out, const Echo_Socket &socket,
+                        uint16_t sequence) {
+  icmphdr header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = socket.echo_request;
+  header.un.echo.id = 1337;
+  header.un.echo.sequence = sequence;
+  std::memcpy(out, &header, sizeof(header));
+}
+
+bool read_echo_reply(const Echo_Socket &socket, const Received_Packet &reply,
+                     uint16_t &sequence) {
+  icmphdr header;
+  if (reply.length < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, reply.data, sizeof(header));
+  if (header.type != socket.echo_reply) {
+    return false;
+  }
+  sequence = header.un.echo.sequence;
+  return true;
+}
+} // namespace pico_ping
@@ -0,0 +1,112 @@
+/**
+ * @file echo_socket.h
+ * @ingroup Ping_Service
+ * @brief Echo request sockets and packet layout shared by every engine
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+#include "event_loop.h"
+#include "packet_io.h"
+#include "transport.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Largest echo payload that fits an IPv4 datagram
+ */
+constexpr size_t max_payload_size = 65535 - 20 - 8;
+
+/**
+ * @brief Datagrams exchanged per sendmmsg or recvmmsg call
+ */
+constexpr size_t echo_batch_size = 64;
+
+/**
+ * @brief ICMP datagram socket of one address family and its packet I/O
+ *
+ * ICMP and ICMPv6 echo headers share their layout, only the type values
+ * differ, so both families are driven by the same code through this.
+ */
+struct Echo_Socket {
+  int family = AF_INET;
+  // -1 for simulated transports, which only signal through their backend
+  int sock = -1;
+  uint8_t echo_request = ICMP_ECHO;
+  uint8_t echo_reply = ICMP_ECHOREPLY;
+  std::unique_ptr<Packet_IO> io;
+};
+
+/**
+ * @brief Opens the socket of a family and watches it with a loop
+ *
+ * The loop owns the socket from here on, also if the caller's own setup of
+ * it throws later. Reply readiness is edge triggered, so the handler has to
+ * drain the socket, see receive_echo_replies.
+ *
+ * @param[in] transport Opens the socket and its packet I/O
+ * @param[in] loop Loop the socket is added to
+ * @param[in] family AF_INET or AF_INET6
+ * @param[in] packet_size Bytes of the largest request, replies echo it whole
+ * @param[in] control_size Ancillary data bytes received with every reply
+ * @param[in] readable Called from the loop whenever replies may be waiting
+ *
+ * @throw std::runtime_error if the socket cannot be opened
+ */
+Echo_Socket open_echo_socket(Transport &transport, Event_Loop &loop,
+                             int family, size_t packet_size,
+                             size_t control_size,
+                             Event_Loop::Handler readable);
+
+/**
+ * @brief Payload of the given size repeating pattern, "PingPong" if empty
+ */
+std::vector<unsigned char>
+echo_payload(size_t size, const std::vector<unsigned char> &pattern = {});
+
+/**
+ * @brief Writes the ICMP header of an echo request, ping sockets fill in
+ * the checksum and replace the identifier
+ *
+ * @param[out] out At least sizeof(icmphdr) bytes
+ * @param[in] socket Socket the request is sent on, selects the type
+ * @param[in] sequence Sequence number the reply carries back
+ */
+void write_echo_request(unsigned char *out, const Echo_Socket &socket,
+                        uint16_t sequence);
+
+/**
+ * @brief Reads the sequence number of an echo reply
+ *
+ * @return false if the packet is too short or no echo reply
+ */
+bool read_echo_reply(const Echo_Socket &socket, const Received_Packet &reply,
+                     uint16_t &sequence);
+
+/**
+ * @brief Hands every reply waiting on a socket to a handler
+ *
+ * A short batch means the socket has been drained, which is all the edge
+ * triggered readiness needs before the next edge.
+ */
+template <typename Handler>
+void receive_echo_replies(Packet_IO &io, Handler &&handle) {
+  size_t received;
+  do {
+    received = io.receive();
+    for (size_t i = 0; i < received; ++i) {
+      handle(io.packet(i));
+    }
+  } while (received == io.batch_size());
+}
+} // namespace pico_ping
@@ -0,0 +1,35 @@
+/**
+ * @file event_fd.cpp
+ * @ingroup Ping_Service
+ * @brief Signalling through eventfds, shared by every thread handing off work
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "event_fd.h"
+
+namespace pico_ping {
+
+bool signal_eventfd(int fd) {
+  uint64_t one = 1;
+  ssize_t written;
+  do {
+    written = write(fd, &one, sizeof(one));
+  } while (written < 0 && errno == EINTR);
+  return written == sizeof(one) || (written < 0 && errno == EAGAIN);
+}
+
+bool read_eventfd(int fd, uint64_t &count) {
+  ssize_t bytes;
+  do {
+    bytes = read(fd, &count, sizeof(count));
+  } while (bytes < 0 && errno == EINTR);
+  return bytes == sizeof(count);
+}
+} // namespace pico_ping
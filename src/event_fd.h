@@ -0,0 +1,38 @@
+/**
+ * @file event_fd.h
+ * @ingroup Ping_Service
+ * @brief Signalling through eventfds, shared by every thread handing off work
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace pico_ping {
+
+/**
+ * @brief Adds one to an eventfd's counter, waking whoever waits on it
+ *
+ * Interrupted writes are retried. A non-blocking eventfd whose counter is
+ * full is already readable, so that counts as signalled.
+ *
+ * @return false if the eventfd could not be written
+ */
+bool signal_eventfd(int fd);
+
+/**
+ * @brief Takes an eventfd's counter, waiting for it if the eventfd blocks
+ *
+ * Interrupted reads are retried. Timerfds are read the same way, their
+ * counter holds the expirations.
+ *
+ * @param[out] count Signals since the last read
+ *
+ * @return false if nothing was read, also if a non-blocking eventfd was not
+ * signalled
+ */
+bool read_eventfd(int fd, uint64_t &count);
+} // namespace pico_ping
@@ -0,0 +1,146 @@
+/**
+ * @file event_loop.cpp
+ * @ingroup Ping_Service
+ * @brief epoll based reactor owning every descriptor of a service
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "event_loop.h"
+
+namespace pico_ping {
+
+// Upper bound of events handled per epoll_wait call
+static constexpr int max_events = 64;
+
+Event_Loop::Event_Loop(Virtual_Clock *clock)
+    : clock_(clock), epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epoll_fd_ < 0) {
+    throw std::runtime_error("Unable to create event loop");
+  }
+}
+
+Event_Loop::~Event_Loop() {
+  for (auto &entry : handlers_) {
+    if (clock_ != nullptr) {
+      clock_->remove_timer(entry.first);
+    }
+    close(entry.first);
+  }
+  close(epoll_fd_);
+}
+
+void Event_Loop::add(int fd, uint32_t events, Handler handler) {
+  auto owned = std::make_unique<Handler>(std::move(handler));
+
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.ptr = owned.get();
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    if (clock_ != nullptr) {
+      clock_->remove_timer(fd);
+    }
+    close(fd);
+    throw std::runtime_error("Unable to watch descriptor");
+  }
+  handlers_[fd] = std::move(owned);
+}
+
+void Event_Loop::modify(int fd, uint32_t events) {
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.ptr = handlers_.at(fd).get();
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+}
+
+void Event_Loop::remove(int fd) {
+  if (clock_ != nullptr) {
+    clock_->remove_timer(fd);
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  handlers_.erase(fd);
+}
+
+int Event_Loop::add_timer(std::function<void()> handler) {
+  // Virtual timers are eventfds, read just the same as timerfds
+  int timer = clock_ != nullptr
+                  ? clock_->add_timer()
+                  : timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer < 0) {
+    throw std::runtime_error("Unable to create timer");
+  }
+
+  add(timer, EPOLLIN, [timer, handler = std::move(handler)](uint32_t) {
+    uint64_t expirations;
+    if (read(timer, &expirations, sizeof(expirations)) > 0) {
+      handler();
+    }
+  });
+  return timer;
+}
+
+void Event_Loop::arm_timer(int timer, time_point<steady_clock> deadline) {
+  if (clock_ != nullptr) {
+    clock_->arm_timer(timer, deadline);
+    return;
+  }
+  auto ns = duration_cast<nanoseconds>(deadline.time_since_epoch()).count();
+
+  // A zero it_value disarms the timer, so clamp to the earliest valid time
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  if (ns <= 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void Event_Loop::disarm_timer(int timer) {
+  if (clock_ != nullptr) {
+    clock_->disarm_timer(timer);
+    return;
+  }
+  struct itimerspec spec = {};
+  timerfd_settime(timer, 0, &spec, nullptr);
+}
+
+int Event_Loop::run_once(int timeout_ms) {
+  struct epoll_event events[max_events];
+
+  int ready;
+  if (clock_ == nullptr) {
+    ready = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+  } else {
+    // Simulated time only moves on once everything due now was handled
+    ready = epoll_wait(epoll_fd_, events, max_events, 0);
+    while (ready == 0 && clock_->advance()) {
+      ready = epoll_wait(epoll_fd_, events, max_events, 0);
+    }
+    if (ready == 0) {
+      ready = epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+    }
+  }
+  if (ready < 0) {
+    // Signals interrupt the wait without being an error
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw std::runtime_error("Event loop wait failed");
+  }
+
+  for (int i = 0; i < ready; ++i) {
+    (*static_cast<Handler *>(events[i].data.ptr))(events[i].events);
+  }
+  return ready;
+}
+} // namespace pico_ping
@@ -0,0 +1,133 @@
+/**
+ * @file event_loop.h
+ * @ingroup Ping_Service
+ * @brief epoll based reactor owning every descriptor of a service
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+
+#include "virtual_clock.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Single threaded reactor dispatching readiness events to handlers
+ *
+ * Every descriptor added to the loop is owned by it and closed when it is
+ * removed or the loop is destroyed. Timers are timerfds on CLOCK_MONOTONIC,
+ * the clock behind steady_clock, and are armed with absolute deadlines so
+ * they never drift by the time spent handling events.
+ *
+ * Given a Virtual_Clock the timers run on simulated time instead: whenever no
+ * descriptor is ready the clock jumps to the next deadline, so the loop never
+ * sleeps while a timer is armed.
+ */
+class Event_Loop {
+public:
+  /**
+   * @brief Callback invoked with the epoll event mask that became ready
+   */
+  using Handler = std::function<void(uint32_t events)>;
+
+  /**
+   * @brief Create the epoll instance
+   *
+   * @param[in] clock Simulated time to run timers on, null for real time.
+   * Must outlive the loop
+   *
+   * @throw std::runtime_error if the epoll instance cannot be created
+   */
+  explicit Event_Loop(Virtual_Clock *clock = nullptr);
+  ~Event_Loop();
+
+  Event_Loop(const Event_Loop &) = delete;
+  Event_Loop &operator=(const Event_Loop &) = delete;
+
+  /**
+   * @brief Takes ownership of a descriptor and watches it for events
+   *
+   * @param[in] fd Descriptor to watch, closed by the loop from now on
+   * @param[in] events epoll event mask such as EPOLLIN | EPOLLET
+   * @param[in] handler Called from run_once whenever the descriptor is ready
+   *
+   * @throw std::runtime_error if epoll refuses the descriptor
+   */
+  void add(int fd, uint32_t events, Handler handler);
+
+  /**
+   * @brief Changes the events a descriptor is watched for
+   *
+   * @param[in] fd Descriptor previously added to the loop
+   * @param[in] events New epoll event mask
+   */
+  void modify(int fd, uint32_t events);
+
+  /**
+   * @brief Stops watching a descriptor and closes it
+   *
+   * Must not be called from a handler while other events of the same
+   * run_once batch may still refer to the descriptor.
+   */
+  void remove(int fd);
+
+  /**
+   * @brief Creates a disarmed timer owned by the loop
+   *
+   * The expiration count is consumed before the handler is called.
+   *
+   * @param[in] handler Called from run_once whenever the timer fires
+   *
+   * @return Timer descriptor used to arm the timer
+   *
+   * @throw std::runtime_error if the timer cannot be created
+   */
+  int add_timer(std::function<void()> handler);
+
+  /**
+   * @brief Arms a timer to fire once at an absolute deadline
+   *
+   * Deadlines in the past fire immediately.
+   */
+  void arm_timer(int timer, time_point<steady_clock> deadline);
+
+  /**
+   * @brief Stops a timer from firing until it is armed again
+   */
+  void disarm_timer(int timer);
+
+  /**
+   * @brief Waits for events and dispatches them to their handlers
+   *
+   * @param[in] timeout_ms Longest time to wait, -1 waits indefinitely. With a
+   * virtual clock only waited for once no timer is armed anymore
+   *
+   * @return Number of events dispatched
+   */
+  int run_once(int timeout_ms = -1);
+
+  /**
+   * @brief The epoll descriptor, readable whenever run_once has events to
+   * dispatch
+   */
+  int fd() const { return epoll_fd_; }
+
+private:
+  Virtual_Clock *clock_;
+  int epoll_fd_;
+  // Handlers are heap allocated so epoll can keep a stable pointer to them
+  std::unordered_map<int, std::unique_ptr<Handler>> handlers_;
+};
+} // namespace pico_ping
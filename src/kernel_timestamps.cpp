@@ -0,0 +1,125 @@
+/**
+ * @file kernel_timestamps.cpp
+ * @ingroup Ping_Service
+ * @brief Kernel transmit and receive timestamps through SO_TIMESTAMPING, and
+ * the hop limit replies arrive with
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "kernel_timestamps.h"
+
+namespace pico_ping {
+
+static int64_t to_ns(const struct timespec &ts) {
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void enable_kernel_timestamps(int sock) {
+  int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+              SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+              SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE |
+              SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+  if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) <
+      0) {
+    throw std::runtime_error("Unable to enable kernel timestamps");
+  }
+}
+
+bool read_kernel_time(const struct msghdr &msg, Kernel_Time &time) {
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&msg), cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SO_TIMESTAMPING) {
+      auto stamps =
+          reinterpret_cast<const struct scm_timestamping *>(CMSG_DATA(cmsg));
+      // Index 1 is a deprecated legacy field, 2 is the raw hardware clock
+      time.software_ns = to_ns(stamps->ts[0]);
+      time.hardware_ns = to_ns(stamps->ts[2]);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool read_tx_timestamp(int sock, uint32_t &key, Kernel_Time &time) {
+  unsigned char control[kernel_time_control_size];
+  struct msghdr msg = {};
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  // Other queued errors carry no timestamp, keep reading past them
+  while (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0) {
+    bool has_time = read_kernel_time(msg, time);
+
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      bool recverr =
+          (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+          (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+      if (!recverr) {
+        continue;
+      }
+      auto err =
+          reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(cmsg));
+      if (has_time && err->ee_errno == ENOMSG &&
+          err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+        key = err->ee_data;
+        return true;
+      }
+    }
+    msg.msg_controllen = sizeof(control);
+  }
+  return false;
+}
+
+bool kernel_rtt(const Kernel_Time &sent, const Kernel_Time &received,
+                double &rtt) {
+  int64_t elapsed;
+  if (sent.hardware_ns != 0 && received.hardware_ns != 0) {
+    elapsed = received.hardware_ns - sent.hardware_ns;
+  } else if (sent.software_ns != 0 && received.software_ns != 0) {
+    elapsed = received.software_ns - sent.software_ns;
+  } else {
+    return false;
+  }
+  rtt = elapsed / 1e6;
+  return true;
+}
+
+void enable_reply_ttl(int sock, int family) {
+  int on = 1;
+  int rc = family == AF_INET6
+               ? setsockopt(sock, SOL_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on))
+               : setsockopt(sock, SOL_IP, IP_RECVTTL, &on, sizeof(on));
+  if (rc < 0) {
+    throw std::runtime_error("Unable to enable reply TTL");
+  }
+}
+
+bool read_reply_ttl(const struct msghdr &msg, uint8_t &ttl) {
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&msg), cmsg)) {
+    bool hop_limit =
+        (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_TTL) ||
+        (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT);
+    if (hop_limit) {
+      int value;
+      std::memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+      ttl = static_cast<uint8_t>(value);
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace pico_ping
@@ -0,0 +1,109 @@
+/**
+ * @file kernel_timestamps.h
+ * @ingroup Ping_Service
+ * @brief Kernel transmit and receive timestamps through SO_TIMESTAMPING, and
+ * the hop limit replies arrive with
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Timestamp taken by the kernel, zero where a source is unavailable
+ *
+ * Software timestamps use CLOCK_REALTIME, hardware timestamps come from the
+ * NIC clock, so only timestamps of the same source may be subtracted.
+ */
+struct Kernel_Time {
+  int64_t software_ns = 0;
+  int64_t hardware_ns = 0;
+};
+
+/**
+ * @brief Bytes of ancillary data needed to receive one timestamp message
+ */
+constexpr size_t kernel_time_control_size = 256;
+
+/**
+ * @brief Requests software and, where supported, hardware timestamps
+ *
+ * Receive timestamps are attached to every datagram as a control message.
+ * Transmit timestamps are queued on the socket error queue without the packet
+ * payload, keyed by a counter that increases by one per datagram sent.
+ *
+ * @param[in] sock Socket to enable timestamping on
+ *
+ * @throw std::runtime_error if the kernel rejects the socket option
+ */
+void enable_kernel_timestamps(int sock);
+
+/**
+ * @brief Extracts the kernel timestamp from a received message
+ *
+ * @param[in] msg Message header filled by recvmsg or recvmmsg
+ * @param[out] time Timestamps found in the control messages
+ *
+ * @return true if the message carried a timestamp
+ */
+bool read_kernel_time(const struct msghdr &msg, Kernel_Time &time);
+
+/**
+ * @brief Reads one transmit timestamp from the socket error queue
+ *
+ * @param[in] sock Socket with timestamping enabled
+ * @param[out] key Send counter of the datagram the timestamp belongs to
+ * @param[out] time Transmit timestamps
+ *
+ * @return false once the error queue holds no more timestamps
+ */
+bool read_tx_timestamp(int sock, uint32_t &key, Kernel_Time &time);
+
+/**
+ * @brief Elapsed time between two kernel timestamps in milliseconds
+ *
+ * Hardware timestamps are preferred when both sides have one.
+ *
+ * @param[in] sent Transmit timestamps
+ * @param[in] received Receive timestamps
+ * @param[out] rtt Difference in milliseconds
+ *
+ * @return false if no source is present on both sides
+ */
+bool kernel_rtt(const Kernel_Time &sent, const Kernel_Time &received,
+                double &rtt);
+
+/**
+ * @brief Bytes of ancillary data needed to receive the hop limit of a reply
+ */
+constexpr size_t reply_ttl_control_size = CMSG_SPACE(sizeof(int));
+
+/**
+ * @brief Requests the IP TTL or IPv6 hop limit of every received datagram
+ *
+ * @param[in] sock Socket to enable it on
+ * @param[in] family AF_INET or AF_INET6
+ *
+ * @throw std::runtime_error if the kernel rejects the socket option
+ */
+void enable_reply_ttl(int sock, int family);
+
+/**
+ * @brief Extracts the TTL or hop limit from a received message
+ *
+ * @param[in] msg Message header filled by recvmsg or recvmmsg
+ * @param[out] ttl Hop limit the datagram arrived with
+ *
+ * @return true if the message carried one
+ */
+bool read_reply_ttl(const struct msghdr &msg, uint8_t &ttl);
+} // namespace pico_ping
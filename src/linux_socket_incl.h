@@ -12,6 +12,6 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/icmp6.h>
 #include <netinet/ip_icmp.h>
-#include <sys/select.h>
 #include <sys/socket.h>
\ No newline at end of file
@@ -0,0 +1,77 @@
+/**
+ * @file output_buffer.cpp
+ * @ingroup Ping_Service
+ * @brief Allocation free formatting of per probe output into batched writes
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+
+#include "output_buffer.h"
+
+namespace pico_ping {
+
+Output_Buffer::Output_Buffer(int fd, size_t capacity, Async_Writer *writer)
+    : fd_(fd), writer_(writer), data_(std::max<size_t>(capacity, 64)) {}
+
+Output_Buffer &Output_Buffer::text(std::string_view text) {
+  while (!text.empty()) {
+    if (size_ == capacity()) {
+      flush();
+    }
+    auto length = std::min(text.size(), capacity() - size_);
+    std::memcpy(data_.data() + size_, text.data(), length);
+    size_ += length;
+    text.remove_prefix(length);
+  }
+  return *this;
+}
+
+Output_Buffer &Output_Buffer::number(uint64_t value) {
+  // 20 digits hold any 64 bit value
+  reserve(20);
+  auto end = data_.data() + capacity();
+  size_ = static_cast<size_t>(
+      std::to_chars(data_.data() + size_, end, value).ptr - data_.data());
+  return *this;
+}
+
+Output_Buffer &Output_Buffer::fixed(double value, int precision) {
+  // Round trip through a local buffer, fixed notation of a large double
+  // runs to hundreds of digits
+  char digits[384];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value,
+                              std::chars_format::fixed, precision);
+  if (result.ec != std::errc()) {
+    return text("nan");
+  }
+  return text({digits, static_cast<size_t>(result.ptr - digits)});
+}
+
+void Output_Buffer::flush() {
+  if (writer_ && size_ > 0) {
+    writer_->push(view());
+    size_ = 0;
+    return;
+  }
+
+  size_t written = 0;
+  while (fd_ >= 0 && written < size_) {
+    auto rc = write(fd_, data_.data() + written, size_ - written);
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    written += static_cast<size_t>(rc);
+  }
+  size_ = 0;
+}
+} // namespace pico_ping
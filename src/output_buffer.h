@@ -0,0 +1,102 @@
+/**
+ * @file output_buffer.h
+ * @ingroup Ping_Service
+ * @brief Allocation free formatting of per probe output into batched writes
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "async_writer.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Formats text and numbers into one large buffer written out in bulk
+ *
+ * Numbers are formatted with std::to_chars straight into the buffer, so
+ * unlike an ostream nothing consults the locale or allocates. The buffer is
+ * only written when flush is called or when it runs out of room, which makes
+ * the cost of a write system call shared by every line of a batch. Writes
+ * always end on a line boundary as long as callers reserve room for a whole
+ * line before composing it, so lines stay whole when several writers share
+ * a descriptor. Given an Async_Writer, flushing only queues the bytes for
+ * its thread and the caller never waits on the descriptor.
+ */
+class Output_Buffer {
+public:
+  /**
+   * @brief Construct an empty buffer
+   *
+   * @param[in] fd Descriptor flushed to, not owned. -1 discards the output
+   * @param[in] capacity Bytes buffered before a write is forced
+   * @param[in] writer Flushes go to this writer instead of fd if given, not
+   * owned
+   */
+  explicit Output_Buffer(int fd = STDOUT_FILENO, size_t capacity = 64 * 1024,
+                         Async_Writer *writer = nullptr);
+
+  Output_Buffer(const Output_Buffer &) = delete;
+  Output_Buffer &operator=(const Output_Buffer &) = delete;
+
+  /**
+   * @brief Makes sure the next bytes fit without a write in between
+   *
+   * Flushes if fewer than length bytes are free, called before composing a
+   * line so the line is never split over two writes.
+   */
+  void reserve(size_t length) {
+    if (capacity() - size_ < length) {
+      flush();
+    }
+  }
+
+  Output_Buffer &text(std::string_view text);
+  Output_Buffer &character(char c) {
+    if (size_ == capacity()) {
+      flush();
+    }
+    data_[size_++] = c;
+    return *this;
+  }
+  Output_Buffer &number(uint64_t value);
+  /**
+   * @brief Appends a number in fixed notation
+   *
+   * @param[in] value Number to format
+   * @param[in] precision Digits after the decimal point
+   */
+  Output_Buffer &fixed(double value, int precision = 2);
+
+  /**
+   * @brief Writes out everything buffered, retrying short writes
+   *
+   * Output that cannot be written, e.g. to a closed pipe, is dropped. With
+   * a writer the bytes are only queued, see Async_Writer::push.
+   */
+  void flush();
+
+  /**
+   * @brief Buffered bytes not written yet
+   */
+  std::string_view view() const { return {data_.data(), size_}; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return data_.size(); }
+  int fd() const { return fd_; }
+
+private:
+  int fd_;
+  Async_Writer *writer_;
+  std::vector<char> data_;
+  size_t size_ = 0;
+};
+} // namespace pico_ping
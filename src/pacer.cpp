@@ -0,0 +1,39 @@
+/**
+ * @file pacer.cpp
+ * @ingroup Ping_Service
+ * @brief Token bucket pacing probes on an absolute deadline schedule
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+
+#include "pacer.h"
+
+namespace pico_ping {
+
+Pacer::Pacer(nanoseconds period, size_t burst)
+    : period_(std::max(period, nanoseconds(1))),
+      burst_(std::max(burst, size_t(1))) {}
+
+void Pacer::start(time_point<steady_clock> now) {
+  next_ = now;
+  tokens_ = 0;
+}
+
+size_t Pacer::take(time_point<steady_clock> now, size_t wanted) {
+  // Credit every deadline that passed, computed rather than looped so tiny
+  // periods stay cheap
+  if (now >= next_) {
+    auto due = static_cast<size_t>((now - next_) / period_) + 1;
+    tokens_ = std::min(tokens_ + due, burst_);
+    next_ += due * period_;
+  }
+
+  auto taken = std::min(tokens_, wanted);
+  tokens_ -= taken;
+  return taken;
+}
+} // namespace pico_ping
@@ -0,0 +1,69 @@
+/**
+ * @file pacer.h
+ * @ingroup Ping_Service
+ * @brief Token bucket pacing probes on an absolute deadline schedule
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Hands out send tokens at a fixed rate
+ *
+ * Tokens are credited on an absolute schedule, the n-th one at start time
+ * plus n periods, no matter when take is called. Time spent processing
+ * replies therefore delays sends without lowering the rate: the tokens that
+ * accrued meanwhile are taken in one go by the next call. The bucket holds at
+ * most burst tokens so a long stall does not turn into an unbounded burst,
+ * tokens beyond that are dropped but the schedule itself does not shift.
+ */
+class Pacer {
+public:
+  Pacer() = default;
+
+  /**
+   * @brief Construct a pacer crediting one token per period
+   *
+   * @param[in] period Time between two tokens, at least one nanosecond
+   * @param[in] burst Most tokens held at once, at least one
+   */
+  Pacer(nanoseconds period, size_t burst);
+
+  /**
+   * @brief Starts the schedule, the first token is credited at now
+   */
+  void start(time_point<steady_clock> now);
+
+  /**
+   * @brief Takes the tokens that have accrued up to now
+   *
+   * @param[in] now Current time
+   * @param[in] wanted Most tokens to take
+   *
+   * @return Number of probes that may be sent now
+   */
+  size_t take(time_point<steady_clock> now, size_t wanted);
+
+  /**
+   * @brief Absolute time the next token is credited at
+   */
+  time_point<steady_clock> next_deadline() const { return next_; }
+
+  nanoseconds period() const { return period_; }
+
+private:
+  nanoseconds period_ = nanoseconds(1);
+  size_t burst_ = 1;
+  size_t tokens_ = 0;
+  time_point<steady_clock> next_;
+};
+} // namespace pico_ping
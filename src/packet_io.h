@@ -0,0 +1,135 @@
+/**
+ * @file packet_io.h
+ * @ingroup Ping_Service
+ * @brief Interface of the batched packet I/O backends
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "socket_address.h"
+
+namespace pico_ping {
+
+/**
+ * @brief A datagram read by Packet_IO::receive, valid until the next receive
+ */
+struct Received_Packet {
+  const unsigned char *data;
+  size_t length;
+  const Socket_Address *from;
+  // Header including any control messages, for ancillary data like timestamps
+  const struct msghdr *header;
+};
+
+/**
+ * @brief Queues outgoing datagrams and exchanges them with the kernel in
+ * batches
+ *
+ * Every queued datagram carries a caller defined cookie, after a flush the
+ * cookies of the datagrams that actually went out are available in send
+ * order. Backends allocate all buffers up front so none of the calls below
+ * allocate.
+ */
+class Packet_IO {
+public:
+  virtual ~Packet_IO() = default;
+
+  /**
+   * @brief Queues a datagram made of a copied head and a referenced tail
+   *
+   * Only the head is copied into the send slot, the tail is sent straight from
+   * the caller's memory, which must stay unchanged until the next flush. This
+   * lets large datagrams that only differ in their first bytes share one
+   * buffer. Must only be called while the batch is not full, flush first
+   * otherwise.
+   *
+   * @param[in] head Leading bytes of the datagram
+   * @param[in] head_length Number of head bytes, truncated to the packet size
+   * @param[in] tail Remaining bytes of the datagram, may be null if empty
+   * @param[in] tail_length Number of tail bytes, truncated so the datagram
+   * fits the packet size
+   * @param[in] dest Destination address
+   * @param[in] cookie Value identifying the datagram after the flush
+   */
+  virtual void queue(const void *head, size_t head_length, const void *tail,
+                     size_t tail_length, const Socket_Address &dest,
+                     uint64_t cookie) = 0;
+
+  /**
+   * @brief Copies a whole datagram into the next send slot
+   *
+   * @param[in] packet Datagram contents
+   * @param[in] length Number of bytes, truncated to the packet size
+   * @param[in] dest Destination address
+   * @param[in] cookie Value identifying the datagram after the flush
+   */
+  void queue(const void *packet, size_t length, const Socket_Address &dest,
+             uint64_t cookie = 0) {
+    queue(packet, length, nullptr, 0, dest, cookie);
+  }
+
+  virtual bool full() const = 0;
+
+  /**
+   * @brief Sends every queued datagram
+   *
+   * Datagrams the kernel refuses are skipped so the rest of the batch still
+   * goes out.
+   *
+   * @return Number of queued datagrams that could not be sent
+   */
+  virtual size_t flush() = 0;
+
+  /**
+   * @brief Number of datagrams the last flush handed to the kernel
+   */
+  virtual size_t sent_count() const = 0;
+
+  /**
+   * @brief Cookie of a datagram sent by the last flush, in send order
+   *
+   * @param[in] index Position among the sent datagrams
+   */
+  virtual uint64_t sent_cookie(size_t index) const = 0;
+
+  /**
+   * @brief Reads up to one batch of datagrams without blocking
+   *
+   * A batch shorter than batch_size means nothing more is waiting.
+   *
+   * @return Number of datagrams read, accessible through packet()
+   */
+  virtual size_t receive() = 0;
+
+  /**
+   * @brief Accesses a datagram read by the last receive
+   *
+   * @param[in] index Position in the batch, less than the receive result
+   */
+  virtual Received_Packet packet(size_t index) const = 0;
+
+  virtual size_t batch_size() const = 0;
+
+  /**
+   * @brief Whether replies were already collected without event_fd signalling
+   *
+   * Backends that reap send and receive completions together may pick up
+   * replies during a flush, these have to be fetched with receive before
+   * waiting on event_fd again.
+   */
+  virtual bool receive_pending() const { return false; }
+
+  /**
+   * @brief Descriptor that becomes readable when receive has work to do
+   *
+   * The descriptor stays owned by the backend.
+   */
+  virtual int event_fd() const = 0;
+};
+} // namespace pico_ping
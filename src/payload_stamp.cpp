@@ -0,0 +1,46 @@
+/**
+ * @file payload_stamp.cpp
+ * @ingroup Ping_Service
+ * @brief Send timestamp carried in the echo payload
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstring>
+
+#include "payload_stamp.h"
+
+namespace pico_ping {
+
+// Tells stamped payloads apart from replies to other pingers on the host
+static constexpr uint32_t stamp_magic = 0x7069636f;
+
+void write_payload_stamp(unsigned char *payload, const Payload_Stamp &stamp) {
+  int64_t sent_ns = duration_cast<nanoseconds>(stamp.sent.time_since_epoch())
+                        .count();
+  std::memcpy(payload, &stamp_magic, 4);
+  std::memcpy(payload + 4, &stamp.target, 4);
+  std::memcpy(payload + 8, &sent_ns, 8);
+}
+
+bool read_payload_stamp(const unsigned char *payload, size_t length,
+                        Payload_Stamp &stamp) {
+  uint32_t magic;
+  if (length < payload_stamp_size) {
+    return false;
+  }
+  std::memcpy(&magic, payload, 4);
+  if (magic != stamp_magic) {
+    return false;
+  }
+
+  int64_t sent_ns;
+  std::memcpy(&stamp.target, payload + 4, 4);
+  std::memcpy(&sent_ns, payload + 8, 8);
+  stamp.sent = time_point<steady_clock>(
+      duration_cast<steady_clock::duration>(nanoseconds(sent_ns)));
+  return true;
+}
+} // namespace pico_ping
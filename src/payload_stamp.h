@@ -0,0 +1,58 @@
+/**
+ * @file payload_stamp.h
+ * @ingroup Ping_Service
+ * @brief Send timestamp carried in the echo payload
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief What a probe tells about itself in its payload
+ *
+ * The destination echoes the payload untouched, so a reply carries everything
+ * needed to compute its RTT without looking up the probe it answers.
+ */
+struct Payload_Stamp {
+  uint32_t target = 0;
+  time_point<steady_clock> sent;
+};
+
+/**
+ * @brief Bytes a stamp takes up in the payload
+ *
+ * Layout is a magic value, the target index and the monotonic send time in
+ * nanoseconds, all in host byte order since only this host reads them back.
+ */
+constexpr size_t payload_stamp_size = 16;
+
+/**
+ * @brief Writes a stamp to the start of an echo payload
+ *
+ * @param[out] payload At least payload_stamp_size bytes
+ * @param[in] stamp Stamp to write
+ */
+void write_payload_stamp(unsigned char *payload, const Payload_Stamp &stamp);
+
+/**
+ * @brief Reads a stamp back from an echoed payload
+ *
+ * @param[in] payload Payload of the echo reply
+ * @param[in] length Bytes of payload
+ * @param[out] stamp Stamp found in the payload
+ *
+ * @return false if the payload is too short or does not carry a stamp
+ */
+bool read_payload_stamp(const unsigned char *payload, size_t length,
+                        Payload_Stamp &stamp);
+} // namespace pico_ping
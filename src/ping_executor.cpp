@@ -0,0 +1,228 @@
+/**
+ * @file ping_executor.cpp
+ * @ingroup Ping_Service
+ * @brief Ping sessions written as C++20 coroutines awaiting probe results
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "ping_executor.h"
+
+namespace pico_ping {
+
+// Every frame is preceded by its pool, null for heap frames
+static constexpr size_t frame_header = alignof(std::max_align_t);
+
+// Equally sized frames and the indices of the free ones. Owned by the
+// executor and every frame taken from it, so sessions created but never
+// spawned may outlive their executor
+struct Ping_Executor::Frame_Pool {
+  size_t frame_size;
+  std::vector<unsigned char> frames;
+  std::vector<uint32_t> free;
+  size_t owners = 1;
+
+  void *allocate(size_t size) {
+    if (size > frame_size || free.empty()) {
+      return nullptr;
+    }
+    auto index = free.back();
+    free.pop_back();
+    ++owners;
+    return frames.data() + index * frame_size;
+  }
+
+  void release() {
+    if (--owners == 0) {
+      delete this;
+    }
+  }
+};
+
+void *Ping_Session::promise_type::allocate(size_t size,
+                                          Ping_Executor *executor) {
+  Ping_Executor::Frame_Pool *pool = nullptr;
+  void *block = nullptr;
+  if (executor != nullptr) {
+    pool = executor->frames_;
+    block = pool->allocate(size + frame_header);
+    if (block == nullptr) {
+      pool = nullptr;
+      ++executor->heap_frames_;
+    }
+  }
+  if (block == nullptr) {
+    block = ::operator new(size + frame_header);
+  }
+  std::memcpy(block, &pool, sizeof(pool));
+  return static_cast<unsigned char *>(block) + frame_header;
+}
+
+void Ping_Session::promise_type::operator delete(void *frame, size_t) {
+  auto block = static_cast<unsigned char *>(frame) - frame_header;
+  Ping_Executor::Frame_Pool *pool;
+  std::memcpy(&pool, block, sizeof(pool));
+  if (pool == nullptr) {
+    ::operator delete(block);
+    return;
+  }
+  pool->free.push_back(
+      static_cast<uint32_t>((block - pool->frames.data()) / pool->frame_size));
+  pool->release();
+}
+
+void Ping_Session::promise_type::unhandled_exception() {
+  executor->error_ = std::current_exception();
+}
+
+// Returning frees the session at once, nothing awaits it
+void Ping_Session::promise_type::Final_Awaiter::await_suspend(
+    std::coroutine_handle<promise_type> handle) noexcept {
+  handle.promise().executor->finish(handle.promise());
+}
+
+void Ping_Executor::Ping_Awaitable::await_suspend(
+    std::coroutine_handle<> handle) {
+  this->handle = handle;
+  executor_.submit(*this);
+}
+
+void Ping_Executor::Sleep_Awaitable::await_suspend(
+    std::coroutine_handle<> handle) {
+  this->handle = handle;
+  executor_.add_sleeper(*this);
+}
+
+Engine_Options Ping_Executor::engine_options(const Engine_Options &options,
+                                             Ping_Executor *executor) {
+  auto taken = options;
+  taken.on_result = [executor](const Probe_Result &result) {
+    executor->on_result(result);
+  };
+  return taken;
+}
+
+Ping_Executor::Ping_Executor(const Engine_Options &options,
+                             size_t max_sessions, size_t frame_size)
+    : engine_(engine_options(options, this)),
+      sleepers_(max_sessions, milliseconds(1), engine_.now()),
+      max_sessions_(max_sessions) {
+  if (max_sessions_ == 0 || max_sessions_ > UINT32_MAX) {
+    throw std::invalid_argument("Sessions out of range.");
+  }
+  sleep_timer_ = engine_.loop().add_timer([this] { wake_sleepers(); });
+
+  auto pool = std::make_unique<Frame_Pool>();
+  // Rounded up so every frame stays aligned like the pool itself
+  pool->frame_size =
+      (frame_size + frame_header - 1) / frame_header * frame_header;
+  pool->frames.resize(max_sessions_ * pool->frame_size);
+  pool->free.reserve(max_sessions_);
+  for (size_t i = max_sessions_; i > 0; --i) {
+    pool->free.push_back(static_cast<uint32_t>(i - 1));
+  }
+  frames_ = pool.release();
+}
+
+Ping_Executor::~Ping_Executor() {
+  while (live_ != nullptr) {
+    auto promise = live_;
+    live_ = promise->next;
+    std::coroutine_handle<Ping_Session::promise_type>::from_promise(*promise)
+        .destroy();
+  }
+  frames_->release();
+}
+
+void Ping_Executor::spawn(Ping_Session session) {
+  if (sessions_ == max_sessions_) {
+    throw std::runtime_error("Too many ping sessions.");
+  }
+  auto handle = std::exchange(session.handle_, nullptr);
+  auto &promise = handle.promise();
+  promise.executor = this;
+  promise.start.handle = handle;
+  promise.next = live_;
+  if (live_ != nullptr) {
+    live_->previous = &promise;
+  }
+  live_ = &promise;
+  ++sessions_;
+  ready_.push(&promise.start);
+}
+
+void Ping_Executor::run() {
+  while (sessions_ > 0) {
+    while (!ready_.empty()) {
+      ready_.pop()->handle.resume();
+      if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+      }
+    }
+    if (sessions_ > 0) {
+      engine_.run_once();
+    }
+  }
+}
+
+// Pings finding every slot taken wait for the next probe to complete
+void Ping_Executor::submit(Ping_Awaitable &ping) {
+  if (engine_.submit(ping.target_, ping.timeout_, &ping) ==
+      Probe_Engine::no_probe) {
+    blocked_.push(&ping);
+  }
+}
+
+// Called from the engine, sessions are only resumed from run
+void Ping_Executor::on_result(const Probe_Result &result) {
+  auto &ping = *static_cast<Ping_Awaitable *>(result.context);
+  ping.reply_.status = result.status;
+  ping.reply_.rtt = result.rtt;
+  ping.reply_.ttl = result.ttl;
+  ready_.push(&ping);
+
+  if (!blocked_.empty()) {
+    submit(*static_cast<Ping_Awaitable *>(blocked_.pop()));
+  }
+}
+
+// The wheel holds one timer per session, so it never runs full
+void Ping_Executor::add_sleeper(Sleep_Awaitable &sleeper) {
+  sleepers_.arm(sleeper.deadline_, reinterpret_cast<uintptr_t>(&sleeper));
+  if (!sleep_armed_ || sleeper.deadline_ < sleep_deadline_) {
+    sleep_armed_ = true;
+    sleep_deadline_ = sleeper.deadline_;
+    engine_.loop().arm_timer(sleep_timer_, sleep_deadline_);
+  }
+}
+
+void Ping_Executor::wake_sleepers() {
+  sleepers_.expire(engine_.now(), [this](uint64_t cookie) {
+    ready_.push(reinterpret_cast<Sleep_Awaitable *>(cookie));
+  });
+  sleep_armed_ = false;
+  if (!sleepers_.empty()) {
+    sleep_armed_ = true;
+    sleep_deadline_ = sleepers_.next_deadline();
+    engine_.loop().arm_timer(sleep_timer_, sleep_deadline_);
+  }
+}
+
+void Ping_Executor::finish(Ping_Session::promise_type &promise) {
+  (promise.previous ? promise.previous->next : live_) = promise.next;
+  if (promise.next != nullptr) {
+    promise.next->previous = promise.previous;
+  }
+  --sessions_;
+  std::coroutine_handle<Ping_Session::promise_type>::from_promise(promise)
+      .destroy();
+}
+} // namespace pico_ping
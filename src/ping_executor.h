@@ -0,0 +1,293 @@
+/**
+ * @file ping_executor.h
+ * @ingroup Ping_Service
+ * @brief Ping sessions written as C++20 coroutines awaiting probe results
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "probe_engine.h"
+#include "timer_wheel.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+class Ping_Executor;
+
+/**
+ * @brief What co_await Ping_Executor::ping resumes with
+ */
+struct Ping_Reply {
+  // reply or timeout
+  Probe_Status status = Probe_Status::timeout;
+  // Zero for timeouts
+  duration<double, std::milli> rtt{0};
+  // Hop limit the reply arrived with, zero if unknown
+  uint8_t ttl = 0;
+
+  explicit operator bool() const { return status == Probe_Status::reply; }
+};
+
+/**
+ * @brief Something a session waits for, linked into the executor's lists
+ * while it does so nothing is allocated to track it
+ */
+struct Executor_Waiter {
+  std::coroutine_handle<> handle;
+  Executor_Waiter *next = nullptr;
+};
+
+/**
+ * @brief Coroutine type of a ping session, started by Ping_Executor::spawn
+ *
+ * A session is any coroutine returning Ping_Session, it suspends until it is
+ * spawned and its frame is freed as soon as it returns. A session taking a
+ * Ping_Executor as its first parameter has its frame taken from that
+ * executor's pool, any other session from the heap.
+ */
+class Ping_Session {
+public:
+  struct promise_type {
+    Executor_Waiter start;
+    Ping_Executor *executor = nullptr;
+    // Sessions alive on the executor, freed with it if it stops early
+    promise_type *previous = nullptr;
+    promise_type *next = nullptr;
+
+    Ping_Session get_return_object() {
+      return Ping_Session(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct Final_Awaiter {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+      void await_resume() noexcept {}
+    };
+    Final_Awaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception();
+
+    template <typename... Args>
+    static void *operator new(size_t size, Ping_Executor &executor,
+                              Args &...) {
+      return allocate(size, &executor);
+    }
+    static void *operator new(size_t size) { return allocate(size, nullptr); }
+    static void operator delete(void *frame, size_t size);
+
+  private:
+    static void *allocate(size_t size, Ping_Executor *executor);
+  };
+
+  Ping_Session(Ping_Session &&other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  Ping_Session(const Ping_Session &) = delete;
+  Ping_Session &operator=(const Ping_Session &) = delete;
+  Ping_Session &operator=(Ping_Session &&) = delete;
+
+  /**
+   * @brief Frees the frame of a session that was never spawned
+   */
+  ~Ping_Session() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+private:
+  friend class Ping_Executor;
+  explicit Ping_Session(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * @brief Single threaded executor running ping sessions on a Probe_Engine
+ *
+ * Each session is a coroutine with its own sequencing, such as retries with
+ * backoff, and thousands of them run on one thread:
+ *
+ *     Ping_Session check(Ping_Executor &ex, Socket_Address host) {
+ *       for (auto backoff = seconds(1); backoff < seconds(60); backoff *= 2) {
+ *         if (auto reply = co_await ex.ping(host, seconds(1))) {
+ *           co_return;
+ *         }
+ *         co_await ex.sleep(backoff);
+ *       }
+ *     }
+ *     executor.spawn(check(executor, host));
+ *     executor.run();
+ *
+ * A session waiting on a probe or a sleep is linked into an intrusive list
+ * through the awaiter in its own frame, and frames come from a pool sized
+ * at construction, so no heap allocation happens per probe. Sessions whose
+ * result arrived are resumed from run in the order their results came in,
+ * never from inside the engine's event handling.
+ */
+class Ping_Executor {
+public:
+  /**
+   * @brief Awaiter of one probe, see ping
+   */
+  class Ping_Awaitable : Executor_Waiter {
+  public:
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    Ping_Reply await_resume() const { return reply_; }
+
+  private:
+    friend class Ping_Executor;
+    Ping_Awaitable(Ping_Executor &executor, const Socket_Address &target,
+                   nanoseconds timeout)
+        : executor_(executor), target_(target), timeout_(timeout) {}
+
+    Ping_Executor &executor_;
+    Socket_Address target_;
+    nanoseconds timeout_;
+    Ping_Reply reply_;
+  };
+
+  /**
+   * @brief Awaiter of a pause, see sleep
+   */
+  class Sleep_Awaitable : Executor_Waiter {
+  public:
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() const {}
+
+  private:
+    friend class Ping_Executor;
+    Sleep_Awaitable(Ping_Executor &executor,
+                    time_point<steady_clock> deadline)
+        : executor_(executor), deadline_(deadline) {}
+
+    Ping_Executor &executor_;
+    time_point<steady_clock> deadline_;
+  };
+
+  /**
+   * @brief Construct an executor, its engine and its pool of session frames
+   *
+   * @param[in] options Engine options, on_result is taken over by the
+   * executor
+   * @param[in] max_sessions Sessions alive at once
+   * @param[in] frame_size Bytes of each pooled frame, larger frames are
+   * taken from the heap
+   *
+   * @throw std::invalid_argument if max_sessions is zero or the engine
+   * options are out of range
+   * @throw std::runtime_error if the event loop cannot be created
+   */
+  explicit Ping_Executor(const Engine_Options &options = {},
+                         size_t max_sessions = 1024, size_t frame_size = 512);
+  /**
+   * @brief Frees the sessions still alive, e.g. after run threw. The frame
+   * pool stays until sessions created but never spawned freed theirs too
+   */
+  ~Ping_Executor();
+
+  Ping_Executor(const Ping_Executor &) = delete;
+  Ping_Executor &operator=(const Ping_Executor &) = delete;
+
+  /**
+   * @brief Sends an echo request once awaited and resumes with its outcome
+   *
+   * Waits for a free slot first if the engine has max_in_flight probes
+   * outstanding.
+   */
+  Ping_Awaitable ping(const Socket_Address &target, nanoseconds timeout) {
+    return Ping_Awaitable(*this, target, timeout);
+  }
+
+  /**
+   * @brief Resumes the awaiting session once the duration passed
+   */
+  Sleep_Awaitable sleep(nanoseconds duration) {
+    return Sleep_Awaitable(*this, engine_.now() + duration);
+  }
+
+  /**
+   * @brief Starts a session, it runs once run is called
+   *
+   * @throw std::runtime_error if max_sessions sessions are alive already
+   */
+  void spawn(Ping_Session session);
+
+  /**
+   * @brief Runs until every session returned
+   *
+   * @throw Whatever a session let escape, after that session was freed
+   */
+  void run();
+
+  size_t sessions() const { return sessions_; }
+  // Frames that did not fit the pool and were taken from the heap instead
+  uint64_t heap_frames() const { return heap_frames_; }
+  Probe_Engine &engine() { return engine_; }
+
+private:
+  friend struct Ping_Session::promise_type;
+
+  // Intrusive FIFO of waiters
+  struct Waiter_List {
+    Executor_Waiter *head = nullptr;
+    Executor_Waiter *tail = nullptr;
+
+    bool empty() const { return head == nullptr; }
+    void push(Executor_Waiter *waiter) {
+      waiter->next = nullptr;
+      (tail ? tail->next : head) = waiter;
+      tail = waiter;
+    }
+    Executor_Waiter *pop() {
+      auto waiter = head;
+      head = waiter->next;
+      if (!head) {
+        tail = nullptr;
+      }
+      return waiter;
+    }
+  };
+
+  static Engine_Options engine_options(const Engine_Options &options,
+                                       Ping_Executor *executor);
+  void submit(Ping_Awaitable &ping);
+  void on_result(const Probe_Result &result);
+  void add_sleeper(Sleep_Awaitable &sleeper);
+  void wake_sleepers();
+  void finish(Ping_Session::promise_type &promise);
+
+  Probe_Engine engine_;
+  Waiter_List ready_;
+  // Pings waiting for a free engine slot
+  Waiter_List blocked_;
+  Timer_Wheel sleepers_;
+  int sleep_timer_;
+  bool sleep_armed_ = false;
+  time_point<steady_clock> sleep_deadline_;
+  size_t max_sessions_;
+  size_t sessions_ = 0;
+  Ping_Session::promise_type *live_ = nullptr;
+  // Shared with the frames taken from it, see ping_executor.cpp
+  struct Frame_Pool;
+  Frame_Pool *frames_;
+  uint64_t heap_frames_ = 0;
+  std::exception_ptr error_;
+};
+} // namespace pico_ping
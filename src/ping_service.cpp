@@ -10,131 +10,842 @@
  * Distributed under the Apache license and can be found in LICENSE.txt
  */
 
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
-#include <thread>
 
+#include "event_fd.h"
 #include "ping_service.h"
 
 namespace pico_ping {
 
 // Ensure that class is usable after construction
 Ping_Service::Ping_Service(const std::string &host, seconds timeout)
-    : timeout_(timeout) {
-  remote_dest_ = str_to_in_addr(host);
+    : Ping_Service(std::vector<std::string>{host}, timeout) {}
+
+// Resolve every destination before any socket resources are acquired
+Ping_Service::Ping_Service(const std::vector<std::string> &hosts,
+                           seconds timeout, const Ping_Options &options)
+    : options_(options),
+      transport_(options.transport
+                     ? options.transport
+                     : std::make_shared<Icmp_Transport>(options.io_backend)),
+      loop_(options.clock.get()), resolver_(options.dns_ttl),
+      timeout_(timeout),
+      writer_(options.async_output && options.output_fd >= 0
+                  ? std::make_unique<Async_Writer>(options.output_fd,
+                                                   options.output_queue_size,
+                                                   options.output_backpressure)
+                  : nullptr),
+      output_(options.output_fd, 64 * 1024, writer_.get()) {
+  if (hosts.empty() && options_.target_file.empty()) {
+    throw std::invalid_argument("No hosts given.");
+  }
+  if (options_.payload_size > max_payload_size ||
+      (options_.stamp_payload && options_.payload_size < payload_stamp_size)) {
+    throw std::invalid_argument("Payload size out of range.");
+  }
+
+  // The payload never changes between probes, only the bytes a stamp
+  // overwrites are rebuilt on every send
+  payload_ = echo_payload(options_.payload_size, options_.pattern);
+
+  // Each window has to hold every probe sent to a target within one timeout,
+  // plus some slack for the pacer catching up after a stall
+  auto interval = std::max(duration_cast<nanoseconds>(options_.interval),
+                           nanoseconds(1));
+  auto in_flight = static_cast<size_t>(timeout_ / interval) + 4;
+  Probe_Window window(in_flight);
+
+  targets_.reserve(hosts.size());
+  for (const auto &host : hosts) {
+    // Blocks and ranges are only expanded once probing starts
+    Address_Range range;
+    if (parse_address_range(host, range)) {
+      generator_.add(range);
+      continue;
+    }
+
+    Target target;
+    target.window = window;
+    target.host = host;
+    target.resolved = str_to_address(host, target.addr);
+
+    // Hostnames are resolved in the background and probed once they are
+    if (!target.resolved) {
+      target.address = host;
+      if (host_index_.emplace(host, targets_.size()).second) {
+        targets_.push_back(std::move(target));
+      }
+      continue;
+    }
+
+    // The same address given twice would be indistinguishable on replies
+    target.address = address_to_string(target.addr);
+    if (target_index_.emplace(target.addr, targets_.size()).second) {
+      targets_.push_back(std::move(target));
+    }
+  }
+
+  active_targets_ = targets_.size();
+
+  // Generated addresses take turns in a fixed number of slots, each shard
+  // only needs enough of them for its own stripe. The size of a target file
+  // is unknown until it was read, so it gets every slot
+  if (!options_.target_file.empty()) {
+    target_file_ = std::make_unique<Target_File>(
+        options_.target_file, options_.shard, options_.shard_count);
+  }
+  if (!generator_.empty() || target_file_) {
+    generator_.start(options_.permute, options_.seed, options_.shard,
+                     options_.shard_count);
+    sweeps_ = generator_.ranges();
+    if (target_file_) {
+      Address_Range file;
+      file.spec = options_.target_file == "-" ? "stdin" : options_.target_file;
+      sweeps_.push_back(file);
+    }
+    range_stats_.resize(sweeps_.size());
+
+    auto shard_count = std::max<size_t>(options_.shard_count, 1);
+    uint64_t stripe = (generator_.size() + shard_count - 1) / shard_count;
+    if (target_file_) {
+      stripe = max_sweep_width;
+    }
+    Target slot;
+    slot.window = window;
+    slot.finished = true;
+    slot.range = 0;
+    targets_.resize(targets_.size() +
+                        std::min<uint64_t>(stripe, max_sweep_width),
+                    slot);
+  }
+
+  // At most one timeout per window slot can be outstanding
+  probe_timeouts_ =
+      Timer_Wheel(targets_.size() * window.capacity(), milliseconds(1), now());
+
+  // Probes to all targets are spread evenly over the interval, the bucket
+  // may catch up on up to 20ms worth of sends but never on more than a window
+  auto targets = static_cast<nanoseconds::rep>(targets_.size());
+  auto period = std::max(interval / targets, nanoseconds(1));
+  auto burst = std::min(static_cast<size_t>(milliseconds(20) / period),
+                        window.capacity());
+  pacer_ = Pacer(period, burst);
+
+  // Records carry wall clock times, of the virtual clock if there is one
+  wall_offset_ =
+      duration_cast<nanoseconds>(system_clock::now().time_since_epoch()) -
+      duration_cast<nanoseconds>(now().time_since_epoch());
+
   socket_init();
 }
 
 // Packet sending and receiving loop
 void Ping_Service::start() {
-  int sequence = 0;
-  while (true) {
+  // SIGINT is taken through the loop so the summary is printed from a
+  // consistent state rather than from a signal handler
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  int interrupt = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (interrupt < 0) {
+    throw std::runtime_error("Unable to create signalfd");
+  }
+  loop_.add(interrupt, EPOLLIN, [this, interrupt](uint32_t) {
+    struct signalfd_siginfo info;
+    if (read(interrupt, &info, sizeof(info)) > 0) {
+      running_ = false;
+    }
+  });
+
+  run();
+  // Keeps machine readable output on stdout free of anything else
+  print_summary(options_.output_format == Output_Format::text ? std::cout
+                                                              : std::cerr);
+  print_output_drops(std::cerr, output_counters());
+}
+
+void Ping_Service::run() {
+  pacer_.start(now());
+  loop_.arm_timer(send_timer_, pacer_.next_deadline());
+  if (options_.output_header) {
+    write_probe_header(output_, options_.output_format);
+    options_.output_header = false;
+  }
+
+  // Everything printed while handling one batch of events goes out in a
+  // single write
+  running_ = !done();
+  while (running_) {
+    loop_.run_once();
+    output_.flush();
+  }
 
-    unsigned char data[64];
+  // Whatever the writer thread still holds belongs before the summary
+  if (writer_) {
+    writer_->sync();
+  }
+}
+
+void Ping_Service::stop() {
+  if (!signal_eventfd(stop_fd_)) {
+    throw std::runtime_error("Unable to stop the service");
+  }
+}
+
+// Counts and RTTs in the format ping prints below the summary header
+static void print_stats(std::ostream &out, const Rtt_Stats &stats) {
+  out << stats.transmitted() << " packets transmitted, " << stats.received()
+      << " received, ";
+  if (stats.duplicates() > 0) {
+    out << "+" << stats.duplicates() << " duplicates, ";
+  }
+  out << stats.loss() * 100 << "% packet loss\n";
 
-    struct timeval timeout_settings = {timeout_.count(), 0};
+  if (stats.received() > 0) {
+    out << "rtt min/avg/max/mdev = " << stats.min() << "/" << stats.mean()
+        << "/" << stats.max() << "/" << stats.mdev() << " ms\n"
+        << "rtt p50/p90/p99/p99.9 = " << stats.percentile(0.5) << "/"
+        << stats.percentile(0.9) << "/" << stats.percentile(0.99) << "/"
+        << stats.percentile(0.999) << " ms\n";
+  }
+}
 
-    icmp_header_.un.echo.sequence = ++sequence;
-    std::memcpy(data, &icmp_header_, sizeof(icmp_header_));
-    std::memcpy(data + sizeof(icmp_header_), "PingPong", 8);
+void Ping_Service::print_summary(std::ostream &out) const {
+  print_target_summary(out);
+  print_range_summary(out, ranges(), range_stats());
+}
 
+void Ping_Service::print_target_summary(std::ostream &out) const {
+  out << std::fixed << std::setprecision(2);
+  for (const auto &target : targets_) {
+    if (target.range == no_range) {
+      out << "\n--- " << target.host << " ping statistics ---\n";
+      print_stats(out, target.stats);
+    }
+  }
+  out << std::flush;
+}
+
+void Ping_Service::print_range_summary(std::ostream &out,
+                                       const std::vector<Address_Range> &ranges,
+                                       const std::vector<Range_Stats> &stats) {
+  out << std::fixed << std::setprecision(2);
+  for (size_t i = 0; i < ranges.size() && i < stats.size(); ++i) {
+    // Target files have no size until they were read to the end
+    out << "\n--- " << ranges[i].spec << " ping statistics ---\n"
+        << stats[i].probed;
+    if (ranges[i].size > 0) {
+      out << " of " << ranges[i].size;
+    }
+    out << " addresses probed, " << stats[i].alive << " alive";
+    if (stats[i].skipped > 0) {
+      out << ", " << stats[i].skipped << " malformed lines skipped";
+    }
+    out << "\n";
+    print_stats(out, stats[i].stats);
+  }
+  out << std::flush;
+}
+
+Writer_Counters Ping_Service::output_counters() const {
+  return writer_ ? writer_->counters() : Writer_Counters();
+}
+
+void Ping_Service::print_output_drops(std::ostream &out,
+                                      const Writer_Counters &counters) {
+  if (counters.dropped > 0) {
+    out << counters.dropped << " bytes of output dropped in "
+        << counters.dropped_batches << " batches, the output was too slow\n";
+  }
+}
+
+std::vector<Range_Stats> Ping_Service::range_stats() const {
+  auto stats = range_stats_;
+  for (const auto &target : targets_) {
+    // Admission already counted the address as probed
+    if (target.range != no_range && !target.finished) {
+      auto &range = stats[target.range];
+      range.alive += target.stats.received() > 0;
+      range.stats.merge(target.stats);
+    }
+  }
+  if (target_file_) {
+    stats.back().skipped = target_file_->skipped();
+  }
+  return stats;
+}
+
+void Ping_Service::send_probes() {
+  // Targets take turns so every one of them is probed once per interval
+  auto due = pacer_.take(now(), SIZE_MAX);
+  for (size_t i = 0; i < due; ++i) {
+    // Unresolved and finished targets keep their turn so neither resolving
+    // nor finishing shifts the rate
+    if (wants_probe(targets_[next_target_])) {
+      send_echo(next_target_);
+    }
+    next_target_ = (next_target_ + 1) % targets_.size();
+  }
+  flush_echoes();
+  loop_.arm_timer(send_timer_, pacer_.next_deadline());
+
+  if (!expiry_armed_) {
+    arm_expiry();
+  }
+}
+
+void Ping_Service::arm_expiry() {
+  expiry_armed_ = !probe_timeouts_.empty();
+  if (expiry_armed_) {
+    loop_.arm_timer(expiry_timer_, probe_timeouts_.next_deadline());
+  }
+}
+
+void Ping_Service::send_echo(size_t index) {
+  unsigned char head[sizeof(icmphdr) + payload_stamp_size];
+  auto &target = targets_[index];
+
+  auto sent = now();
+  auto tag = log_echo_sent_time(target, sent);
+  write_echo_request(head, sockets_[target.socket],
+                     static_cast<uint16_t>(tag));
+
+  // Ping sockets checksum in the kernel, so the shared payload is sent as is
+  size_t stamp_size = 0;
+  if (options_.stamp_payload) {
+    write_payload_stamp(head + sizeof(icmphdr),
+                        {static_cast<uint32_t>(index), sent});
+    stamp_size = payload_stamp_size;
+  }
+
+  auto &io = *sockets_[target.socket].io;
+  if (io.full()) {
+    flush_echoes();
+  }
+  io.queue(head, sizeof(icmphdr) + stamp_size,
+           payload_.data() + stamp_size, payload_.size() - stamp_size,
+           target.addr, (static_cast<uint64_t>(index) << 32) | tag);
+  target.window.set_timer(
+      tag, probe_timeouts_.arm(sent + timeout_,
+                               (static_cast<uint64_t>(index) << 32) | tag));
+  target.stats.record_sent();
+
+  if (flood_dots()) {
+    output_.character('.');
+  }
+}
+
+void Ping_Service::flush_echoes() {
+  for (auto &socket : sockets_) {
     // Cover general send failure incase interface goes down - no reason to exit
-    int rc = sendto(sock_, data, sizeof(icmp_header_) + 8, 0,
-                    (struct sockaddr *)&addr_, sizeof(addr_));
-    log_echo_sent_time(sequence);
-    if (rc <= 0) {
-      std::cout << "Ping failed. \n";
+    // Machine readable output reports failed probes once they time out
+    auto failed = socket.io->flush();
+    if (options_.output_format != Output_Format::text) {
+      failed = 0;
+    }
+    for (size_t i = 0; i < failed; ++i) {
+      output_.text("Ping failed.\n");
     }
 
-    fd_set read_set;
-    memset(&read_set, 0, sizeof(read_set));
-    FD_SET(sock_, &read_set);
+    // The kernel numbers timestamps by counting datagrams that were sent
+    if (!socket.timestamp_keys.empty()) {
+      auto &keys = socket.timestamp_keys;
+      for (size_t i = 0; i < socket.io->sent_count(); ++i) {
+        auto cookie = socket.io->sent_cookie(i);
+        auto key = socket.next_timestamp_key++;
+        keys[key % keys.size()] = {key, static_cast<uint32_t>(cookie),
+                                   static_cast<size_t>(cookie >> 32)};
+      }
+    }
 
-    rc = select(sock_ + 1, &read_set, NULL, NULL, &timeout_settings);
-    if (rc == 0) {
-      std::cout << "Request timed out \n";
-      continue;
+    if (socket.io->receive_pending()) {
+      receive_replies(socket);
+    }
+  }
+}
+
+void Ping_Service::read_tx_timestamps(Probe_Socket &socket) {
+  uint32_t key;
+  Kernel_Time time;
+  auto &keys = socket.timestamp_keys;
+  while (read_tx_timestamp(socket.sock, key, time)) {
+    auto &sent = keys[key % keys.size()];
+    if (sent.key == key) {
+      targets_[sent.target].window.log_sent_kernel(sent.tag, time);
+    }
+  }
+}
+
+void Ping_Service::receive_replies(Probe_Socket &socket) {
+  // Transmit timestamps are queued before the replies they are matched with
+  if (!socket.timestamp_keys.empty()) {
+    read_tx_timestamps(socket);
+  }
+  receive_echo_replies(*socket.io, [&](const Received_Packet &reply) {
+    process_reply(socket, reply);
+  });
+}
+
+void Ping_Service::process_reply(const Probe_Socket &socket,
+                                 const Received_Packet &reply) {
+  // We only care about ECHO_REPLY ICMP packets, ignore all other types
+  uint16_t recvd_seq;
+  if (!read_echo_reply(socket, reply, recvd_seq)) {
+    return;
+  }
+
+  auto it = target_index_.find(*reply.from);
+  if (it == target_index_.end()) {
+    return;
+  }
+  auto &target = targets_[it->second];
+
+  // Replies after the timeout or to reused slots have no trustworthy RTT
+  duration<double, std::milli> rtt;
+  auto match = get_packet_rtt(target, recvd_seq, rtt);
+  if (match == Reply_Match::late || match == Reply_Match::stale) {
+    return;
+  }
+
+  // A stamped payload carries its own send time, the window then only tells
+  // duplicates and timed out probes apart
+  Payload_Stamp stamp;
+  if (options_.stamp_payload &&
+      read_payload_stamp(reply.data + sizeof(icmphdr),
+                         reply.length - sizeof(icmphdr), stamp) &&
+      stamp.target == it->second) {
+    rtt = now() - stamp.sent;
+  }
+
+  if (match == Reply_Match::matched) {
+    probe_timeouts_.cancel(target.window.timer(recvd_seq));
+    target.stats.record_rtt(rtt.count());
+  } else {
+    target.stats.record_duplicate();
+  }
+
+  auto event = probe_event(it->second, recvd_seq,
+                           match == Reply_Match::matched
+                               ? Probe_Status::reply
+                               : Probe_Status::duplicate);
+  event.length = reply.length;
+  event.received_ns = wall_ns(now());
+  event.sent_ns = event.received_ns - static_cast<int64_t>(rtt.count() * 1e6);
+  event.rtt_ms = rtt.count();
+
+  // Wire RTT excludes scheduling delay between the kernel and this process
+  Kernel_Time received;
+  double wire_rtt;
+  if (options_.kernel_timestamps && read_kernel_time(*reply.header, received) &&
+      kernel_rtt(target.window.sent_kernel(recvd_seq), received, wire_rtt)) {
+    event.wire_rtt_ms = wire_rtt;
+  }
+  if (reports_ttl()) {
+    read_reply_ttl(*reply.header, event.ttl);
+  }
+  if (options_.on_probe) {
+    options_.on_probe(event);
+  }
+
+  // Flood mode only erases the dot of an answered probe, so the dots left on
+  // screen count the probes that were lost
+  if (!flood_dots()) {
+    write_probe_event(output_, options_.output_format, event);
+  } else if (match == Reply_Match::matched) {
+    output_.character('\b');
+  }
+
+  // Last, as settling may hand the slot over to the next generated address
+  if (match == Reply_Match::matched) {
+    settle(it->second);
+  }
+}
+
+// Answered probes cancelled their timeout, so every one that fires is lost
+void Ping_Service::expire_probes(time_point<steady_clock> now) {
+  probe_timeouts_.expire(now, [this](uint64_t cookie) {
+    auto &target = targets_[cookie >> 32];
+    auto tag = static_cast<uint32_t>(cookie);
+
+    // The slot may have been reused by a newer probe in the meantime
+    if (target.window.expire(tag)) {
+      target.stats.record_lost();
+      auto event = probe_event(cookie >> 32, static_cast<uint16_t>(tag),
+                               Probe_Status::timeout);
+      event.sent_ns = wall_ns(target.window.sent(tag));
+      if (options_.on_probe) {
+        options_.on_probe(event);
+      }
+      if (!flood_dots()) {
+        write_probe_event(output_, options_.output_format, event);
+      }
+      settle(cookie >> 32);
     }
+  });
+  arm_expiry();
+}
 
-    // Get data from response
-    socklen_t slen = 0;
-    rc = recvfrom(sock_, data, sizeof(data), 0, NULL, &slen);
-    std::memcpy(&icmp_response_header_, data, sizeof(icmp_response_header_));
+// Slots are numbered across the shards of a sweep so ids never collide
+Probe_Event Ping_Service::probe_event(size_t index, uint16_t sequence,
+                                      Probe_Status status) const {
+  const auto &target = targets_[index];
+  Probe_Event event;
+  event.target = static_cast<uint32_t>(
+      index * std::max<size_t>(options_.shard_count, 1) + options_.shard);
+  event.sequence = sequence;
+  event.status = status;
+  event.addr = &target.addr;
+  event.host = target.host;
+  event.address = target.address;
+  return event;
+}
+
+// Generated targets are probed at least once, they would never finish
+// otherwise
+static size_t probe_limit(const Target &target, size_t count) {
+  return target.range == no_range ? count : std::max<size_t>(count, 1);
+}
+
+bool Ping_Service::wants_probe(const Target &target) const {
+  auto limit = probe_limit(target, options_.count);
+  return target.resolved &&
+         (limit == 0 || target.stats.transmitted() < limit);
+}
+
+void Ping_Service::settle(size_t index) {
+  auto &target = targets_[index];
+  const auto &stats = target.stats;
+  auto limit = probe_limit(target, options_.count);
+  if (target.finished || limit == 0 || stats.transmitted() < limit ||
+      stats.received() + stats.lost() < stats.transmitted()) {
+    return;
+  }
+  finish_target(index);
+}
+
+void Ping_Service::finish_target(size_t index) {
+  auto &target = targets_[index];
+  target.finished = true;
+  --active_targets_;
+  if (target.range != no_range) {
+    auto &range = range_stats_[target.range];
+    range.alive += target.stats.received() > 0;
+    range.stats.merge(target.stats);
 
-    // We only care about ECHO_REPLY ICMP packets, ignore all other types
-    if (icmp_response_header_.type == ICMP_ECHOREPLY) {
-      int recvd_seq = icmp_response_header_.un.echo.sequence;
-      std::cout << std::fixed << std::setprecision(2);
-      std::cout << sizeof(data) << " bytes from " << inet_ntoa(remote_dest_)
-                << ": icmp_seq=" << recvd_seq
-                << " time=" << get_packet_rtt(recvd_seq).count() << "\n";
+    // The slot only owns the index entries it managed to claim
+    auto address = target_index_.find(target.addr);
+    if (target.resolved && address != target_index_.end() &&
+        address->second == index) {
+      target_index_.erase(address);
     }
+    auto host = host_index_.find(target.host);
+    if (host != host_index_.end() && host->second == index) {
+      host_index_.erase(host);
+    }
+    target.resolved = false;
+    admit_target(index);
+    update_file_watch();
+  }
+  if (done()) {
+    running_ = false;
+  }
+}
+
+bool Ping_Service::done() const {
+  return active_targets_ == 0 && (!target_file_ || target_file_->at_end());
+}
 
-    // Clear out hash map containing last 100 packet sent timepoints
-    if (sequence % 100 == 0) {
-      sequence = 0;
-      clear_echo_sent_times();
+void Ping_Service::admit_target(size_t index) {
+  Socket_Address addr;
+  size_t range;
+  while (generator_.next(addr, range)) {
+    if (admit_address(index, addr, range)) {
+      return;
     }
+  }
+  if (!target_file_) {
+    return;
+  }
 
-    std::this_thread::sleep_for(milliseconds(500));
+  Target_Entry entry;
+  auto file_range = sweeps_.size() - 1;
+  while (true) {
+    auto status = target_file_->next(entry);
+    if (status != Target_File::Status::entry) {
+      file_wanted_ = file_wanted_ || status == Target_File::Status::pending;
+      return;
+    }
+    if (entry.resolved ? admit_address(index, entry.address, file_range)
+                       : admit_host(index, entry.host, file_range)) {
+      return;
+    }
   }
 }
 
-struct in_addr Ping_Service::str_to_in_addr(const std::string &host) {
-  struct in_addr dst;
+bool Ping_Service::admit_address(size_t index, const Socket_Address &addr,
+                                 size_t range) {
+  // Skip addresses an explicit target or another slot is probing now
+  if (!target_index_.emplace(addr, index).second) {
+    return false;
+  }
+  auto &target = targets_[index];
+  target.addr = addr;
+  target.address = address_to_string(addr);
+  target.host = target.address;
+  target.socket = open_socket(addr.any.sa_family);
+  target.resolved = true;
+  activate_slot(index, range);
+  return true;
+}
 
-  // Use number of "."'s to determine if ip address or hostname
+bool Ping_Service::admit_host(size_t index, const std::string &host,
+                              size_t range) {
+  if (!host_index_.emplace(host, index).second) {
+    return false;
+  }
+  auto &target = targets_[index];
+  target.host = host;
+  target.address = host;
+  target.resolved = false;
+  activate_slot(index, range);
+  resolver_.resolve(host);
+  return true;
+}
+
+void Ping_Service::activate_slot(size_t index, size_t range) {
+  auto &target = targets_[index];
+  target.range = range;
+  target.window.reset();
+  target.stats = Rtt_Stats();
+  target.finished = false;
+  ++range_stats_[range].probed;
+  ++active_targets_;
+}
+
+void Ping_Service::read_target_file() {
+  target_file_->fill();
+
+  // Whatever slots still find no input keep the file watched
+  file_wanted_ = false;
+  for (size_t i = 0; i < targets_.size(); ++i) {
+    if (targets_[i].range != no_range && targets_[i].finished) {
+      admit_target(i);
+    }
+  }
+  update_file_watch();
+  if (done()) {
+    running_ = false;
+  }
+}
+
+// Level triggered while wanted, so input is only read as slots free up and a
+// slow consumer pushes back on the writer. Unwatched it stays edge triggered
+// without EPOLLIN, which reports nothing but the writer hanging up once
+void Ping_Service::update_file_watch() {
+  if (target_file_fd_ < 0 || file_wanted_ == file_watched_) {
+    return;
+  }
+  file_watched_ = file_wanted_;
+  loop_.modify(target_file_fd_, file_watched_ ? EPOLLIN : EPOLLET);
+}
+
+bool Ping_Service::str_to_address(const std::string &host,
+                                  Socket_Address &dst) {
+  std::memset(&dst, 0, sizeof(dst));
+
+  // Use number of "."'s and ":"'s to determine if ip address or hostname
   auto num_periods = count(host.cbegin(), host.cend(), '.');
+  auto num_colons = count(host.cbegin(), host.cend(), ':');
+
+  // Attempt to parse as an IPv6 address
+  if (num_colons > 0) {
+    dst.v6.sin6_family = AF_INET6;
+    if (inet_pton(AF_INET6, host.c_str(), &dst.v6.sin6_addr) != 1)
+      throw std::invalid_argument("Invalid IPv6 address.");
+    return true;
+  }
 
   // Attempt to parse as an IP address
   if (num_periods == 3) {
-    if (inet_aton(host.c_str(), &dst) == 0)
+    dst.v4.sin_family = AF_INET;
+    if (inet_aton(host.c_str(), &dst.v4.sin_addr) == 0)
       throw std::invalid_argument("Invalid IP address.");
+    return true;
+  }
+
+  // Hostnames are looked up later, only their syntax can be checked here
+  if (!valid_hostname(host))
+    throw std::invalid_argument("Invalid hostname.");
+  return false;
+}
+
+void Ping_Service::apply_resolution(const Resolution &resolution) {
+  auto it = host_index_.find(resolution.host);
+  if (it == host_index_.end()) {
+    return;
+  }
+  auto index = it->second;
+  auto &target = targets_[index];
+
+  if (target.finished) {
+    return;
   }
 
-  // Attempt to parse as a hostname
-  else {
-    auto hp = gethostbyname(host.c_str());
-    if (hp == nullptr)
-      throw std::invalid_argument("Invalid hostname.");
+  // A name that never resolved has nothing to probe
+  if (!resolution.resolved && !target.resolved) {
+    std::cerr << "Unable to resolve " << target.host << "\n";
+    ++unresolved_;
+    finish_target(index);
+    return;
+  }
 
-    // https://stackoverflow.com/questions/5444197/converting-host-to-ip-by-sockaddr-in-gethostname-etc
-    std::memcpy(&dst, hp->h_addr_list[0], hp->h_length);
+  // A failed re-resolution keeps probing the address that was known to work
+  if (!resolution.resolved) {
+    return;
+  }
+  if (target.resolved && same_host(target.addr, resolution.address)) {
+    return;
   }
 
-  return dst;
+  // Replies from the previous address no longer match, its probes time out
+  if (target.resolved) {
+    target_index_.erase(target.addr);
+    target.resolved = false;
+  }
+  if (!target_index_.emplace(resolution.address, index).second) {
+    // A swept name whose address is being probed already is a duplicate
+    if (target.range != no_range) {
+      finish_target(index);
+    }
+    return;
+  }
+  target.addr = resolution.address;
+  target.address = address_to_string(target.addr);
+  target.socket = open_socket(target.addr.any.sa_family);
+  target.resolved = true;
+}
+
+// Cached answers are bypassed, they would be up to a whole TTL old by now
+void Ping_Service::resolve_targets() {
+  for (const auto &host : host_index_) {
+    resolver_.resolve(host.first, true);
+  }
+  loop_.arm_timer(resolve_timer_, now() + resolver_.ttl());
 }
 
 // Init all local socket resources to allow them to send and receive
 void Ping_Service::socket_init() {
-  sock_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+  // Other threads stop the loop through an eventfd it watches
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd_ < 0) {
+    throw std::runtime_error("Unable to create eventfd");
+  }
+  loop_.add(stop_fd_, EPOLLIN, [this](uint32_t) {
+    uint64_t count;
+    if (read_eventfd(stop_fd_, count)) {
+      running_ = false;
+    }
+  });
+
+  send_timer_ = loop_.add_timer([this] { send_probes(); });
+  expiry_timer_ = loop_.add_timer([this] { expire_probes(now()); });
 
-  // If socket is already used, or permissions are not correct throw
-  if (sock_ < 0) {
-    throw std::runtime_error("Unable to create socket");
+  sockets_.reserve(2);
+  for (auto &target : targets_) {
+    if (target.resolved) {
+      target.socket = open_socket(target.addr.any.sa_family);
+    }
+  }
+  for (size_t i = 0; i < targets_.size(); ++i) {
+    if (targets_[i].range != no_range) {
+      admit_target(i);
+    }
   }
 
-  // Setup remote address fields
-  std::memset(&addr_, 0, sizeof(addr_));
-  addr_.sin_family = AF_INET;
-  addr_.sin_addr = remote_dest_;
+  // A mapped target file never waits, a stream is read as slots need input
+  if (target_file_ && target_file_->event_fd() >= 0) {
+    target_file_fd_ = dup(target_file_->event_fd());
+    file_watched_ = true;
+    loop_.add(target_file_fd_, EPOLLIN,
+              [this](uint32_t) { read_target_file(); });
+    update_file_watch();
+  }
 
-  // Setup packet to send fields
-  std::memset(&icmp_header_, 0, sizeof(icmp_header_));
-  icmp_header_.type = ICMP_ECHO;
-  icmp_header_.un.echo.id = 1337;
+  // Lookups start right away and are picked up once the loop runs, the
+  // timer re-resolves every hostname whenever cached answers go stale. A
+  // target file may list hostnames further down
+  if (!host_index_.empty() || target_file_) {
+    loop_.add(dup(resolver_.event_fd()), EPOLLIN, [this](uint32_t) {
+      resolutions_.clear();
+      resolver_.collect(resolutions_);
+      for (const auto &resolution : resolutions_) {
+        apply_resolution(resolution);
+      }
+    });
+    resolve_timer_ = loop_.add_timer([this] { resolve_targets(); });
+    resolve_targets();
+  }
 }
 
-// Add an entry to hashmap with a timepoint and a given packet sequence
-void Ping_Service::log_echo_sent_time(int sequence) {
-  echo_sent_times_.insert({sequence, steady_clock::now()});
+size_t Ping_Service::open_socket(int family) {
+  for (size_t i = 0; i < sockets_.size(); ++i) {
+    if (sockets_[i].family == family) {
+      return i;
+    }
+  }
+
+  // Replies echo the whole probe, so they need as much room as it does
+  auto packet_size = sizeof(icmphdr) + payload_.size();
+  size_t control_size =
+      options_.kernel_timestamps ? kernel_time_control_size : 0;
+  if (reports_ttl()) {
+    control_size += reply_ttl_control_size;
+  }
+  auto index = sockets_.size();
+  Probe_Socket socket;
+  static_cast<Echo_Socket &>(socket) = open_echo_socket(
+      *transport_, loop_, family, packet_size, control_size,
+      [this, index](uint32_t) { receive_replies(sockets_[index]); });
+  sockets_.push_back(std::move(socket));
+
+  auto &probe_socket = sockets_[index];
+  if (probe_socket.sock < 0) {
+    return index;
+  }
+  if (options_.kernel_timestamps) {
+    enable_kernel_timestamps(probe_socket.sock);
+    probe_socket.timestamp_keys.resize(probe_timeouts_.capacity());
+  }
+  if (reports_ttl()) {
+    enable_reply_ttl(probe_socket.sock, family);
+  }
+  return index;
 }
 
-// Delete all entries in the hashmap
-void Ping_Service::clear_echo_sent_times() { echo_sent_times_.clear(); }
+// Claim the next slot of the target window with a timepoint
+uint32_t Ping_Service::log_echo_sent_time(Target &target,
+                                          time_point<steady_clock> now) {
+  return target.window.log_sent(now);
+}
 
 // Calculate a duration based on a now time point and the logged time point
-duration<double, std::milli> Ping_Service::get_packet_rtt(int sequence) {
-  return steady_clock::now() - echo_sent_times_[sequence];
+Reply_Match Ping_Service::get_packet_rtt(Target &target, uint16_t sequence,
+                                         duration<double, std::milli> &rtt) {
+  time_point<steady_clock> sent;
+  auto match = target.window.complete(sequence, sent);
+  if (match != Reply_Match::stale) {
+    rtt = now() - sent;
+  }
+  return match;
 }
 } // namespace pico_ping
@@ -14,13 +14,33 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 // Utility include that has all relevant linux network header files
 #include "linux_socket_incl.h"
+#include "echo_socket.h"
+#include "event_loop.h"
+#include "kernel_timestamps.h"
+#include "output_buffer.h"
+#include "pacer.h"
+#include "payload_stamp.h"
+#include "probe_record.h"
+#include "probe_window.h"
+#include "resolver.h"
+#include "rtt_stats.h"
+#include "socket_address.h"
+#include "target_file.h"
+#include "target_generator.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "virtual_clock.h"
 
 using namespace std::chrono;
 
@@ -33,6 +53,140 @@ using namespace std::chrono;
  */
 namespace pico_ping {
 
+/**
+ * @brief Optional behaviour of a Ping_Service, defaults match classic ping
+ */
+struct Ping_Options {
+  // Report wire level RTT from kernel transmit and receive timestamps
+  bool kernel_timestamps = false;
+  // io_uring falls back to epoll when the kernel lacks support
+  IO_Backend io_backend = IO_Backend::epoll;
+  // Time between two probes to the same target
+  nanoseconds interval = milliseconds(500);
+  // Print a dot per probe and erase it on reply instead of per packet lines
+  bool flood = false;
+  // Carry the send time in the payload and take the RTT from the echo
+  bool stamp_payload = false;
+  // Bytes following the ICMP header, at most max_payload_size
+  size_t payload_size = 56;
+  // Bytes repeated to fill the payload, "PingPong" if empty
+  std::vector<unsigned char> pattern;
+  // Hostnames are re-resolved this often to follow DNS changes
+  seconds dns_ttl = seconds(60);
+  // Probes per target before it is done, zero to probe until stopped.
+  // Addresses of CIDR blocks and ranges are probed at least once
+  size_t count = 0;
+  // Walk CIDR blocks and ranges in a pseudo random order
+  bool permute = false;
+  // Seed of that order, services sharing a sweep must share the seed
+  uint64_t seed = 0;
+  // Stripe of the CIDR blocks and ranges this service probes, out of
+  // shard_count services splitting them
+  size_t shard = 0;
+  size_t shard_count = 1;
+  // File listing further destinations one per line, "-" for stdin. They are
+  // swept like the addresses of a range
+  std::string target_file;
+  // Exchanges the packets, ICMP sockets using io_backend if null. A
+  // Simulated_Network probes without touching the network
+  std::shared_ptr<Transport> transport;
+  // Runs every timer on simulated time, null for real time. Meant for a
+  // Simulated_Network sharing the clock, see Virtual_Clock
+  std::shared_ptr<Virtual_Clock> clock;
+  // Per probe lines are written here in batches, -1 discards them. The
+  // summary still goes to the stream passed to print_summary
+  int output_fd = STDOUT_FILENO;
+  // Format of the per probe output. Other than text, flood mode prints every
+  // probe too and the hop limit of replies is reported
+  Output_Format output_format = Output_Format::text;
+  // Write the CSV header row or binary stream header when run starts, off
+  // for services adding to a stream somebody else started
+  bool output_header = true;
+  // Write per probe output from a thread of its own, so a slow terminal or
+  // a full pipe never holds up probing. Otherwise the probing thread writes
+  bool async_output = true;
+  // What happens once the writer thread falls output_queue_size bytes behind
+  Backpressure output_backpressure = Backpressure::block;
+  size_t output_queue_size = 1 << 20;
+  // Called with every reply and timeout in addition to the output, from the
+  // thread running the service. The event refers to the target's strings,
+  // which are only valid during the call
+  std::function<void(const Probe_Event &)> on_probe;
+};
+
+/**
+ * @brief Addresses of CIDR blocks and ranges probed at the same time
+ *
+ * Generated addresses are admitted into this many target slots as earlier
+ * ones finish, which bounds memory however large the sweep.
+ */
+constexpr size_t max_sweep_width = 1024;
+
+/// Range index of targets that were given explicitly
+constexpr size_t no_range = SIZE_MAX;
+
+/**
+ * @brief State kept for every destination the service is probing
+ *
+ * All targets of an address family share one socket, so replies are matched
+ * back to a target by their source address and then to a probe by sequence
+ * number.
+ */
+struct Target {
+  std::string host;
+  Socket_Address addr;
+  // Numeric form of addr, formatted once for every line reporting on it
+  std::string address;
+  // Index into the service sockets of the target's address family
+  size_t socket = 0;
+  // Hostnames are only probed once their first lookup succeeded
+  bool resolved = false;
+  // All probes were sent and answered or timed out, see Ping_Options::count
+  bool finished = false;
+  // CIDR block or range the address was generated from
+  size_t range = no_range;
+  Probe_Window window;
+  Rtt_Stats stats;
+};
+
+/**
+ * @brief Outcome of the addresses of one CIDR block or range
+ */
+struct Range_Stats {
+  // Addresses probed so far and how many of them answered at least once
+  uint64_t probed = 0;
+  uint64_t alive = 0;
+  // Malformed lines of a target file
+  uint64_t skipped = 0;
+  Rtt_Stats stats;
+
+  void merge(const Range_Stats &other) {
+    probed += other.probed;
+    alive += other.alive;
+    skipped += other.skipped;
+    stats.merge(other.stats);
+  }
+};
+
+/**
+ * @brief Probe a kernel transmit timestamp key was assigned to
+ */
+struct Timestamp_Key {
+  uint32_t key;
+  uint32_t tag;
+  size_t target;
+};
+
+/**
+ * @brief Echo socket of the service, with what it needs to match transmit
+ * timestamps back to probes
+ */
+struct Probe_Socket : Echo_Socket {
+  // Kernel timestamp keys count per socket, modulo size to the probe
+  std::vector<Timestamp_Key> timestamp_keys;
+  uint32_t next_timestamp_key = 0;
+};
+
 class Ping_Service {
 public:
   /**
@@ -52,74 +206,394 @@ public:
   Ping_Service(const std::string &host, seconds timeout);
 
   /**
-   * @brief Infinite loop that sounds out ICMP echo packets and processes
-   * replies
+   * @brief Construct a Ping_Service object that probes several destinations
    *
-   * Constructs echo packets and processes replies as they are recieved. If a
-   * response takes longer than the timeout value, a packet loss error is
-   * reported
+   * Every host is validated up front. IPv4 and IPv6 hosts may be mixed, all
+   * hosts of a family are probed from a single shared socket and both sockets
+   * are served by the same event loop.
+   *
+   * Hosts may also be CIDR blocks or address ranges, whose addresses are
+   * generated lazily and probed max_sweep_width at a time. Destinations of
+   * Ping_Options::target_file are read as they are needed and swept the same
+   * way.
+   *
+   * @param[in] hosts Hostnames, ip addresses, CIDR blocks or address ranges
+   * of every destination
+   * @param[in] timeout Chrono seconds object for storing timeout value
+   * @param[in] options Optional behaviour of the service
+   *
+   * @throw std::invalid_argument if any IP, hostname or range is invalid, if
+   * no hosts and no target file are given, if the target file cannot be
+   * opened or if the payload size is out of range
+   * @throw std::runtime_error if socket operations fail
+   */
+  Ping_Service(const std::vector<std::string> &hosts, seconds timeout,
+               const Ping_Options &options = {});
+
+  /**
+   * @brief Loop that sounds out ICMP echo packets and processes replies until
+   * SIGINT, then prints a summary of every target
+   *
+   * Sending and receiving are decoupled: every send interval one echo packet
+   * is sent to each target on a fixed schedule, while replies are processed as
+   * they are recieved in between. Both are driven by the event loop, the send
+   * schedule and probe timeouts by timers and replies by socket readiness.
+   *
+   * Sends to the different targets are spread evenly over the interval and
+   * paced by a token bucket on an absolute schedule, so the achieved rate
+   * matches the requested one however long reply processing takes. Many
+   * probes can be in flight at once and any probe whose response takes longer
+   * than the timeout value has a packet loss error reported
    *
    * If IP address or hostname is found to be invalid an exception is thrown.
+   *
+   * @throw std::runtime_error if socket operations fail
    */
   void start();
 
+  /**
+   * @brief Sends and receives until stop is called or every target finished,
+   * without touching signals
+   *
+   * The service is driven entirely by the thread calling run, so several
+   * services can each run on a thread of their own.
+   *
+   * @throw std::runtime_error if socket operations fail
+   */
+  void run();
+
+  /**
+   * @brief Makes run return, may be called from any thread
+   *
+   * @throw std::runtime_error if the loop of run cannot be woken
+   */
+  void stop();
+
+  /**
+   * @brief Prints transmitted, received and lost counts plus RTT statistics
+   * of every target, like ping does on exit
+   *
+   * Can be called at any time, statistics are updated as probes complete.
+   *
+   * @param[in] out Stream to print to
+   */
+  void print_summary(std::ostream &out) const;
+
+  /**
+   * @brief Prints the summary of the explicitly given targets only
+   *
+   * @param[in] out Stream to print to
+   */
+  void print_target_summary(std::ostream &out) const;
+
+  /**
+   * @brief Prints the summary of every CIDR block and range
+   *
+   * @param[in] out Stream to print to
+   * @param[in] ranges Blocks and ranges as parsed
+   * @param[in] stats Outcome of each of them
+   */
+  static void print_range_summary(std::ostream &out,
+                                  const std::vector<Address_Range> &ranges,
+                                  const std::vector<Range_Stats> &stats);
+
+  /**
+   * @brief Prints how much per probe output was dropped, if any was
+   *
+   * @param[in] out Stream to print to
+   * @param[in] counters Counters of the output writer
+   */
+  static void print_output_drops(std::ostream &out,
+                                 const Writer_Counters &counters);
+
+  /**
+   * @brief CIDR blocks and ranges given to the service, followed by the
+   * target file as a range of unknown size
+   */
+  const std::vector<Address_Range> &ranges() const { return sweeps_; }
+
+  /**
+   * @brief Outcome of every CIDR block and range so far, including the
+   * addresses still being probed
+   */
+  std::vector<Range_Stats> range_stats() const;
+
+  /**
+   * @brief Hostnames that were never probed because their first lookup
+   * failed, the run counts as failed if there are any
+   */
+  size_t unresolved() const { return unresolved_; }
+
+  /**
+   * @brief Per probe output written and dropped so far, zeros unless
+   * Ping_Options::async_output is set
+   */
+  Writer_Counters output_counters() const;
+
 private:
   /**
-   * @brief Converts a string to in_addr struct
+   * @brief Current time, simulated if the service runs on a virtual clock
+   */
+  time_point<steady_clock> now() const {
+    return options_.clock ? options_.clock->now() : steady_clock::now();
+  }
+  /**
+   * @brief Converts a time point of now() to nanoseconds since the Unix epoch
+   */
+  int64_t wall_ns(time_point<steady_clock> time) const {
+    return (time.time_since_epoch() + wall_offset_).count();
+  }
+  /**
+   * @brief Whether probes show as flood dots instead of per probe output
+   */
+  bool flood_dots() const {
+    return options_.flood && options_.output_format == Output_Format::text;
+  }
+  /**
+   * @brief Whether the hop limit of replies is read
+   */
+  bool reports_ttl() const {
+    return options_.output_format != Output_Format::text ||
+           static_cast<bool>(options_.on_probe);
+  }
+  /**
+   * @brief Outcome of a probe with the target it was sent to filled in
    *
-   * Takes a string representation of a hostname or ip address and converts it
-   * into in_addr struct which is used during socket operations.
+   * @param[in] index Target the probe was sent to
+   * @param[in] sequence Sequence of the probe
+   * @param[in] status Outcome of the probe
+   */
+  Probe_Event probe_event(size_t index, uint16_t sequence,
+                          Probe_Status status) const;
+  /**
+   * @brief Converts an address literal to a socket address of either family
+   *
+   * Takes a string representation of a hostname, IPv4 or IPv6 address.
+   * Addresses are converted right away, hostnames only have their syntax
+   * checked and are left to the resolver.
    *
    * @param[in] host String representation of a hostname of IP address
+   * @param[out] dst Socket address with family and host populated, if host
+   * is an address
    *
-   * @return in_addr struct containing populated address fields containing
-   * address
+   * @return false if host is a hostname that still has to be resolved
    *
-   * @throw std::invalid_argument if string representation cannot be converted
-   * to address
+   * @throw std::invalid_argument if string representation is neither a valid
+   * address nor a valid hostname
+   */
+  bool str_to_address(const std::string &host, Socket_Address &dst);
+  /**
+   * @brief Points a hostname target at the address its lookup returned
+   *
+   * @param[in] resolution Finished lookup of the target's hostname
+   */
+  void apply_resolution(const Resolution &resolution);
+  /**
+   * @brief Requests a lookup of every hostname target and schedules the next
    */
-  struct in_addr str_to_in_addr(const std::string &host);
+  void resolve_targets();
   /**
-   * @brief Initializes socket for sending and receiving ICMP packets
+   * @brief Initializes timers and one socket per address family in use
    *
    */
   void socket_init();
   /**
-   * @brief Calculates packet RTT based on stored sent time and received time
+   * @brief Opens the ICMP socket for a family through the transport unless
+   * it is open already, and registers it with the loop
    *
-   * Because there is no assurance that ICMP replies will be recieved in the
-   * order they were dispatched, responses are stored in a hash map with the
-   * packet sequence acting as the key and a chrono timepoint as the value. Upon
-   * the socket receiving a response, an elapsed duration is calculated by
-   * comparing the timepoint value with that key and the timepoint representing
-   * now.
+   * @param[in] family AF_INET or AF_INET6
+   *
+   * @return Index of the socket in sockets_
+   */
+  size_t open_socket(int family);
+  /**
+   * @brief Queues one echo packet to the given target and arms its timeout
+   *
+   * Packets are only handed to the kernel once the batch fills up or is
+   * flushed at the end of a send round.
+   *
+   * @param[in] index Index of the destination to probe
+   */
+  void send_echo(size_t index);
+  /**
+   * @brief Hands every queued echo packet of every socket to the kernel
+   *
+   * Send failures are reported, and with kernel timestamps enabled every sent
+   * packet is assigned the timestamp key the kernel will report it under.
+   */
+  void flush_echoes();
+  /**
+   * @brief Attaches every queued kernel transmit timestamp to its probe
+   *
+   * @param[in] socket Socket whose error queue is read
+   */
+  void read_tx_timestamps(Probe_Socket &socket);
+  /**
+   * @brief Drains every reply waiting on a socket in batches
+   *
+   * @param[in] socket Socket to drain
+   */
+  void receive_replies(Probe_Socket &socket);
+  /**
+   * @brief Matches one reply to its target and probe and reports it
    *
-   * @param[in] Packet sequence identifier
+   * The source address of the reply selects the target it belongs to and the
+   * sequence selects the probe. Replies from unknown sources, to probes that
+   * already completed, or of types other than ECHO_REPLY are ignored.
    *
-   * @return Floating point duration value representing milliseconds.
+   * @param[in] socket Socket the reply arrived on
+   * @param[in] reply Datagram read from the socket
    */
-  duration<double, std::milli> get_packet_rtt(int pkt_sequence);
+  void process_reply(const Probe_Socket &socket, const Received_Packet &reply);
   /**
-   * @brief Adds a packet sequence and chonro time point to hashmap
+   * @brief Fills a sweep slot with the next generated address or the next
+   * entry of the target file
    *
-   * @param[in] Packet sequence identifier
+   * Leaves the slot idle once both are exhausted or while the target file
+   * waits for more input.
    *
+   * @param[in] index Slot in targets_
    */
-  void log_echo_sent_time(int pkt_sequence);
+  void admit_target(size_t index);
   /**
-   * @brief Clears all packets out of hashmap
+   * @brief Puts an address into a sweep slot
+   *
+   * @return false if another target is probing the address already
+   */
+  bool admit_address(size_t index, const Socket_Address &addr, size_t range);
+  /**
+   * @brief Puts a hostname into a sweep slot and starts resolving it
+   *
+   * @return false if another target is probing the hostname already
+   */
+  bool admit_host(size_t index, const std::string &host, size_t range);
+  /**
+   * @brief Resets the state of a sweep slot for a new destination
+   */
+  void activate_slot(size_t index, size_t range);
+  /**
+   * @brief Reads more of a streamed target file into idle sweep slots
+   */
+  void read_target_file();
+  /**
+   * @brief Watches the streamed target file only while slots wait for it
+   */
+  void update_file_watch();
+  /**
+   * @brief Whether every target finished and nothing is left to sweep
+   */
+  bool done() const;
+  /**
+   * @brief Whether the pacer should still send to a target
+   */
+  bool wants_probe(const Target &target) const;
+  /**
+   * @brief Marks a target finished once its last probe completed
+   *
+   * @param[in] index Target whose probe just completed
+   */
+  void settle(size_t index);
+  /**
+   * @brief Marks a target finished
+   *
+   * Generated targets hand their statistics to their range and free their
+   * slot for the next address. The service stops once no target is left.
+   *
+   * @param[in] index Target that is done
+   */
+  void finish_target(size_t index);
+  /**
+   * @brief Reports every probe whose timeout has passed as lost
+   *
+   * @param[in] now Time point to compare deadlines against
+   */
+  void expire_probes(time_point<steady_clock> now);
+  /**
+   * @brief Sends every probe the pacer allows and arms the send timer for the
+   * next one
+   */
+  void send_probes();
+  /**
+   * @brief Arms the expiry timer for the earliest probe timeout
+   */
+  void arm_expiry();
+  /**
+   * @brief Adds a chrono time point for the next probe to the target window
+   *
+   * @param[in] target Target the packet is sent to
+   * @param[in] now Send time of the probe
+   *
+   * @return Tag of the probe, the low 16 bits being the packet sequence
+   */
+  uint32_t log_echo_sent_time(Target &target, time_point<steady_clock> now);
+  /**
+   * @brief Calculates packet RTT based on stored sent time and received time
+   *
+   * Because there is no assurance that ICMP replies will be recieved in the
+   * order they were dispatched, send times are stored in a ring indexed by
+   * packet sequence. Upon the socket receiving a response, an elapsed duration
+   * is calculated by comparing the timepoint stored in that slot with the
+   * timepoint representing now.
    *
-   * The hash map is reset every 100 packets
+   * @param[in] target Target the packet was sent to
+   * @param[in] pkt_sequence Packet sequence identifier
+   * @param[out] rtt Floating point duration value representing milliseconds,
+   * set unless the reply is stale
    *
+   * @return How the reply relates to the probe stored for that sequence
    */
-  void clear_echo_sent_times();
+  Reply_Match get_packet_rtt(Target &target, uint16_t pkt_sequence,
+                             duration<double, std::milli> &rtt);
 
-  std::map<int, time_point<steady_clock>> echo_sent_times_;
-  int sock_;
+  std::vector<Target> targets_;
+  // Source address to index into targets_
+  std::unordered_map<Socket_Address, size_t, Address_Hash, Address_Equal>
+      target_index_;
+  // Hostname to index into targets_, for targets given by name
+  std::unordered_map<std::string, size_t> host_index_;
+  // Addresses of CIDR blocks and ranges not admitted yet
+  Target_Generator generator_;
+  // Destinations read from Ping_Options::target_file, if one is given
+  std::unique_ptr<Target_File> target_file_;
+  // Generator ranges followed by the target file
+  std::vector<Address_Range> sweeps_;
+  // Outcome of generated targets that already finished, per sweep
+  std::vector<Range_Stats> range_stats_;
+  // A streamed target file is watched only while slots wait for input
+  int target_file_fd_ = -1;
+  bool file_wanted_ = false;
+  bool file_watched_ = false;
+  // Targets that did not finish yet, run returns when this reaches zero
+  size_t active_targets_ = 0;
+  // Timeout of every probe in flight, cookie is the target index and tag
+  Timer_Wheel probe_timeouts_;
+  Ping_Options options_;
+  std::shared_ptr<Transport> transport_;
+  // Closes the sockets and timers, so it is declared before every member
+  // using them and destroyed after those
+  Event_Loop loop_;
+  // At most one per address family, reserved so references stay valid
+  std::vector<Probe_Socket> sockets_;
+  Resolver resolver_;
+  std::vector<Resolution> resolutions_;
+  // Hostnames given up on because their first lookup failed
+  size_t unresolved_ = 0;
+  int resolve_timer_ = -1;
+  int send_timer_;
+  int expiry_timer_;
+  bool expiry_armed_ = false;
+  bool running_ = false;
+  int stop_fd_ = -1;
+  Pacer pacer_;
+  size_t next_target_ = 0;
   seconds timeout_ = seconds(5);
-  struct in_addr remote_dest_;
-  struct icmphdr icmp_header_;
-  struct sockaddr_in addr_;
-  struct icmphdr icmp_response_header_;
+  // Filled once, every probe copies only its header and stamp
+  std::vector<unsigned char> payload_;
+  // Drains output_ on a thread of its own, if asynchronous output is on
+  std::unique_ptr<Async_Writer> writer_;
+  // Per probe lines, written once per batch of events
+  Output_Buffer output_;
+  // Added to steady clock time points to get wall clock ones
+  nanoseconds wall_offset_;
 };
 } // namespace pico_ping
\ No newline at end of file
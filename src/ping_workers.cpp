@@ -0,0 +1,223 @@
+/**
+ * @file ping_workers.cpp
+ * @ingroup Ping_Service
+ * @brief Targets sharded over pinned worker threads
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "event_fd.h"
+#include "ping_workers.h"
+
+namespace pico_ping {
+
+// CPUs the process is allowed to run on, in ascending order
+static std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+Ping_Workers::Ping_Workers(const std::vector<std::string> &hosts,
+                           seconds timeout, const Ping_Options &options,
+                           size_t workers)
+    : output_format_(options.output_format), output_fd_(options.output_fd),
+      output_header_(options.output_header) {
+  if (workers == 0) {
+    throw std::invalid_argument("No workers requested.");
+  }
+  if (hosts.empty() && options.target_file.empty()) {
+    throw std::invalid_argument("No hosts given.");
+  }
+  // Simulated time is advanced by a single event loop
+  if (options.clock && workers > 1) {
+    throw std::invalid_argument("A virtual clock drives one worker only.");
+  }
+
+  // Explicit hosts are dealt out, blocks, ranges and the target file go to
+  // every worker which then probes its own stripe of them
+  std::vector<std::string> singles, ranges;
+  for (const auto &host : hosts) {
+    Address_Range range;
+    (parse_address_range(host, range) ? ranges : singles).push_back(host);
+  }
+  if (ranges.empty() && options.target_file.empty()) {
+    workers = std::min(workers, singles.size());
+  }
+
+  std::vector<std::vector<std::string>> shards(workers, ranges);
+  for (size_t i = 0; i < singles.size(); ++i) {
+    shards[i % workers].push_back(singles[i]);
+  }
+
+  shards_.reserve(workers);
+  for (size_t i = 0; i < workers; ++i) {
+    auto shard_options = options;
+    shard_options.shard = i;
+    shard_options.shard_count = workers;
+    shard_options.output_header = false;
+    shards_.push_back(
+        std::make_unique<Ping_Service>(shards[i], timeout, shard_options));
+  }
+}
+
+void Ping_Workers::start() {
+  // Blocked before any worker starts so every thread inherits the mask and
+  // SIGINT is only ever seen through the signalfd below
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // Each descriptor is handed to the loop as soon as it exists, so the loop
+  // closes the ones already created if a later one cannot be
+  Event_Loop loop;
+  bool running = true;
+  int interrupt = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (interrupt < 0) {
+    throw std::runtime_error("Unable to create signalfd");
+  }
+  loop.add(interrupt, EPOLLIN, [&running](uint32_t) { running = false; });
+  int failed = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (failed < 0) {
+    throw std::runtime_error("Unable to create eventfd");
+  }
+  loop.add(failed, EPOLLIN, [&running](uint32_t) { running = false; });
+  int finished = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (finished < 0) {
+    throw std::runtime_error("Unable to create eventfd");
+  }
+
+  // Workers whose targets all finished return on their own, the sweep is
+  // over once every one of them did
+  uint64_t finished_count = 0;
+  loop.add(finished, EPOLLIN, [&](uint32_t) {
+    uint64_t count;
+    if (read_eventfd(finished, count)) {
+      finished_count += count;
+      running = finished_count < shards_.size();
+    }
+  });
+
+  if (output_header_) {
+    Output_Buffer header(output_fd_);
+    write_probe_header(header, output_format_);
+    header.flush();
+    output_header_ = false;
+  }
+
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto cpus = allowed_cpus();
+  bool pin = shards_.size() > 1 && !cpus.empty();
+
+  // Workers reference the locals above, so they are all joined before
+  // leaving, also if starting one of them or the loop fails
+  std::vector<std::thread> threads;
+  auto join_workers = [&] {
+    for (auto &shard : shards_) {
+      shard->stop();
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  };
+  threads.reserve(shards_.size());
+  try {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      threads.emplace_back([&, i] {
+        // Pinning is best effort, an unpinned worker still works correctly
+        if (pin) {
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(cpus[i % cpus.size()], &set);
+          pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+
+        try {
+          shards_[i]->run();
+          if (!signal_eventfd(finished)) {
+            throw std::runtime_error("Unable to signal worker completion");
+          }
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          // SIGINT is blocked everywhere, so it reaches the loop through the
+          // signalfd if even the eventfd cannot be written
+          if (!signal_eventfd(failed)) {
+            kill(getpid(), SIGINT);
+          }
+        }
+      });
+    }
+    while (running) {
+      loop.run_once();
+    }
+  } catch (...) {
+    join_workers();
+    throw;
+  }
+  join_workers();
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  print_summary(output_format_ == Output_Format::text ? std::cout : std::cerr);
+
+  Writer_Counters output;
+  for (const auto &shard : shards_) {
+    auto counters = shard->output_counters();
+    output.dropped += counters.dropped;
+    output.dropped_batches += counters.dropped_batches;
+  }
+  Ping_Service::print_output_drops(std::cerr, output);
+}
+
+size_t Ping_Workers::unresolved() const {
+  size_t unresolved = 0;
+  for (const auto &shard : shards_) {
+    unresolved += shard->unresolved();
+  }
+  return unresolved;
+}
+
+void Ping_Workers::print_summary(std::ostream &out) const {
+  for (const auto &shard : shards_) {
+    shard->print_target_summary(out);
+  }
+
+  // Every shard swept its own stripe of the same blocks and ranges
+  auto stats = shards_.front()->range_stats();
+  for (size_t i = 1; i < shards_.size(); ++i) {
+    auto shard_stats = shards_[i]->range_stats();
+    for (size_t range = 0; range < stats.size(); ++range) {
+      stats[range].merge(shard_stats[range]);
+    }
+  }
+  Ping_Service::print_range_summary(out, shards_.front()->ranges(), stats);
+}
+} // namespace pico_ping
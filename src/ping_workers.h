@@ -0,0 +1,85 @@
+/**
+ * @file ping_workers.h
+ * @ingroup Ping_Service
+ * @brief Targets sharded over pinned worker threads
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ping_service.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Splits the targets into shards, each probed by its own worker thread
+ *
+ * Every shard is a complete Ping_Service with its own sockets, event loop and
+ * pacer, and runs on a thread pinned to one of the CPUs the process may use.
+ * The kernel gives every ICMP datagram socket its own echo identifier and
+ * delivers replies only to the socket whose identifier they carry, so each
+ * reply lands on the worker that sent the probe and workers share no state.
+ */
+class Ping_Workers {
+public:
+  /**
+   * @brief Construct one service per shard, targets are dealt round robin
+   *
+   * CIDR blocks, ranges and the entries of a target file are split by
+   * striping them over every shard instead.
+   *
+   * @param[in] hosts Hostnames, ip addresses, CIDR blocks or address ranges
+   * of every destination
+   * @param[in] timeout Chrono seconds object for storing timeout value
+   * @param[in] options Optional behaviour shared by every shard
+   * @param[in] workers Number of worker threads, at most one per host unless
+   * blocks or ranges are given
+   *
+   * @throw std::invalid_argument if any IP or hostname is invalid, if no
+   * hosts and no target file are given, if a streamed target file is to be
+   * split, if workers is zero or if several are to share a virtual clock
+   * @throw std::runtime_error if socket operations fail
+   */
+  Ping_Workers(const std::vector<std::string> &hosts, seconds timeout,
+               const Ping_Options &options, size_t workers);
+
+  /**
+   * @brief Runs every shard until SIGINT or until all of them finished, then
+   * prints their summaries
+   *
+   * @throw std::runtime_error if a worker fails, after every worker stopped
+   */
+  void start();
+
+  /**
+   * @brief Prints the summary of every shard, blocks and ranges combined
+   * over all shards
+   *
+   * @param[in] out Stream to print to
+   */
+  void print_summary(std::ostream &out) const;
+
+  /**
+   * @brief Hostnames no shard could resolve, see Ping_Service::unresolved
+   */
+  size_t unresolved() const;
+
+  size_t size() const { return shards_.size(); }
+
+private:
+  std::vector<std::unique_ptr<Ping_Service>> shards_;
+  // Shards write their records into one stream, whose header comes first
+  Output_Format output_format_;
+  int output_fd_;
+  bool output_header_;
+};
+} // namespace pico_ping
@@ -0,0 +1,203 @@
+/**
+ * @file probe_engine.cpp
+ * @ingroup Ping_Service
+ * @brief Individually submitted probes for programs embedding pico_ping
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <stdexcept>
+
+#include "kernel_timestamps.h"
+#include "payload_stamp.h"
+#include "probe_engine.h"
+
+namespace pico_ping {
+
+// Every ICMP sequence can be in flight at once
+static constexpr size_t max_sequences = 65536;
+
+Probe_Engine::Probe_Engine(const Engine_Options &options)
+    : options_(options),
+      transport_(options.transport
+                     ? options.transport
+                     : std::make_shared<Icmp_Transport>(options.io_backend)),
+      loop_(options.clock.get()) {
+  if (options_.max_in_flight == 0 || options_.max_in_flight > max_sequences) {
+    throw std::invalid_argument("Probes in flight out of range.");
+  }
+  if (options_.payload_size < payload_stamp_size ||
+      options_.payload_size > max_payload_size) {
+    throw std::invalid_argument("Payload size out of range.");
+  }
+
+  slots_.resize(options_.max_in_flight);
+  free_slots_ = Ring_Queue<uint16_t>(slots_.size());
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    free_slots_.push(static_cast<uint16_t>(i));
+  }
+  completions_.reserve(slots_.size());
+  timeouts_ = Timer_Wheel(slots_.size(), milliseconds(1), now());
+  expiry_timer_ = loop_.add_timer([this] { expire(); });
+
+  payload_ = echo_payload(options_.payload_size);
+  sockets_.reserve(2);
+}
+
+uint64_t Probe_Engine::submit(const Socket_Address &address,
+                              nanoseconds timeout, void *context) {
+  if (free_slots_.empty()) {
+    return no_probe;
+  }
+  auto &socket = sockets_[open_socket(address.any.sa_family)];
+  auto index = free_slots_.front();
+  free_slots_.pop();
+  ++in_flight_;
+
+  auto &slot = slots_[index];
+  slot.id = next_id_++;
+  slot.context = context;
+  slot.address = address;
+  slot.sent = now();
+  auto deadline = slot.sent + timeout;
+  slot.timer = timeouts_.arm(deadline, index);
+  if (!expiry_armed_ || deadline < expiry_deadline_) {
+    arm_expiry(deadline);
+  }
+
+  // The sequence selects the slot, the stamp tells its users apart
+  unsigned char head[sizeof(icmphdr) + payload_stamp_size];
+  write_echo_request(head, socket, index);
+  write_payload_stamp(head + sizeof(icmphdr),
+                      {static_cast<uint32_t>(slot.id), slot.sent});
+
+  if (socket.io->full()) {
+    flush();
+  }
+  socket.io->queue(head, sizeof(head), payload_.data() + payload_stamp_size,
+                   payload_.size() - payload_stamp_size, address, index);
+  return slot.id;
+}
+
+int Probe_Engine::run_once(int timeout_ms) {
+  // Probes submitted by handlers go out in the same batch as the replies
+  // that caused them
+  flush();
+  auto handled = loop_.run_once(timeout_ms);
+  flush();
+  return handled;
+}
+
+void Probe_Engine::run() {
+  while (in_flight_ > 0) {
+    run_once();
+  }
+}
+
+size_t Probe_Engine::poll(std::vector<Probe_Result> &results) {
+  auto count = completions_.size();
+  results.insert(results.end(), completions_.begin(), completions_.end());
+  completions_.clear();
+  return count;
+}
+
+// Requests that fail to send time out like lost ones
+void Probe_Engine::flush() {
+  for (auto &socket : sockets_) {
+    socket.io->flush();
+    if (socket.io->receive_pending()) {
+      receive(socket);
+    }
+  }
+}
+
+void Probe_Engine::receive(Echo_Socket &socket) {
+  receive_echo_replies(*socket.io, [&](const Received_Packet &reply) {
+    process_reply(socket, reply);
+  });
+}
+
+void Probe_Engine::process_reply(const Echo_Socket &socket,
+                                 const Received_Packet &reply) {
+  uint16_t index;
+  if (!read_echo_reply(socket, reply, index) || index >= slots_.size()) {
+    return;
+  }
+
+  // Duplicates and replies to probes that timed out find the slot free or
+  // in use by a later probe
+  auto &slot = slots_[index];
+  Payload_Stamp stamp;
+  if (slot.id == no_probe || !same_host(slot.address, *reply.from) ||
+      !read_payload_stamp(reply.data + sizeof(icmphdr),
+                          reply.length - sizeof(icmphdr), stamp) ||
+      stamp.target != static_cast<uint32_t>(slot.id)) {
+    return;
+  }
+
+  timeouts_.cancel(slot.timer);
+  Probe_Result result;
+  result.status = Probe_Status::reply;
+  result.rtt = now() - slot.sent;
+  result.length = reply.length;
+  read_reply_ttl(*reply.header, result.ttl);
+  complete(index, result);
+}
+
+// Handlers may have submitted probes meanwhile, the wheel knows about those
+void Probe_Engine::expire() {
+  timeouts_.expire(now(), [this](uint64_t index) {
+    Probe_Result result;
+    result.status = Probe_Status::timeout;
+    complete(index, result);
+  });
+  expiry_armed_ = false;
+  if (!timeouts_.empty()) {
+    arm_expiry(timeouts_.next_deadline());
+  }
+}
+
+void Probe_Engine::arm_expiry(time_point<steady_clock> deadline) {
+  expiry_armed_ = true;
+  expiry_deadline_ = deadline;
+  loop_.arm_timer(expiry_timer_, deadline);
+}
+
+// The slot is free before on_result runs, so the handler may reuse it
+void Probe_Engine::complete(size_t index, Probe_Result &result) {
+  auto &slot = slots_[index];
+  result.id = slot.id;
+  result.context = slot.context;
+  result.address = slot.address;
+  slot.id = no_probe;
+  slot.timer = Timer_Wheel::invalid_handle;
+  free_slots_.push(static_cast<uint16_t>(index));
+  --in_flight_;
+
+  if (options_.on_result) {
+    options_.on_result(result);
+  } else {
+    completions_.push_back(result);
+  }
+}
+
+size_t Probe_Engine::open_socket(int family) {
+  for (size_t i = 0; i < sockets_.size(); ++i) {
+    if (sockets_[i].family == family) {
+      return i;
+    }
+  }
+
+  auto index = sockets_.size();
+  sockets_.push_back(open_echo_socket(
+      *transport_, loop_, family, sizeof(icmphdr) + payload_.size(),
+      reply_ttl_control_size,
+      [this, index](uint32_t) { receive(sockets_[index]); }));
+  if (sockets_[index].sock >= 0) {
+    enable_reply_ttl(sockets_[index].sock, family);
+  }
+  return index;
+}
+} // namespace pico_ping
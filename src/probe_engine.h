@@ -0,0 +1,198 @@
+/**
+ * @file probe_engine.h
+ * @ingroup Ping_Service
+ * @brief Individually submitted probes for programs embedding pico_ping
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+#include "echo_socket.h"
+#include "event_loop.h"
+#include "probe_record.h"
+#include "ring_queue.h"
+#include "socket_address.h"
+#include "timer_wheel.h"
+#include "transport.h"
+#include "virtual_clock.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Outcome of one submitted probe
+ */
+struct Probe_Result {
+  // Returned by submit
+  uint64_t id = 0;
+  // Passed to submit, untouched by the engine
+  void *context = nullptr;
+  Socket_Address address;
+  // reply or timeout, duplicate replies are not reported
+  Probe_Status status = Probe_Status::timeout;
+  // Only meaningful for replies
+  duration<double, std::milli> rtt{0};
+  // Hop limit the reply arrived with, zero if unknown
+  uint8_t ttl = 0;
+  // Bytes of the reply
+  size_t length = 0;
+};
+
+/**
+ * @brief Optional behaviour of a Probe_Engine
+ */
+struct Engine_Options {
+  // Exchanges the packets, ICMP sockets using io_backend if null
+  std::shared_ptr<Transport> transport;
+  IO_Backend io_backend = IO_Backend::epoll;
+  // Runs timeouts on simulated time, null for real time
+  std::shared_ptr<Virtual_Clock> clock;
+  // Probes outstanding at once, at most the 65536 ICMP sequences
+  size_t max_in_flight = 4096;
+  // Bytes following the ICMP header, payload_stamp_size to max_payload_size
+  size_t payload_size = 56;
+  // Called from run_once with every result. Results are queued for poll
+  // instead if this is empty
+  std::function<void(const Probe_Result &)> on_result;
+};
+
+/**
+ * @brief Sends single echo requests on demand and reports each one's outcome
+ *
+ * Where a Ping_Service probes a fixed set of destinations on a schedule of
+ * its own, the engine probes whatever it is asked to whenever it is asked,
+ * so a program such as a health checker can embed it and keep its own
+ * schedule. Results are delivered through Engine_Options::on_result or
+ * collected with poll.
+ *
+ * Every probe in flight occupies one slot of a preallocated table whose
+ * index is the ICMP sequence, and carries its id in a payload stamp so a
+ * late reply to an earlier user of the slot is never mistaken for a reply
+ * to the current one. Nothing is allocated per probe.
+ *
+ * Single threaded: submit, run_once and poll must be called from the same
+ * thread, on_result is called from run_once and may submit further probes.
+ */
+class Probe_Engine {
+public:
+  /// Never returned by submit for an accepted probe
+  static constexpr uint64_t no_probe = 0;
+
+  /**
+   * @brief Construct an engine, sockets are opened as families are used
+   *
+   * @throw std::invalid_argument if max_in_flight or payload_size is out of
+   * range
+   * @throw std::runtime_error if the event loop cannot be created
+   */
+  explicit Probe_Engine(const Engine_Options &options = {});
+
+  Probe_Engine(const Probe_Engine &) = delete;
+  Probe_Engine &operator=(const Probe_Engine &) = delete;
+
+  /**
+   * @brief Queues an echo request, sent on the next call to run_once at the
+   * latest
+   *
+   * @param[in] address Destination, see lookup_host for hostnames
+   * @param[in] timeout Time after which the probe is reported as timed out
+   * @param[in] context Handed back in the result
+   *
+   * @return Id of the probe or no_probe if max_in_flight probes are
+   * outstanding
+   *
+   * @throw std::runtime_error if the socket of a new family cannot be opened
+   */
+  uint64_t submit(const Socket_Address &address, nanoseconds timeout,
+                  void *context = nullptr);
+
+  /**
+   * @brief Sends what was submitted, then waits for and handles replies and
+   * timeouts
+   *
+   * @param[in] timeout_ms Longest time to wait, -1 waits indefinitely
+   *
+   * @return Number of events handled
+   */
+  int run_once(int timeout_ms = -1);
+
+  /**
+   * @brief Runs until no probe is in flight anymore
+   */
+  void run();
+
+  /**
+   * @brief Moves every queued result to the back of results
+   *
+   * @return Number of results moved
+   */
+  size_t poll(std::vector<Probe_Result> &results);
+
+  size_t in_flight() const { return in_flight_; }
+
+  /**
+   * @brief Descriptor that becomes readable when run_once has work, for
+   * nesting the engine in another event loop. Only with real time
+   */
+  int fd() const { return loop_.fd(); }
+
+  /**
+   * @brief Loop run by run_once, for timers of the embedding program that
+   * follow the engine's clock
+   */
+  Event_Loop &loop() { return loop_; }
+
+  /**
+   * @brief Current time, simulated if the engine runs on a virtual clock
+   */
+  time_point<steady_clock> now() const {
+    return options_.clock ? options_.clock->now() : steady_clock::now();
+  }
+
+private:
+  struct Slot {
+    // no_probe while the slot is free
+    uint64_t id = no_probe;
+    void *context = nullptr;
+    Socket_Address address;
+    time_point<steady_clock> sent;
+    Timer_Wheel::Handle timer = Timer_Wheel::invalid_handle;
+  };
+
+  size_t open_socket(int family);
+  void flush();
+  void receive(Echo_Socket &socket);
+  void process_reply(const Echo_Socket &socket, const Received_Packet &reply);
+  void expire();
+  void arm_expiry(time_point<steady_clock> deadline);
+  void complete(size_t index, Probe_Result &result);
+
+  Engine_Options options_;
+  std::shared_ptr<Transport> transport_;
+  Event_Loop loop_;
+  std::vector<Slot> slots_;
+  Ring_Queue<uint16_t> free_slots_;
+  size_t in_flight_ = 0;
+  uint64_t next_id_ = 1;
+  Timer_Wheel timeouts_;
+  int expiry_timer_;
+  bool expiry_armed_ = false;
+  time_point<steady_clock> expiry_deadline_;
+  // At most one per address family, reserved so references stay valid
+  std::vector<Echo_Socket> sockets_;
+  std::vector<unsigned char> payload_;
+  std::vector<Probe_Result> completions_;
+};
+} // namespace pico_ping
@@ -0,0 +1,201 @@
+/**
+ * @file probe_record.cpp
+ * @ingroup Ping_Service
+ * @brief Per probe results as text lines, JSON lines, CSV or binary records
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <endian.h>
+
+#include <cstring>
+
+#include "probe_record.h"
+
+namespace pico_ping {
+
+// Longest record apart from the host and address it names
+static constexpr size_t max_record_length = 256;
+
+bool parse_output_format(const std::string &name, Output_Format &format) {
+  if (name == "text") {
+    format = Output_Format::text;
+  } else if (name == "json") {
+    format = Output_Format::json;
+  } else if (name == "csv") {
+    format = Output_Format::csv;
+  } else if (name == "binary") {
+    format = Output_Format::binary;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const char *status_name(Probe_Status status) {
+  switch (status) {
+  case Probe_Status::duplicate:
+    return "duplicate";
+  case Probe_Status::timeout:
+    return "timeout";
+  default:
+    return "reply";
+  }
+}
+
+void write_probe_header(Output_Buffer &out, Output_Format format) {
+  if (format == Output_Format::csv) {
+    out.text("target,host,address,seq,status,bytes,sent_ns,received_ns,"
+             "rtt_ms,wire_rtt_ms,ttl\n");
+  } else if (format == Output_Format::binary) {
+    Probe_Record_Header header;
+    std::memcpy(header.magic, probe_record_magic, sizeof(header.magic));
+    header.version = htole32(probe_record_version);
+    header.record_size = htole32(sizeof(Probe_Record));
+    out.text({reinterpret_cast<const char *>(&header), sizeof(header)});
+  }
+}
+
+static void write_text(Output_Buffer &out, const Probe_Event &event) {
+  if (event.status == Probe_Status::timeout) {
+    out.text("Request timed out for ")
+        .text(event.address)
+        .text(" icmp_seq=")
+        .number(event.sequence)
+        .character('\n');
+    return;
+  }
+
+  out.number(event.length)
+      .text(" bytes from ")
+      .text(event.address)
+      .text(": icmp_seq=")
+      .number(event.sequence)
+      .text(" time=")
+      .fixed(event.rtt_ms);
+  if (event.wire_rtt_ms >= 0) {
+    out.text(" wire=").fixed(event.wire_rtt_ms);
+  }
+  if (event.status == Probe_Status::duplicate) {
+    out.text(" (DUP!)");
+  }
+  out.character('\n');
+}
+
+// Hostnames are validated, escaping only guards against what slipped through
+static void json_string(Output_Buffer &out, std::string_view text) {
+  static const char hex[] = "0123456789abcdef";
+  out.character('"');
+  for (auto c : text) {
+    auto byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      out.character('\\').character(c);
+    } else if (byte < 0x20) {
+      out.text("\\u00").character(hex[byte >> 4]).character(hex[byte & 0xf]);
+    } else {
+      out.character(c);
+    }
+  }
+  out.character('"');
+}
+
+static void write_json(Output_Buffer &out, const Probe_Event &event) {
+  bool answered = event.status != Probe_Status::timeout;
+  out.text("{\"target\":").number(event.target).text(",\"host\":");
+  json_string(out, event.host);
+  out.text(",\"address\":");
+  json_string(out, event.address);
+  out.text(",\"seq\":")
+      .number(event.sequence)
+      .text(",\"status\":\"")
+      .text(status_name(event.status))
+      .text("\",\"bytes\":");
+  answered ? out.number(event.length) : out.text("null");
+  out.text(",\"sent_ns\":").number(static_cast<uint64_t>(event.sent_ns));
+  out.text(",\"received_ns\":");
+  answered ? out.number(static_cast<uint64_t>(event.received_ns))
+           : out.text("null");
+  out.text(",\"rtt_ms\":");
+  event.rtt_ms >= 0 ? out.fixed(event.rtt_ms, 3) : out.text("null");
+  out.text(",\"wire_rtt_ms\":");
+  event.wire_rtt_ms >= 0 ? out.fixed(event.wire_rtt_ms, 3) : out.text("null");
+  out.text(",\"ttl\":");
+  event.ttl > 0 ? out.number(event.ttl) : out.text("null");
+  out.text("}\n");
+}
+
+static void write_csv(Output_Buffer &out, const Probe_Event &event) {
+  bool answered = event.status != Probe_Status::timeout;
+  out.number(event.target)
+      .character(',')
+      .text(event.host)
+      .character(',')
+      .text(event.address)
+      .character(',')
+      .number(event.sequence)
+      .character(',')
+      .text(status_name(event.status))
+      .character(',');
+  if (answered) {
+    out.number(event.length);
+  }
+  out.character(',').number(static_cast<uint64_t>(event.sent_ns));
+  out.character(',');
+  if (answered) {
+    out.number(static_cast<uint64_t>(event.received_ns));
+  }
+  out.character(',');
+  if (event.rtt_ms >= 0) {
+    out.fixed(event.rtt_ms, 3);
+  }
+  out.character(',');
+  if (event.wire_rtt_ms >= 0) {
+    out.fixed(event.wire_rtt_ms, 3);
+  }
+  out.character(',');
+  if (event.ttl > 0) {
+    out.number(event.ttl);
+  }
+  out.character('\n');
+}
+
+static void write_binary(Output_Buffer &out, const Probe_Event &event) {
+  Probe_Record record;
+  std::memset(&record, 0, sizeof(record));
+  record.sent_ns = static_cast<int64_t>(htole64(event.sent_ns));
+  record.received_ns = static_cast<int64_t>(htole64(event.received_ns));
+  record.target = htole32(event.target);
+  record.sequence = htole16(event.sequence);
+  record.status = static_cast<uint8_t>(event.status);
+  record.ttl = event.ttl;
+  if (event.addr && event.addr->any.sa_family == AF_INET) {
+    record.family = 4;
+    std::memcpy(record.address, &event.addr->v4.sin_addr, 4);
+  } else if (event.addr && event.addr->any.sa_family == AF_INET6) {
+    record.family = 6;
+    std::memcpy(record.address, &event.addr->v6.sin6_addr, 16);
+  }
+  out.text({reinterpret_cast<const char *>(&record), sizeof(record)});
+}
+
+void write_probe_event(Output_Buffer &out, Output_Format format,
+                       const Probe_Event &event) {
+  // Room for the whole record, so no write ever splits it
+  out.reserve(max_record_length + event.host.size() + event.address.size());
+  switch (format) {
+  case Output_Format::json:
+    write_json(out, event);
+    break;
+  case Output_Format::csv:
+    write_csv(out, event);
+    break;
+  case Output_Format::binary:
+    write_binary(out, event);
+    break;
+  default:
+    write_text(out, event);
+  }
+}
+} // namespace pico_ping
@@ -0,0 +1,120 @@
+/**
+ * @file probe_record.h
+ * @ingroup Ping_Service
+ * @brief Per probe results as text lines, JSON lines, CSV or binary records
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "output_buffer.h"
+#include "socket_address.h"
+
+namespace pico_ping {
+
+/**
+ * @brief How every probe outcome is written
+ */
+enum class Output_Format {
+  text,  ///< Lines like ping prints them
+  json,  ///< One JSON object per line
+  csv,   ///< A header row followed by one row per probe
+  binary ///< A Probe_Record_Header followed by fixed width Probe_Records
+};
+
+/**
+ * @brief Parses the name of an output format, e.g. "json"
+ *
+ * @return false if the name is unknown
+ */
+bool parse_output_format(const std::string &name, Output_Format &format);
+
+/**
+ * @brief Outcome of one probe, the values match the binary status field
+ */
+enum class Probe_Status : uint8_t { reply = 0, duplicate = 1, timeout = 2 };
+
+/**
+ * @brief Everything reported about one probe outcome
+ *
+ * Timestamps are nanoseconds since the Unix epoch. Values that are unknown
+ * are zero, or negative for the RTTs, and written as null or left empty.
+ */
+struct Probe_Event {
+  // Slot of the destination, reused by later addresses of a sweep
+  uint32_t target = 0;
+  uint16_t sequence = 0;
+  Probe_Status status = Probe_Status::reply;
+  // Hop limit the reply arrived with
+  uint8_t ttl = 0;
+  // Bytes of the reply
+  size_t length = 0;
+  int64_t sent_ns = 0;
+  int64_t received_ns = 0;
+  double rtt_ms = -1;
+  // Between the kernel timestamps, only with kernel timestamps enabled
+  double wire_rtt_ms = -1;
+  const Socket_Address *addr = nullptr;
+  std::string_view host;
+  // Numeric form of addr
+  std::string_view address;
+};
+
+/**
+ * @brief Leads a binary stream, 16 bytes
+ */
+struct Probe_Record_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+/**
+ * @brief Fixed width record of one probe in a binary stream, 48 bytes
+ *
+ * Every field is little-endian and naturally aligned, so on little-endian
+ * hosts a mapped stream can be scanned in place as an array of records
+ * starting right after the header. IPv4 addresses take the first 4 bytes of
+ * address, both families are in network byte order.
+ */
+struct Probe_Record {
+  int64_t sent_ns;
+  // Zero for timeouts
+  int64_t received_ns;
+  uint32_t target;
+  uint16_t sequence;
+  uint8_t status;
+  // Zero if unknown
+  uint8_t ttl;
+  // 4 or 6
+  uint8_t family;
+  uint8_t reserved[7];
+  uint8_t address[16];
+};
+
+static_assert(sizeof(Probe_Record_Header) == 16, "Header layout changed");
+static_assert(sizeof(Probe_Record) == 48, "Record layout changed");
+
+constexpr char probe_record_magic[8] = {'P', 'I', 'C', 'O', 'P', 'I', 'N', 'G'};
+constexpr uint32_t probe_record_version = 1;
+
+/**
+ * @brief Writes what precedes the first record, the CSV header row or the
+ * binary stream header. Nothing for text and JSON lines
+ */
+void write_probe_header(Output_Buffer &out, Output_Format format);
+
+/**
+ * @brief Writes one probe outcome, reserving room so it is never split
+ * over two writes
+ */
+void write_probe_event(Output_Buffer &out, Output_Format format,
+                       const Probe_Event &event);
+} // namespace pico_ping
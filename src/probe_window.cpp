@@ -0,0 +1,113 @@
+/**
+ * @file probe_window.cpp
+ * @ingroup Ping_Service
+ * @brief Fixed size ring of in-flight probe send times indexed by sequence
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+
+#include "probe_window.h"
+
+namespace pico_ping {
+
+// Largest window whose index still fits in the 16 bit ICMP sequence
+static constexpr size_t max_window = 1 << 16;
+
+Probe_Window::Probe_Window(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity && size < max_window) {
+    size <<= 1;
+  }
+  slots_.resize(size);
+  mask_ = static_cast<uint32_t>(size - 1);
+}
+
+uint32_t Probe_Window::log_sent(time_point<steady_clock> sent) {
+  uint32_t tag = next_tag_++;
+  auto &slot = slots_[tag & mask_];
+  slot.sent = sent;
+  slot.sent_kernel = {};
+  slot.timer = 0;
+  slot.tag = tag;
+  slot.state = Probe_State::in_flight;
+  return tag;
+}
+
+Reply_Match Probe_Window::complete(uint16_t sequence,
+                                   time_point<steady_clock> &sent) {
+  auto &slot = slots_[sequence & mask_];
+  if (slot.state == Probe_State::empty ||
+      static_cast<uint16_t>(slot.tag) != sequence) {
+    return Reply_Match::stale;
+  }
+
+  sent = slot.sent;
+  switch (slot.state) {
+  case Probe_State::replied:
+    return Reply_Match::duplicate;
+  case Probe_State::expired:
+    return Reply_Match::late;
+  default:
+    slot.state = Probe_State::replied;
+    return Reply_Match::matched;
+  }
+}
+
+bool Probe_Window::expire(uint32_t tag) {
+  auto &slot = slots_[tag & mask_];
+  if (slot.tag != tag || slot.state != Probe_State::in_flight) {
+    return false;
+  }
+  slot.state = Probe_State::expired;
+  return true;
+}
+
+bool Probe_Window::log_sent_kernel(uint32_t tag, const Kernel_Time &time) {
+  auto &slot = slots_[tag & mask_];
+  if (slot.tag != tag) {
+    return false;
+  }
+  slot.sent_kernel = time;
+  return true;
+}
+
+Kernel_Time Probe_Window::sent_kernel(uint16_t sequence) const {
+  auto &slot = slots_[sequence & mask_];
+  if (static_cast<uint16_t>(slot.tag) != sequence) {
+    return {};
+  }
+  return slot.sent_kernel;
+}
+
+time_point<steady_clock> Probe_Window::sent(uint32_t tag) const {
+  auto &slot = slots_[tag & mask_];
+  if (slot.tag != tag) {
+    return {};
+  }
+  return slot.sent;
+}
+
+void Probe_Window::reset() {
+  std::fill(slots_.begin(), slots_.end(), Probe_Slot());
+  next_tag_ = 1;
+}
+
+void Probe_Window::set_timer(uint32_t tag, uint64_t timer) {
+  auto &slot = slots_[tag & mask_];
+  if (slot.tag == tag) {
+    slot.timer = timer;
+  }
+}
+
+uint64_t Probe_Window::timer(uint16_t sequence) const {
+  auto &slot = slots_[sequence & mask_];
+  if (static_cast<uint16_t>(slot.tag) != sequence) {
+    return 0;
+  }
+  return slot.timer;
+}
+} // namespace pico_ping
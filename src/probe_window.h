@@ -0,0 +1,169 @@
+/**
+ * @file probe_window.h
+ * @ingroup Ping_Service
+ * @brief Fixed size ring of in-flight probe send times indexed by sequence
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "kernel_timestamps.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Lifecycle of a single slot in the probe window
+ */
+enum class Probe_State : uint8_t { empty, in_flight, replied, expired };
+
+/**
+ * @brief Outcome of matching a reply sequence against the probe window
+ */
+enum class Reply_Match {
+  matched,   ///< First reply to a probe that is still in flight
+  duplicate, ///< Probe was already answered
+  late,      ///< Probe already timed out
+  stale      ///< Slot has since been reused or was never sent
+};
+
+/**
+ * @brief Send time and generation tag of one probe
+ *
+ * The tag is the full 32 bit send counter of the probe; the low 16 bits are
+ * the ICMP sequence and the remaining bits act as the generation of the slot.
+ */
+struct Probe_Slot {
+  time_point<steady_clock> sent;
+  // Only filled in when kernel timestamps are enabled
+  Kernel_Time sent_kernel;
+  // Handle of the timeout armed for the probe, if any
+  uint64_t timer = 0;
+  uint32_t tag = 0;
+  Probe_State state = Probe_State::empty;
+};
+
+/**
+ * @brief Preallocated ring of probe send times for one target
+ *
+ * Slots are indexed by sequence modulo the window size, which is a power of
+ * two no larger than the 16 bit ICMP sequence space so the index of a probe is
+ * the same whether it is computed from its tag or from the echoed sequence.
+ * Each slot remembers the tag of the probe occupying it, so replies to a probe
+ * whose slot was reused, duplicate replies and replies arriving after the
+ * timeout are detected instead of being given a bogus RTT.
+ *
+ * Nothing is allocated after construction. The window must be large enough to
+ * hold every probe in flight within one timeout, otherwise the oldest
+ * outstanding probes are overwritten.
+ */
+class Probe_Window {
+public:
+  /**
+   * @brief Construct a window holding at least the given number of probes
+   *
+   * @param[in] capacity Minimum number of probes, rounded up to a power of two
+   * and capped at the size of the ICMP sequence space
+   */
+  explicit Probe_Window(size_t capacity = 64);
+
+  /**
+   * @brief Records a probe as sent and assigns it the next tag
+   *
+   * @param[in] sent Time point the probe was sent at
+   *
+   * @return Tag of the probe, truncate to 16 bits for the ICMP sequence
+   */
+  uint32_t log_sent(time_point<steady_clock> sent);
+
+  /**
+   * @brief Matches an echoed sequence to its probe
+   *
+   * A matched probe is marked replied so a later copy is reported as a
+   * duplicate.
+   *
+   * @param[in] sequence Sequence echoed by the reply
+   * @param[out] sent Send time of the probe, set unless the match is stale
+   *
+   * @return How the reply relates to the probe occupying the slot
+   */
+  Reply_Match complete(uint16_t sequence, time_point<steady_clock> &sent);
+
+  /**
+   * @brief Marks a probe as timed out if it is still in flight
+   *
+   * @param[in] tag Tag returned when the probe was sent
+   *
+   * @return true if the probe was in flight and is now counted as lost
+   */
+  bool expire(uint32_t tag);
+
+  /**
+   * @brief Attaches the kernel transmit timestamp to a probe
+   *
+   * @param[in] tag Tag returned when the probe was sent
+   * @param[in] time Transmit timestamp reported by the kernel
+   *
+   * @return false if the slot has since been reused
+   */
+  bool log_sent_kernel(uint32_t tag, const Kernel_Time &time);
+
+  /**
+   * @brief Kernel transmit timestamp of the probe with the given sequence
+   *
+   * @param[in] sequence Sequence echoed by the reply
+   *
+   * @return Timestamp or zeros if none was recorded
+   */
+  Kernel_Time sent_kernel(uint16_t sequence) const;
+
+  /**
+   * @brief Send time of a probe
+   *
+   * @param[in] tag Tag returned when the probe was sent
+   *
+   * @return Send time or the epoch if the slot has since been reused
+   */
+  time_point<steady_clock> sent(uint32_t tag) const;
+
+  /**
+   * @brief Remembers the timeout armed for a probe so a reply can cancel it
+   *
+   * @param[in] tag Tag returned when the probe was sent
+   * @param[in] timer Handle of the timeout
+   */
+  void set_timer(uint32_t tag, uint64_t timer);
+
+  /**
+   * @brief Timeout handle of the probe with the given sequence
+   *
+   * @param[in] sequence Sequence echoed by the reply
+   *
+   * @return Handle or zero if none was recorded
+   */
+  uint64_t timer(uint16_t sequence) const;
+
+  /**
+   * @brief Forgets every probe so the window can serve a new target
+   */
+  void reset();
+
+  /**
+   * @brief Number of slots in the window
+   */
+  size_t capacity() const { return slots_.size(); }
+
+private:
+  std::vector<Probe_Slot> slots_;
+  uint32_t mask_;
+  // ICMP sequences conventionally start at one
+  uint32_t next_tag_ = 1;
+};
+} // namespace pico_ping
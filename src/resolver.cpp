@@ -0,0 +1,179 @@
+/**
+ * @file resolver.cpp
+ * @ingroup Ping_Service
+ * @brief Concurrent hostname resolution with an in-process cache
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "event_fd.h"
+#include "resolver.h"
+
+namespace pico_ping {
+
+bool valid_hostname(const std::string &host) {
+  if (host.empty() || host.size() > 253) {
+    return false;
+  }
+
+  size_t label = 0;
+  char previous = '.';
+  for (char c : host) {
+    if (c == '.') {
+      if (label == 0 || previous == '-') {
+        return false;
+      }
+      label = 0;
+    } else {
+      bool allowed = std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+                     (c == '-' && label > 0);
+      if (!allowed || ++label > 63) {
+        return false;
+      }
+    }
+    previous = c;
+  }
+  // A trailing dot marks a fully qualified name
+  return (label > 0 || previous == '.') && previous != '-';
+}
+
+bool lookup_host(const std::string &host, Socket_Address &address) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+
+  struct addrinfo *result = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0) {
+    return false;
+  }
+
+  std::memset(&address, 0, sizeof(address));
+  std::memcpy(&address, result->ai_addr,
+              std::min<size_t>(result->ai_addrlen, sizeof(address)));
+  freeaddrinfo(result);
+  return true;
+}
+
+Resolver::Resolver(seconds ttl, size_t max_workers)
+    : ttl_(ttl), max_workers_(std::max(max_workers, size_t(1))) {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    throw std::runtime_error("Unable to create resolver eventfd");
+  }
+}
+
+Resolver::~Resolver() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  close(event_fd_);
+}
+
+void Resolver::resolve(const std::string &host, bool refresh) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto cached = cache_.find(host);
+  if (!refresh && cached != cache_.end() &&
+      steady_clock::now() < cached->second.expires) {
+    if (!finish({host, cached->second.address, true})) {
+      throw std::runtime_error("Unable to signal resolver eventfd");
+    }
+    return;
+  }
+  if (!in_flight_.insert(host).second) {
+    return;
+  }
+  requests_.push_back(host);
+
+  // Threads are only started while every existing one is busy. They are
+  // started with every signal blocked so signals reach the caller's thread,
+  // whose own mask is restored whether or not the thread could be started
+  if (idle_workers_ == 0 && workers_.size() < max_workers_) {
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    try {
+      workers_.emplace_back([this] { work(); });
+    } catch (...) {
+      pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+      requests_.pop_back();
+      in_flight_.erase(host);
+      throw;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  } else {
+    wake_.notify_one();
+  }
+}
+
+size_t Resolver::collect(std::vector<Resolution> &results) {
+  // Reset the counter first, a lookup finishing meanwhile signals again
+  uint64_t signals;
+  if (!read_eventfd(event_fd_, signals) && errno != EAGAIN) {
+    throw std::runtime_error("Unable to read resolver eventfd");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto collected = finished_.size();
+  std::move(finished_.begin(), finished_.end(), std::back_inserter(results));
+  finished_.clear();
+  return collected;
+}
+
+void Resolver::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ++idle_workers_;
+    wake_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+    --idle_workers_;
+    if (stopping_) {
+      return;
+    }
+
+    auto host = std::move(requests_.front());
+    requests_.pop_front();
+
+    // The lookup blocks, other workers keep going meanwhile
+    Resolution resolution;
+    resolution.host = host;
+    lock.unlock();
+    resolution.resolved = lookup_host(host, resolution.address);
+    lock.lock();
+
+    if (resolution.resolved) {
+      cache_[host] = {resolution.address, steady_clock::now() + ttl_};
+    }
+    in_flight_.erase(host);
+    // The caller would wait for this lookup forever otherwise, services
+    // take SIGINT through their loop and stop on it
+    if (!finish(std::move(resolution))) {
+      kill(getpid(), SIGINT);
+    }
+  }
+}
+
+bool Resolver::finish(Resolution resolution) {
+  finished_.push_back(std::move(resolution));
+  return signal_eventfd(event_fd_);
+}
+} // namespace pico_ping
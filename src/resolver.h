@@ -0,0 +1,153 @@
+/**
+ * @file resolver.h
+ * @ingroup Ping_Service
+ * @brief Concurrent hostname resolution with an in-process cache
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "socket_address.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Outcome of resolving one hostname
+ */
+struct Resolution {
+  std::string host;
+  Socket_Address address;
+  bool resolved = false;
+};
+
+/**
+ * @brief Whether a string is a syntactically valid DNS hostname
+ *
+ * Labels are 1 to 63 letters, digits, hyphens or underscores that neither
+ * start nor end with a hyphen, and the whole name is at most 253 characters.
+ */
+bool valid_hostname(const std::string &host);
+
+/**
+ * @brief Resolves a hostname to its preferred address, blocking
+ *
+ * Only families the system has an address configured for are considered, so
+ * v6-only and v4-only hosts each get an address they can reach.
+ *
+ * @param[in] host Hostname to look up
+ * @param[out] address First address getaddrinfo returned
+ *
+ * @return false if the lookup failed
+ */
+bool lookup_host(const std::string &host, Socket_Address &address);
+
+/**
+ * @brief Resolves hostnames on a pool of worker threads
+ *
+ * Lookups are queued by resolve and run concurrently on up to max_workers
+ * threads, started as requests arrive. Finished lookups are collected on the
+ * calling thread, event_fd becomes readable whenever some are waiting so the
+ * resolver plugs into an event loop. Successful answers are cached for the
+ * time to live, getaddrinfo does not expose record TTLs so one fixed value
+ * applies to every name. Failures are never cached.
+ */
+class Resolver {
+public:
+  /**
+   * @brief Construct an idle resolver, no threads are started yet
+   *
+   * @param[in] ttl How long an answer is served from the cache
+   * @param[in] max_workers Most lookups running at the same time
+   *
+   * @throw std::runtime_error if the eventfd cannot be created
+   */
+  explicit Resolver(seconds ttl = seconds(60), size_t max_workers = 16);
+
+  /**
+   * @brief Waits for lookups that are running to finish and stops the workers
+   */
+  ~Resolver();
+
+  Resolver(const Resolver &) = delete;
+  Resolver &operator=(const Resolver &) = delete;
+
+  /**
+   * @brief Requests a lookup, answered from the cache while it is fresh
+   *
+   * A host that is already being looked up is not queued a second time.
+   *
+   * @param[in] host Hostname to look up
+   * @param[in] refresh Look the host up even if its answer is still cached,
+   * for periodic re-resolution that must not be served its own last answer
+   *
+   * @throw std::runtime_error if event_fd cannot be signalled, or
+   * std::system_error if a worker thread cannot be started. The caller's
+   * signal mask is left as it was either way
+   */
+  void resolve(const std::string &host, bool refresh = false);
+
+  /**
+   * @brief Moves every finished lookup into results
+   *
+   * @return Number of resolutions appended
+   *
+   * @throw std::runtime_error if event_fd cannot be read
+   */
+  size_t collect(std::vector<Resolution> &results);
+
+  /**
+   * @brief Descriptor that is readable while finished lookups are waiting
+   *
+   * The descriptor stays owned by the resolver.
+   */
+  int event_fd() const { return event_fd_; }
+
+  seconds ttl() const { return ttl_; }
+
+private:
+  struct Cache_Entry {
+    Socket_Address address;
+    time_point<steady_clock> expires;
+  };
+
+  /**
+   * @brief Worker thread body, runs lookups until the resolver is destroyed
+   */
+  void work();
+
+  /**
+   * @brief Queues a finished lookup and signals event_fd, mutex_ held
+   *
+   * @return false if event_fd could not be signalled
+   */
+  bool finish(Resolution resolution);
+
+  seconds ttl_;
+  size_t max_workers_;
+  int event_fd_ = -1;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::string> requests_;
+  std::unordered_set<std::string> in_flight_;
+  std::vector<Resolution> finished_;
+  std::unordered_map<std::string, Cache_Entry> cache_;
+  std::vector<std::thread> workers_;
+  size_t idle_workers_ = 0;
+  bool stopping_ = false;
+};
+} // namespace pico_ping
@@ -0,0 +1,58 @@
+/**
+ * @file ring_queue.h
+ * @ingroup Ping_Service
+ * @brief Bounded FIFO backed by a preallocated ring
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace pico_ping {
+
+/**
+ * @brief Fixed capacity FIFO that never allocates after construction
+ *
+ * @tparam T Trivially copyable element type
+ */
+template <typename T> class Ring_Queue {
+public:
+  Ring_Queue() = default;
+  explicit Ring_Queue(size_t capacity) : items_(capacity) {}
+
+  bool empty() const { return count_ == 0; }
+  bool full() const { return count_ == items_.size(); }
+  size_t size() const { return count_; }
+  size_t capacity() const { return items_.size(); }
+
+  /**
+   * @brief Appends an element to the back of the queue
+   *
+   * @return false if the queue is full and nothing was added
+   */
+  bool push(const T &item) {
+    if (full()) {
+      return false;
+    }
+    items_[(head_ + count_) % items_.size()] = item;
+    ++count_;
+    return true;
+  }
+
+  T &front() { return items_[head_]; }
+
+  void pop() {
+    head_ = (head_ + 1) % items_.size();
+    --count_;
+  }
+
+private:
+  std::vector<T> items_;
+  size_t head_ = 0;
+  size_t count_ = 0;
+};
+} // namespace pico_ping
@@ -0,0 +1,126 @@
+/**
+ * @file rtt_stats.cpp
+ * @ingroup Ping_Service
+ * @brief Streaming RTT statistics in constant memory
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "rtt_stats.h"
+
+namespace pico_ping {
+
+void Rtt_Stats::record_rtt(double rtt_ms) {
+  ++received_;
+  if (received_ == 1) {
+    min_ = max_ = rtt_ms;
+  } else {
+    min_ = std::min(min_, rtt_ms);
+    max_ = std::max(max_, rtt_ms);
+  }
+
+  auto delta = rtt_ms - mean_;
+  mean_ += delta / received_;
+  m2_ += delta * (rtt_ms - mean_);
+
+  auto rtt_us = static_cast<uint64_t>(std::max(rtt_ms, 0.0) * 1000 + 0.5);
+  auto &count = histogram_[bucket_of(rtt_us)];
+  if (count != UINT32_MAX) {
+    ++count;
+  }
+}
+
+void Rtt_Stats::merge(const Rtt_Stats &other) {
+  transmitted_ += other.transmitted_;
+  duplicates_ += other.duplicates_;
+  lost_ += other.lost_;
+  if (other.received_ == 0) {
+    return;
+  }
+
+  if (received_ == 0) {
+    min_ = other.min_;
+    max_ = other.max_;
+  } else {
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  auto count = received_ + other.received_;
+  auto delta = other.mean_ - mean_;
+  mean_ += delta * other.received_ / count;
+  m2_ += other.m2_ +
+         delta * delta * static_cast<double>(received_) * other.received_ /
+             count;
+  received_ = count;
+
+  for (size_t bucket = 0; bucket < histogram_.size(); ++bucket) {
+    auto sum = uint64_t(histogram_[bucket]) + other.histogram_[bucket];
+    histogram_[bucket] =
+        static_cast<uint32_t>(std::min<uint64_t>(sum, UINT32_MAX));
+  }
+}
+
+double Rtt_Stats::loss() const {
+  if (transmitted_ == 0 || received_ >= transmitted_) {
+    return 0;
+  }
+  return static_cast<double>(transmitted_ - received_) / transmitted_;
+}
+
+double Rtt_Stats::mdev() const {
+  return received_ > 1 ? std::sqrt(m2_ / received_) : 0;
+}
+
+// Values below the sub bucket count map one to one, above that the top
+// sub_bucket_bits below the leading bit select the sub bucket
+size_t Rtt_Stats::bucket_of(uint64_t rtt_us) {
+  rtt_us = std::min(rtt_us, (uint64_t(1) << (max_exponent + 1)) - 1);
+  if (rtt_us < sub_buckets) {
+    return static_cast<size_t>(rtt_us);
+  }
+  unsigned exponent = 63 - __builtin_clzll(rtt_us);
+  auto sub = (rtt_us >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+  return (exponent - sub_bucket_bits + 1) * sub_buckets + sub;
+}
+
+double Rtt_Stats::bucket_value(size_t bucket) {
+  if (bucket < sub_buckets) {
+    return static_cast<double>(bucket);
+  }
+  unsigned exponent =
+      static_cast<unsigned>(bucket / sub_buckets) + sub_bucket_bits - 1;
+  auto sub = bucket % sub_buckets;
+  auto width = uint64_t(1) << (exponent - sub_bucket_bits);
+  auto low = (sub_buckets + sub) * width;
+  return low + (width - 1) / 2.0;
+}
+
+double Rtt_Stats::percentile(double fraction) const {
+  if (received_ == 0) {
+    return 0;
+  }
+
+  // Rank of the sample the percentile falls on, counted from one
+  auto rank = static_cast<uint64_t>(
+      std::ceil(std::clamp(fraction, 0.0, 1.0) * received_));
+  rank = std::max<uint64_t>(rank, 1);
+  if (rank == received_) {
+    return max_;
+  }
+
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < histogram_.size(); ++bucket) {
+    seen += histogram_[bucket];
+    if (seen >= rank) {
+      return std::clamp(bucket_value(bucket) / 1000, min_, max_);
+    }
+  }
+  return max_;
+}
+} // namespace pico_ping
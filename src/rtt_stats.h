@@ -0,0 +1,111 @@
+/**
+ * @file rtt_stats.h
+ * @ingroup Ping_Service
+ * @brief Streaming RTT statistics in constant memory
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace pico_ping {
+
+/**
+ * @brief Aggregates probe outcomes and RTTs of one target as they happen
+ *
+ * Mean and variance are kept with Welford's online algorithm, so they stay
+ * accurate over any number of samples. Percentiles come from a log bucketed
+ * histogram in the style of HDR histograms: each power of two of microseconds
+ * is split into 16 linear sub buckets, which bounds the relative error of a
+ * percentile to about 3% from 1us up to half an hour. Memory is fixed no
+ * matter how many samples are recorded.
+ */
+class Rtt_Stats {
+public:
+  void record_sent() { ++transmitted_; }
+
+  /**
+   * @brief Adds the RTT of a probe that was answered in time
+   *
+   * @param[in] rtt_ms Round trip time in milliseconds
+   */
+  void record_rtt(double rtt_ms);
+
+  void record_duplicate() { ++duplicates_; }
+  void record_lost() { ++lost_; }
+
+  /**
+   * @brief Adds every outcome and RTT recorded by another instance
+   *
+   * Mean and variance are combined exactly with Chan's parallel update, so
+   * merging gives the same result as recording all samples in one instance.
+   *
+   * @param[in] other Statistics to fold in
+   */
+  void merge(const Rtt_Stats &other);
+
+  uint64_t transmitted() const { return transmitted_; }
+  uint64_t received() const { return received_; }
+  uint64_t duplicates() const { return duplicates_; }
+  uint64_t lost() const { return lost_; }
+
+  /**
+   * @brief Share of sent probes without a reply so far, from 0 to 1
+   */
+  double loss() const;
+
+  // All in milliseconds, zero until the first RTT is recorded
+  double min() const { return received_ ? min_ : 0; }
+  double max() const { return received_ ? max_ : 0; }
+  double mean() const { return mean_; }
+  /**
+   * @brief Standard deviation of the RTTs, what ping reports as mdev
+   */
+  double mdev() const;
+
+  /**
+   * @brief RTT below which the given share of samples falls
+   *
+   * @param[in] fraction Share of samples from 0 to 1, e.g. 0.99 for p99
+   *
+   * @return RTT in milliseconds, zero until the first RTT is recorded
+   */
+  double percentile(double fraction) const;
+
+private:
+  static constexpr unsigned sub_bucket_bits = 4;
+  static constexpr uint64_t sub_buckets = uint64_t(1) << sub_bucket_bits;
+  // Covers up to 2^31 microseconds, larger RTTs land in the last bucket
+  static constexpr unsigned max_exponent = 30;
+  static constexpr size_t bucket_count =
+      (max_exponent - sub_bucket_bits + 2) * sub_buckets;
+
+  /**
+   * @brief Histogram bucket holding an RTT in microseconds
+   */
+  static size_t bucket_of(uint64_t rtt_us);
+
+  /**
+   * @brief Midpoint of a histogram bucket in microseconds
+   */
+  static double bucket_value(size_t bucket);
+
+  uint64_t transmitted_ = 0;
+  uint64_t received_ = 0;
+  uint64_t duplicates_ = 0;
+  uint64_t lost_ = 0;
+
+  double min_ = 0;
+  double max_ = 0;
+  double mean_ = 0;
+  // Sum of squared differences from the mean, Welford's M2
+  double m2_ = 0;
+
+  std::array<uint32_t, bucket_count> histogram_{};
+};
+} // namespace pico_ping
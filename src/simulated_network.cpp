@@ -0,0 +1,243 @@
+/**
+ * @file simulated_network.cpp
+ * @ingroup Ping_Service
+ * @brief In-process network answering echo requests without any sockets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "event_fd.h"
+#include "simulated_network.h"
+
+namespace pico_ping {
+
+// Orders the delivery heap so the earliest reply is at its front
+static constexpr auto later = [](const auto &a, const auto &b) {
+  return a.at != b.at ? a.at > b.at : a.order > b.order;
+};
+
+static bool probability(double p) { return p >= 0 && p <= 1; }
+
+Simulated_IO::Simulated_IO(int family, const Network_Profile &profile,
+                           size_t batch_size, size_t packet_size, uint64_t seed,
+                           Virtual_Clock *clock)
+    : echo_reply_(family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY),
+      profile_(profile), batch_size_(std::max(batch_size, size_t(1))),
+      packet_size_(packet_size), clock_(clock), random_(seed) {
+  if (!probability(profile_.loss) || !probability(profile_.duplicate) ||
+      !probability(profile_.reorder)) {
+    throw std::invalid_argument("Network probabilities must be in 0..1.");
+  }
+  auto capacity = std::clamp<size_t>(profile_.capacity, 1, UINT32_MAX);
+
+  send_buffers_.resize(batch_size_ * packet_size_);
+  send_lengths_.resize(batch_size_);
+  send_addrs_.resize(batch_size_);
+  send_cookies_.resize(batch_size_);
+
+  deliveries_.reserve(capacity);
+  pool_.resize(capacity * packet_size_);
+  free_buffers_.resize(capacity);
+  for (size_t i = 0; i < capacity; ++i) {
+    free_buffers_[i] = static_cast<uint32_t>(capacity - 1 - i);
+  }
+
+  recv_buffers_.resize(batch_size_ * packet_size_);
+  recv_lengths_.resize(batch_size_);
+  recv_addrs_.resize(batch_size_);
+  recv_headers_.assign(batch_size_, {});
+  for (size_t i = 0; i < batch_size_; ++i) {
+    recv_headers_[i].msg_name = &recv_addrs_[i];
+    recv_headers_[i].msg_namelen = sizeof(recv_addrs_[i]);
+  }
+
+  if (clock_ != nullptr) {
+    timer_fd_ = clock_->add_timer();
+    return;
+  }
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd_ < 0) {
+    throw std::runtime_error("Unable to create simulated network timer");
+  }
+}
+
+Simulated_IO::~Simulated_IO() {
+  if (clock_ != nullptr) {
+    clock_->remove_timer(timer_fd_);
+  }
+  close(timer_fd_);
+}
+
+void Simulated_IO::queue(const void *head, size_t head_length,
+                         const void *tail, size_t tail_length,
+                         const Socket_Address &dest, uint64_t cookie) {
+  head_length = std::min(head_length, packet_size_);
+  tail_length = std::min(tail_length, packet_size_ - head_length);
+
+  auto buffer = send_buffers_.data() + queued_ * packet_size_;
+  std::memcpy(buffer, head, head_length);
+  if (tail_length > 0) {
+    std::memcpy(buffer + head_length, tail, tail_length);
+  }
+  send_lengths_[queued_] = static_cast<uint32_t>(head_length + tail_length);
+  send_addrs_[queued_] = dest;
+  send_cookies_[queued_] = cookie;
+  ++queued_;
+}
+
+size_t Simulated_IO::flush() {
+  auto now = this->now();
+  for (size_t i = 0; i < queued_; ++i) {
+    ++counters_.sent;
+    deliver(i, now);
+  }
+  sent_count_ = queued_;
+  queued_ = 0;
+
+  if (!deliveries_.empty() && deliveries_.front().at < armed_) {
+    arm_timer();
+  }
+  return 0;
+}
+
+void Simulated_IO::deliver(size_t slot, time_point<steady_clock> now) {
+  if (chance_(random_) < profile_.loss) {
+    ++counters_.lost;
+    return;
+  }
+  int copies = 1;
+  if (chance_(random_) < profile_.duplicate) {
+    ++counters_.duplicated;
+    copies = 2;
+  }
+
+  for (int copy = 0; copy < copies; ++copy) {
+    if (free_buffers_.empty()) {
+      ++counters_.overflowed;
+      continue;
+    }
+    auto delay = sample_latency();
+    if (chance_(random_) < profile_.reorder) {
+      ++counters_.reordered;
+      delay += profile_.reorder_delay;
+    }
+
+    // The echo reply is the request with its type flipped, the checksum is
+    // left as is because replies are never verified
+    auto buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+    auto length = send_lengths_[slot];
+    auto data = pool_.data() + buffer * packet_size_;
+    std::memcpy(data, send_buffers_.data() + slot * packet_size_, length);
+    if (length > 0) {
+      data[0] = echo_reply_;
+    }
+
+    deliveries_.push_back(
+        {now + delay, next_order_++, buffer, length, send_addrs_[slot]});
+    std::push_heap(deliveries_.begin(), deliveries_.end(), later);
+  }
+}
+
+nanoseconds Simulated_IO::sample_latency() {
+  auto base = static_cast<double>(profile_.latency.count());
+  auto jitter = static_cast<double>(profile_.jitter.count());
+  double latency = base;
+  switch (profile_.latency_model) {
+  case Latency_Model::constant:
+    break;
+  case Latency_Model::uniform:
+    latency += jitter * (2 * chance_(random_) - 1);
+    break;
+  case Latency_Model::normal:
+    latency += jitter * normal_(random_);
+    break;
+  case Latency_Model::exponential:
+    latency += jitter * exponential_(random_);
+    break;
+  }
+  return nanoseconds(std::max<int64_t>(std::llround(latency), 0));
+}
+
+void Simulated_IO::arm_timer() {
+  armed_ = time_point<steady_clock>::max();
+  if (clock_ != nullptr) {
+    if (deliveries_.empty()) {
+      clock_->disarm_timer(timer_fd_);
+    } else {
+      armed_ = deliveries_.front().at;
+      clock_->arm_timer(timer_fd_, armed_);
+    }
+    return;
+  }
+
+  itimerspec spec{};
+  if (!deliveries_.empty()) {
+    armed_ = deliveries_.front().at;
+    auto at = duration_cast<nanoseconds>(armed_.time_since_epoch()).count();
+    // A zero value would disarm the timer instead
+    at = std::max<int64_t>(at, 1);
+    spec.it_value.tv_sec = static_cast<time_t>(at / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(at % 1000000000);
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+    throw std::runtime_error("Unable to arm simulated network timer");
+  }
+}
+
+size_t Simulated_IO::receive() {
+  // Reading clears readiness, the timer is armed again below. It has not
+  // expired if receive was called for another reason
+  uint64_t expirations;
+  if (!read_eventfd(timer_fd_, expirations) && errno != EAGAIN) {
+    throw std::runtime_error("Unable to read simulated network timer");
+  }
+
+  auto now = this->now();
+  size_t count = 0;
+  while (count < batch_size_ && !deliveries_.empty() &&
+         deliveries_.front().at <= now) {
+    std::pop_heap(deliveries_.begin(), deliveries_.end(), later);
+    auto &delivery = deliveries_.back();
+    std::memcpy(recv_buffers_.data() + count * packet_size_,
+                pool_.data() + delivery.buffer * packet_size_,
+                delivery.length);
+    recv_lengths_[count] = delivery.length;
+    recv_addrs_[count] = delivery.from;
+    free_buffers_.push_back(delivery.buffer);
+    deliveries_.pop_back();
+    ++count;
+  }
+  counters_.delivered += count;
+
+  arm_timer();
+  return count;
+}
+
+Received_Packet Simulated_IO::packet(size_t index) const {
+  return {recv_buffers_.data() + index * packet_size_, recv_lengths_[index],
+          &recv_addrs_[index], &recv_headers_[index]};
+}
+
+Transport_Socket Simulated_Network::open(int family, size_t batch_size,
+                                         size_t packet_size, size_t) {
+  // Endpoints differ in seed, in the order they were opened
+  auto endpoint = endpoints_.fetch_add(1);
+  Transport_Socket socket;
+  socket.io = std::make_unique<Simulated_IO>(
+      family, profile_, batch_size, packet_size,
+      profile_.seed + endpoint * 0x9e3779b97f4a7c15ull, clock_.get());
+  return socket;
+}
+} // namespace pico_ping
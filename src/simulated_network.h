@@ -0,0 +1,217 @@
+/**
+ * @file simulated_network.h
+ * @ingroup Ping_Service
+ * @brief In-process network answering echo requests without any sockets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+#include "transport.h"
+#include "virtual_clock.h"
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Distribution the one way latency of simulated replies is drawn from
+ */
+enum class Latency_Model {
+  constant,   ///< Always the base latency
+  uniform,    ///< Base latency plus or minus up to the jitter
+  normal,     ///< Mean of the base latency, standard deviation of the jitter
+  exponential ///< Base latency plus an exponential delay with mean jitter
+};
+
+/**
+ * @brief Behaviour of a simulated network, defaults answer every request
+ * after one millisecond
+ */
+struct Network_Profile {
+  Latency_Model latency_model = Latency_Model::constant;
+  nanoseconds latency = milliseconds(1);
+  nanoseconds jitter = nanoseconds(0);
+  // Probability that a request goes unanswered
+  double loss = 0;
+  // Probability that a reply arrives twice, each copy with its own latency
+  double duplicate = 0;
+  // Probability that a reply is held back by reorder_delay, so replies sent
+  // after it overtake it
+  double reorder = 0;
+  nanoseconds reorder_delay = milliseconds(10);
+  // Replies in flight per endpoint, further ones are dropped like they would
+  // be by a full socket receive buffer
+  size_t capacity = 4096;
+  // Seeds the decisions of every endpoint, the same profile and send order
+  // always lose, duplicate and delay the same replies
+  uint64_t seed = 0;
+};
+
+/**
+ * @brief What a simulated endpoint did with the requests it was sent
+ */
+struct Network_Counters {
+  uint64_t sent = 0;
+  uint64_t lost = 0;
+  uint64_t duplicated = 0;
+  uint64_t reordered = 0;
+  // Replies dropped because capacity replies were in flight already
+  uint64_t overflowed = 0;
+  uint64_t delivered = 0;
+};
+
+/**
+ * @brief Packet I/O that turns every request into a delayed echo reply
+ *
+ * Flushed requests are copied into a preallocated pool as replies from their
+ * destination and kept in a heap ordered by delivery time. A timerfd armed
+ * for the earliest delivery serves as event descriptor, so the reply path of
+ * the service runs exactly as it does for a kernel socket. Nothing is
+ * allocated after construction.
+ *
+ * Given a Virtual_Clock, replies travel in simulated time and the timer is
+ * one of the clock's, so a service on the same clock never waits for them.
+ */
+class Simulated_IO : public Packet_IO {
+public:
+  /**
+   * @brief Construct the reply pool and the delivery timer
+   *
+   * @param[in] family AF_INET or AF_INET6, selects the echo reply type
+   * @param[in] profile Latency, loss, duplication and reordering to apply
+   * @param[in] batch_size Number of datagrams per flush or receive
+   * @param[in] packet_size Largest datagram that is sent or received
+   * @param[in] seed Seeds the decisions of this endpoint
+   * @param[in] clock Simulated time replies travel in, null for real time.
+   * Must outlive the endpoint
+   *
+   * @throw std::invalid_argument if a probability is outside 0..1
+   * @throw std::runtime_error if the timer cannot be created
+   */
+  Simulated_IO(int family, const Network_Profile &profile, size_t batch_size,
+               size_t packet_size, uint64_t seed,
+               Virtual_Clock *clock = nullptr);
+  ~Simulated_IO() override;
+
+  Simulated_IO(const Simulated_IO &) = delete;
+  Simulated_IO &operator=(const Simulated_IO &) = delete;
+
+  using Packet_IO::queue;
+  void queue(const void *head, size_t head_length, const void *tail,
+             size_t tail_length, const Socket_Address &dest,
+             uint64_t cookie) override;
+  bool full() const override { return queued_ == batch_size_; }
+  size_t flush() override;
+  size_t sent_count() const override { return sent_count_; }
+  uint64_t sent_cookie(size_t index) const override {
+    return send_cookies_[index];
+  }
+  size_t receive() override;
+  Received_Packet packet(size_t index) const override;
+  size_t batch_size() const override { return batch_size_; }
+  int event_fd() const override { return timer_fd_; }
+
+  /**
+   * @brief Replies still travelling
+   */
+  size_t in_flight() const { return deliveries_.size(); }
+
+  const Network_Counters &counters() const { return counters_; }
+
+private:
+  struct Delivery {
+    time_point<steady_clock> at;
+    // Send order, keeps replies due at the same time in order
+    uint64_t order;
+    uint32_t buffer;
+    uint32_t length;
+    Socket_Address from;
+  };
+
+  /**
+   * @brief Puts a copy of a request on its way back as a reply
+   */
+  void deliver(size_t slot, time_point<steady_clock> now);
+  nanoseconds sample_latency();
+  /**
+   * @brief Arms the timer for the earliest delivery, disarms it if none
+   */
+  void arm_timer();
+  time_point<steady_clock> now() const {
+    return clock_ != nullptr ? clock_->now() : steady_clock::now();
+  }
+
+  uint8_t echo_reply_;
+  Network_Profile profile_;
+  size_t batch_size_;
+  size_t packet_size_;
+  Virtual_Clock *clock_;
+  int timer_fd_ = -1;
+  std::mt19937_64 random_;
+  std::uniform_real_distribution<double> chance_{0.0, 1.0};
+  std::normal_distribution<double> normal_{0.0, 1.0};
+  std::exponential_distribution<double> exponential_{1.0};
+  Network_Counters counters_;
+
+  size_t queued_ = 0;
+  size_t sent_count_ = 0;
+  std::vector<unsigned char> send_buffers_;
+  std::vector<uint32_t> send_lengths_;
+  std::vector<Socket_Address> send_addrs_;
+  std::vector<uint64_t> send_cookies_;
+
+  // Min-heap on delivery time over replies whose data sits in the pool
+  std::vector<Delivery> deliveries_;
+  std::vector<unsigned char> pool_;
+  std::vector<uint32_t> free_buffers_;
+  uint64_t next_order_ = 0;
+  time_point<steady_clock> armed_ = time_point<steady_clock>::max();
+
+  std::vector<unsigned char> recv_buffers_;
+  std::vector<uint32_t> recv_lengths_;
+  std::vector<Socket_Address> recv_addrs_;
+  std::vector<struct msghdr> recv_headers_;
+};
+
+/**
+ * @brief Transport whose endpoints are Simulated_IO instances
+ *
+ * Lets the whole engine be tested and benchmarked on a machine without
+ * network access or ICMP permissions. Every opened endpoint gets its own
+ * seed derived from the profile, so worker threads never share state.
+ */
+class Simulated_Network : public Transport {
+public:
+  /**
+   * @param[in] profile Behaviour of every endpoint
+   * @param[in] clock Simulated time replies travel in, the one of the service
+   * using the network. Null for real time
+   */
+  explicit Simulated_Network(const Network_Profile &profile = {},
+                             std::shared_ptr<Virtual_Clock> clock = nullptr)
+      : profile_(profile), clock_(std::move(clock)) {}
+
+  Transport_Socket open(int family, size_t batch_size, size_t packet_size,
+                        size_t control_size) override;
+
+  const Network_Profile &profile() const { return profile_; }
+
+private:
+  Network_Profile profile_;
+  std::shared_ptr<Virtual_Clock> clock_;
+  std::atomic<uint64_t> endpoints_{0};
+};
+} // namespace pico_ping
@@ -0,0 +1,67 @@
+/**
+ * @file socket_address.cpp
+ * @ingroup Ping_Service
+ * @brief Address storage shared by IPv4 and IPv6 destinations
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <cstring>
+
+#include "socket_address.h"
+
+namespace pico_ping {
+
+// Host part of the address as raw bytes, empty for unknown families
+static const unsigned char *host_bytes(const Socket_Address &address,
+                                       size_t &length) {
+  if (address.any.sa_family == AF_INET6) {
+    length = sizeof(address.v6.sin6_addr);
+    return reinterpret_cast<const unsigned char *>(&address.v6.sin6_addr);
+  }
+  if (address.any.sa_family == AF_INET) {
+    length = sizeof(address.v4.sin_addr);
+    return reinterpret_cast<const unsigned char *>(&address.v4.sin_addr);
+  }
+  length = 0;
+  return nullptr;
+}
+
+socklen_t address_length(const Socket_Address &address) {
+  return address.any.sa_family == AF_INET6 ? sizeof(address.v6)
+                                           : sizeof(address.v4);
+}
+
+std::string address_to_string(const Socket_Address &address) {
+  char text[INET6_ADDRSTRLEN];
+  size_t length;
+  auto bytes = host_bytes(address, length);
+  if (bytes == nullptr ||
+      inet_ntop(address.any.sa_family, bytes, text, sizeof(text)) == nullptr) {
+    return "";
+  }
+  return text;
+}
+
+bool same_host(const Socket_Address &lhs, const Socket_Address &rhs) {
+  size_t lhs_length, rhs_length;
+  auto lhs_bytes = host_bytes(lhs, lhs_length);
+  auto rhs_bytes = host_bytes(rhs, rhs_length);
+  return lhs.any.sa_family == rhs.any.sa_family && lhs_length == rhs_length &&
+         (lhs_length == 0 ||
+          std::memcmp(lhs_bytes, rhs_bytes, lhs_length) == 0);
+}
+
+// FNV-1a over the host bytes, cheap for the 4 or 16 bytes involved
+size_t Address_Hash::operator()(const Socket_Address &address) const {
+  size_t length;
+  auto bytes = host_bytes(address, length);
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return static_cast<size_t>(hash);
+}
+} // namespace pico_ping
@@ -0,0 +1,59 @@
+/**
+ * @file socket_address.h
+ * @ingroup Ping_Service
+ * @brief Address storage shared by IPv4 and IPv6 destinations
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Socket address of either family, the family field tells which
+ *
+ * Only as large as the largest supported address, so it is cheap to keep one
+ * per target and per batch slot.
+ */
+union Socket_Address {
+  struct sockaddr any;
+  struct sockaddr_in v4;
+  struct sockaddr_in6 v6;
+};
+
+/**
+ * @brief Length to pass to socket calls for the address family in use
+ */
+socklen_t address_length(const Socket_Address &address);
+
+/**
+ * @brief Numeric text form of the host part, e.g. 8.8.8.8 or 2001:db8::1
+ */
+std::string address_to_string(const Socket_Address &address);
+
+/**
+ * @brief Whether two addresses name the same host, ports are ignored
+ */
+bool same_host(const Socket_Address &lhs, const Socket_Address &rhs);
+
+/**
+ * @brief Hashes the host part so addresses can key unordered containers
+ */
+struct Address_Hash {
+  size_t operator()(const Socket_Address &address) const;
+};
+
+struct Address_Equal {
+  bool operator()(const Socket_Address &lhs, const Socket_Address &rhs) const {
+    return same_host(lhs, rhs);
+  }
+};
+} // namespace pico_ping
@@ -0,0 +1,277 @@
+/**
+ * @file target_file.cpp
+ * @ingroup Ping_Service
+ * @brief Streaming parser for files listing one destination per line
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "resolver.h"
+#include "target_file.h"
+
+namespace pico_ping {
+
+// Most a single read takes from a pipe, and the longest line kept when
+// waiting for its end
+static constexpr size_t chunk_size = 64 * 1024;
+
+bool parse_ipv4(const char *begin, const char *end, uint32_t &address) {
+  uint32_t value = 0;
+  for (int octet = 0; octet < 4; ++octet) {
+    if (octet > 0) {
+      if (begin == end || *begin != '.') {
+        return false;
+      }
+      ++begin;
+    }
+
+    unsigned number = 0;
+    int digits = 0;
+    while (begin != end && *begin >= '0' && *begin <= '9' && digits < 3) {
+      number = number * 10 + static_cast<unsigned>(*begin - '0');
+      ++begin;
+      ++digits;
+    }
+    if (digits == 0 || number > 255) {
+      return false;
+    }
+    value = (value << 8) | number;
+  }
+  if (begin != end) {
+    return false;
+  }
+  address = htonl(value);
+  return true;
+}
+
+Target_File::Target_File(const std::string &path, size_t shard,
+                         size_t shard_count)
+    : shard_(shard), shard_count_(std::max<size_t>(shard_count, 1)) {
+  if (path == "-") {
+    fd_ = STDIN_FILENO;
+  } else {
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      throw std::invalid_argument("Unable to open target file.");
+    }
+    owns_fd_ = true;
+  }
+
+  struct stat info;
+  if (fstat(fd_, &info) == 0 && S_ISREG(info.st_mode)) {
+    map_size_ = static_cast<size_t>(info.st_size);
+    if (map_size_ == 0) {
+      eof_ = true;
+      return;
+    }
+    auto map = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (map != MAP_FAILED) {
+      // Lines are consumed front to back, read ahead and drop behind
+      madvise(map, map_size_, MADV_SEQUENTIAL);
+      map_ = static_cast<const char *>(map);
+      return;
+    }
+  }
+
+  // Every stripe would have to see the whole stream
+  if (shard_count_ > 1) {
+    if (owns_fd_) {
+      close(fd_);
+    }
+    throw std::invalid_argument("Streamed target files need one worker.");
+  }
+}
+
+Target_File::~Target_File() {
+  if (map_ != nullptr) {
+    munmap(const_cast<char *>(map_), map_size_);
+    map_ = nullptr;
+  }
+  if (owns_fd_) {
+    close(fd_);
+    owns_fd_ = false;
+  }
+}
+
+bool Target_File::at_end() const {
+  if (in_range_) {
+    return false;
+  }
+  if (map_ != nullptr) {
+    return map_offset_ >= map_size_;
+  }
+  return eof_ && buffer_offset_ >= buffer_.size();
+}
+
+void Target_File::fill() {
+  if (map_ != nullptr || eof_) {
+    return;
+  }
+
+  // Drop consumed lines before they outgrow what is still unread
+  if (buffer_offset_ > 0 && buffer_offset_ >= buffer_.size() / 2) {
+    auto consumed = static_cast<std::ptrdiff_t>(buffer_offset_);
+    buffer_.erase(buffer_.begin(), buffer_.begin() + consumed);
+    buffer_offset_ = 0;
+  }
+
+  // Readable with nothing queued means the writer is gone, the read then
+  // returns zero right away instead of blocking
+  int available = 0;
+  ioctl(fd_, FIONREAD, &available);
+  auto size =
+      std::clamp<size_t>(static_cast<size_t>(available), 1, chunk_size);
+
+  auto used = buffer_.size();
+  buffer_.resize(used + size);
+  auto got = read(fd_, buffer_.data() + used, size);
+  buffer_.resize(used + static_cast<size_t>(std::max<ssize_t>(got, 0)));
+  if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+    eof_ = true;
+  }
+}
+
+bool Target_File::next_line(const char *&begin, const char *&end) {
+  const char *data;
+  size_t size, *offset;
+  if (map_ != nullptr) {
+    data = map_;
+    size = map_size_;
+    offset = &map_offset_;
+  } else {
+    data = buffer_.data();
+    size = buffer_.size();
+    offset = &buffer_offset_;
+  }
+  if (*offset >= size) {
+    return false;
+  }
+
+  begin = data + *offset;
+  auto newline =
+      static_cast<const char *>(std::memchr(begin, '\n', size - *offset));
+  if (newline == nullptr) {
+    // A stream may still complete the line, unless it is absurdly long
+    if (map_ == nullptr && !eof_ && size - *offset < chunk_size) {
+      return false;
+    }
+    end = data + size;
+    *offset = size;
+    return true;
+  }
+  end = newline;
+  *offset = static_cast<size_t>(newline - data) + 1;
+  return true;
+}
+
+Target_File::Line Target_File::parse_line(const char *begin, const char *end,
+                                          Target_Entry &entry) {
+  auto comment =
+      static_cast<const char *>(std::memchr(begin, '#', end - begin));
+  if (comment != nullptr) {
+    end = comment;
+  }
+  auto space = [](char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+  };
+  while (begin != end && space(*begin)) {
+    ++begin;
+  }
+  while (end != begin && space(end[-1])) {
+    --end;
+  }
+  if (begin == end) {
+    return Line::skip;
+  }
+
+  // By far the most common line takes the fast path
+  std::memset(&entry.address, 0, sizeof(entry.address));
+  entry.host.clear();
+  entry.resolved = true;
+  if (parse_ipv4(begin, end, entry.address.v4.sin_addr.s_addr)) {
+    entry.address.v4.sin_family = AF_INET;
+    return Line::entry;
+  }
+
+  // Digits and dots only would pass as a hostname but is a broken address
+  if (std::all_of(begin, end, [](char c) {
+        return c == '.' || (c >= '0' && c <= '9');
+      })) {
+    skipped_ += shard_ == 0;
+    return Line::skip;
+  }
+
+  std::string text(begin, end);
+  try {
+    if (parse_address_range(text, range_)) {
+      return Line::range;
+    }
+  } catch (const std::invalid_argument &) {
+    skipped_ += shard_ == 0;
+    return Line::skip;
+  }
+
+  if (text.find(':') != std::string::npos) {
+    auto &v6 = entry.address.v6;
+    v6.sin6_family = AF_INET6;
+    if (inet_pton(AF_INET6, text.c_str(), &v6.sin6_addr) == 1) {
+      return Line::entry;
+    }
+  } else if (valid_hostname(text)) {
+    entry.host = std::move(text);
+    entry.resolved = false;
+    return Line::entry;
+  }
+  skipped_ += shard_ == 0;
+  return Line::skip;
+}
+
+Target_File::Status Target_File::next(Target_Entry &entry) {
+  while (true) {
+    if (in_range_) {
+      if (range_position_ < range_.size) {
+        auto index = range_position_++;
+        if (position_++ % shard_count_ != shard_) {
+          continue;
+        }
+        entry.address = range_address(range_, index);
+        entry.host.clear();
+        entry.resolved = true;
+        return Status::entry;
+      }
+      in_range_ = false;
+    }
+
+    const char *begin, *end;
+    if (!next_line(begin, end)) {
+      return at_end() ? Status::end : Status::pending;
+    }
+    switch (parse_line(begin, end, entry)) {
+    case Line::skip:
+      break;
+    case Line::range:
+      in_range_ = true;
+      range_position_ = 0;
+      break;
+    case Line::entry:
+      if (position_++ % shard_count_ == shard_) {
+        return Status::entry;
+      }
+      break;
+    }
+  }
+}
+} // namespace pico_ping
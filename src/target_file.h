@@ -0,0 +1,143 @@
+/**
+ * @file target_file.h
+ * @ingroup Ping_Service
+ * @brief Streaming parser for files listing one destination per line
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "socket_address.h"
+#include "target_generator.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Parses a dotted quad IPv4 literal without going through libc
+ *
+ * Accepts exactly four decimal octets of at most three digits each and
+ * nothing else, unlike inet_aton which also accepts shorthand and octal.
+ *
+ * @param[in] begin First character of the literal
+ * @param[in] end One past its last character
+ * @param[out] address Address in network byte order, only set on success
+ *
+ * @return false if the text is not a dotted quad
+ */
+bool parse_ipv4(const char *begin, const char *end, uint32_t &address);
+
+/**
+ * @brief One destination read from a target file
+ */
+struct Target_Entry {
+  // Set when resolved, host is set instead for hostnames
+  Socket_Address address;
+  std::string host;
+  bool resolved = false;
+};
+
+/**
+ * @brief Reads destinations from a file or stdin one at a time
+ *
+ * Every line holds an address, a hostname, a CIDR block or an address range;
+ * blank lines, comments starting with # and surrounding whitespace are
+ * ignored and malformed lines are skipped and counted. Regular files are
+ * memory mapped and parsed in place as entries are requested, so probing
+ * starts right away whatever the size of the file. Lines are found with
+ * memchr, which libc vectorizes, and IPv4 literals take a dedicated parser
+ * that never touches inet_aton or DNS.
+ *
+ * Pipes and terminals cannot be mapped and are read in chunks instead,
+ * whenever the event loop reports the descriptor readable. Blocks and ranges
+ * are expanded in order as their line is reached.
+ */
+class Target_File {
+public:
+  /**
+   * @brief Result of asking for the next entry
+   */
+  enum class Status {
+    entry,   ///< An entry was returned
+    pending, ///< More input may arrive, call fill once event_fd is readable
+    end      ///< Every entry was returned
+  };
+
+  /**
+   * @brief Opens and maps the file
+   *
+   * @param[in] path File to read, "-" for stdin
+   * @param[in] shard Stripe of the entries to return
+   * @param[in] shard_count Number of stripes the entries are split into
+   *
+   * @throw std::invalid_argument if the file cannot be opened, or if it
+   * cannot be mapped and is meant to be split over several stripes
+   */
+  explicit Target_File(const std::string &path, size_t shard = 0,
+                       size_t shard_count = 1);
+  ~Target_File();
+
+  Target_File(const Target_File &) = delete;
+  Target_File &operator=(const Target_File &) = delete;
+
+  /**
+   * @brief Next entry of this stripe
+   *
+   * @param[out] entry Set if Status::entry is returned
+   */
+  Status next(Target_Entry &entry);
+
+  /**
+   * @brief Reads whatever input is available without blocking
+   *
+   * Only to be called once event_fd() was reported readable.
+   */
+  void fill();
+
+  /**
+   * @brief Descriptor to watch for more input, -1 if the file is mapped
+   */
+  int event_fd() const { return map_ == nullptr ? fd_ : -1; }
+
+  /**
+   * @brief Whether every entry was returned
+   */
+  bool at_end() const;
+
+  /**
+   * @brief Malformed lines seen so far, counted by stripe zero only
+   */
+  uint64_t skipped() const { return skipped_; }
+
+private:
+  enum class Line { entry, range, skip };
+
+  bool next_line(const char *&begin, const char *&end);
+  Line parse_line(const char *begin, const char *end, Target_Entry &entry);
+
+  int fd_ = -1;
+  bool owns_fd_ = false;
+  // Whole file when mapped
+  const char *map_ = nullptr;
+  size_t map_size_ = 0;
+  size_t map_offset_ = 0;
+  // Unconsumed input when streaming
+  std::vector<char> buffer_;
+  size_t buffer_offset_ = 0;
+  bool eof_ = false;
+  // Block or range being expanded
+  Address_Range range_;
+  uint64_t range_position_ = 0;
+  bool in_range_ = false;
+  // Entries seen, across every stripe
+  uint64_t position_ = 0;
+  size_t shard_;
+  size_t shard_count_;
+  uint64_t skipped_ = 0;
+};
+} // namespace pico_ping
@@ -0,0 +1,290 @@
+/**
+ * @file target_generator.cpp
+ * @ingroup Ping_Service
+ * @brief Lazy expansion of CIDR blocks and address ranges into targets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "target_generator.h"
+
+namespace pico_ping {
+
+using uint128 = unsigned __int128;
+
+// Host part of an address as one integer, IPv4 in the low 32 bits
+static uint128 address_value(const Socket_Address &address) {
+  if (address.any.sa_family == AF_INET) {
+    return ntohl(address.v4.sin_addr.s_addr);
+  }
+  uint128 value = 0;
+  for (auto byte : address.v6.sin6_addr.s6_addr) {
+    value = (value << 8) | byte;
+  }
+  return value;
+}
+
+static Socket_Address address_from_value(int family, uint128 value) {
+  Socket_Address address;
+  std::memset(&address, 0, sizeof(address));
+  address.any.sa_family = static_cast<sa_family_t>(family);
+  if (family == AF_INET) {
+    address.v4.sin_addr.s_addr = htonl(static_cast<uint32_t>(value));
+    return address;
+  }
+  for (int i = 15; i >= 0; --i) {
+    address.v6.sin6_addr.s6_addr[i] = static_cast<uint8_t>(value);
+    value >>= 8;
+  }
+  return address;
+}
+
+// Strict literal parse, dotted quads only for IPv4
+static bool parse_literal(const std::string &text, Socket_Address &address) {
+  std::memset(&address, 0, sizeof(address));
+  if (text.find(':') != std::string::npos) {
+    address.v6.sin6_family = AF_INET6;
+    return inet_pton(AF_INET6, text.c_str(), &address.v6.sin6_addr) == 1;
+  }
+  address.v4.sin_family = AF_INET;
+  return inet_pton(AF_INET, text.c_str(), &address.v4.sin_addr) == 1;
+}
+
+static bool all_digits(const std::string &text) {
+  return !text.empty() && text.size() <= 3 &&
+         std::all_of(text.begin(), text.end(),
+                     [](char c) { return c >= '0' && c <= '9'; });
+}
+
+bool parse_address_range(const std::string &spec, Address_Range &range) {
+  auto slash = spec.find('/');
+  auto dash = spec.find('-');
+  if (slash == std::string::npos && dash == std::string::npos) {
+    return false;
+  }
+
+  Socket_Address first;
+  uint128 first_value, last_value;
+  if (slash != std::string::npos) {
+    auto prefix_text = spec.substr(slash + 1);
+    if (!parse_literal(spec.substr(0, slash), first) ||
+        !all_digits(prefix_text)) {
+      throw std::invalid_argument("Invalid CIDR block.");
+    }
+    unsigned width = first.any.sa_family == AF_INET ? 32 : 128;
+    auto prefix = static_cast<unsigned>(std::stoul(prefix_text));
+    if (prefix > width) {
+      throw std::invalid_argument("Invalid CIDR block.");
+    }
+    if (width - prefix > 32) {
+      throw std::invalid_argument("CIDR block too large.");
+    }
+
+    uint128 host_mask = (uint128(1) << (width - prefix)) - 1;
+    first_value = address_value(first) & ~host_mask;
+    last_value = first_value | host_mask;
+    // Network and broadcast addresses do not answer echo requests
+    if (first.any.sa_family == AF_INET && prefix <= 30) {
+      ++first_value;
+      --last_value;
+    }
+  } else {
+    // Hostnames may contain dashes, only a literal before it makes a range
+    if (!parse_literal(spec.substr(0, dash), first)) {
+      if (first.any.sa_family == AF_INET6) {
+        throw std::invalid_argument("Invalid address range.");
+      }
+      return false;
+    }
+    first_value = address_value(first);
+
+    auto last_text = spec.substr(dash + 1);
+    Socket_Address last;
+    if (first.any.sa_family == AF_INET && all_digits(last_text)) {
+      auto octet = std::stoul(last_text);
+      if (octet > 255) {
+        throw std::invalid_argument("Invalid address range.");
+      }
+      last_value = (first_value & ~uint128(0xff)) | octet;
+    } else if (parse_literal(last_text, last) &&
+               last.any.sa_family == first.any.sa_family) {
+      last_value = address_value(last);
+    } else {
+      throw std::invalid_argument("Invalid address range.");
+    }
+  }
+
+  if (last_value < first_value) {
+    throw std::invalid_argument("Empty address range.");
+  }
+  if (last_value - first_value >= max_range_size) {
+    throw std::invalid_argument("Address range too large.");
+  }
+  range.spec = spec;
+  range.first = address_from_value(first.any.sa_family, first_value);
+  range.size = static_cast<uint64_t>(last_value - first_value) + 1;
+  return true;
+}
+
+Socket_Address range_address(const Address_Range &range, uint64_t index) {
+  return address_from_value(range.first.any.sa_family,
+                            address_value(range.first) + index);
+}
+
+static uint64_t multiply_mod(uint64_t a, uint64_t b, uint64_t modulus) {
+  return static_cast<uint64_t>(uint128(a) * b % modulus);
+}
+
+static uint64_t power_mod(uint64_t base, uint64_t exponent, uint64_t modulus) {
+  uint64_t result = 1;
+  while (exponent > 0) {
+    if (exponent & 1) {
+      result = multiply_mod(result, base, modulus);
+    }
+    base = multiply_mod(base, base, modulus);
+    exponent >>= 1;
+  }
+  return result;
+}
+
+// Trial division is plenty for numbers just above 2^32
+static bool is_prime(uint64_t n) {
+  if (n < 2) {
+    return false;
+  }
+  for (uint64_t d = 2; d * d <= n; ++d) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::vector<uint64_t> prime_factors(uint64_t n) {
+  std::vector<uint64_t> factors;
+  for (uint64_t d = 2; d * d <= n; ++d) {
+    if (n % d == 0) {
+      factors.push_back(d);
+      while (n % d == 0) {
+        n /= d;
+      }
+    }
+  }
+  if (n > 1) {
+    factors.push_back(n);
+  }
+  return factors;
+}
+
+// splitmix64, spreads consecutive seeds over the whole range
+static uint64_t mix(uint64_t &state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+Cyclic_Permutation::Cyclic_Permutation(uint64_t size, uint64_t seed)
+    : size_(size) {
+  if (size > max_range_size) {
+    throw std::invalid_argument("Permutation too large.");
+  }
+  prime_ = size + 1;
+  while (!is_prime(prime_)) {
+    ++prime_;
+  }
+
+  // The group of order p-1 is generated by g exactly when no g^((p-1)/q)
+  // is one for a prime factor q of p-1
+  auto order = prime_ - 1;
+  auto factors = prime_factors(order);
+  uint64_t root = 1;
+  for (uint64_t g = 2; g < prime_; ++g) {
+    if (std::all_of(factors.begin(), factors.end(), [&](uint64_t q) {
+          return power_mod(g, order / q, prime_) != 1;
+        })) {
+      root = g;
+      break;
+    }
+  }
+
+  // Any power of the root coprime to the order generates the group as well
+  uint64_t state = seed;
+  auto exponent = order > 1 ? 1 + mix(state) % (order - 1) : 1;
+  auto coprime = [&](uint64_t k) {
+    return std::none_of(factors.begin(), factors.end(),
+                        [k](uint64_t q) { return k % q == 0; });
+  };
+  while (!coprime(exponent)) {
+    exponent = exponent % (order - 1) + 1;
+  }
+  generator_ = power_mod(root, exponent, prime_);
+  start_ = 1 + mix(state) % order;
+}
+
+bool Cyclic_Permutation::next(uint64_t &index) {
+  while (!done_ && size_ > 0) {
+    if (current_ == 0) {
+      current_ = start_;
+    } else {
+      current_ = multiply_mod(current_, generator_, prime_);
+      if (current_ == start_) {
+        done_ = true;
+        break;
+      }
+    }
+    if (current_ - 1 < size_) {
+      index = current_ - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Target_Generator::add(const Address_Range &range) {
+  if (size_ + range.size > max_range_size) {
+    throw std::invalid_argument("Too many generated targets.");
+  }
+  ranges_.push_back(range);
+  offsets_.push_back(size_);
+  size_ += range.size;
+}
+
+void Target_Generator::start(bool permute, uint64_t seed, size_t shard,
+                             size_t shard_count) {
+  permute_ = permute;
+  if (permute_) {
+    permutation_ = Cyclic_Permutation(size_, seed);
+  }
+  position_ = 0;
+  shard_ = shard;
+  shard_count_ = std::max(shard_count, size_t(1));
+}
+
+bool Target_Generator::next(Socket_Address &address, size_t &range) {
+  while (true) {
+    auto index = position_;
+    if (permute_) {
+      if (!permutation_.next(index)) {
+        return false;
+      }
+    } else if (index >= size_) {
+      return false;
+    }
+    if (position_++ % shard_count_ != shard_) {
+      continue;
+    }
+
+    auto it = std::upper_bound(offsets_.begin(), offsets_.end(), index);
+    range = static_cast<size_t>(it - offsets_.begin()) - 1;
+    address = range_address(ranges_[range], index - offsets_[range]);
+    return true;
+  }
+}
+} // namespace pico_ping
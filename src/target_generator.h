@@ -0,0 +1,154 @@
+/**
+ * @file target_generator.h
+ * @ingroup Ping_Service
+ * @brief Lazy expansion of CIDR blocks and address ranges into targets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "socket_address.h"
+
+namespace pico_ping {
+
+/// Largest number of addresses a single block or range may expand to
+constexpr uint64_t max_range_size = uint64_t(1) << 32;
+
+/**
+ * @brief Contiguous block of addresses of one family
+ */
+struct Address_Range {
+  // Spec as given on the command line, used to label the summary
+  std::string spec;
+  Socket_Address first;
+  uint64_t size = 0;
+};
+
+/**
+ * @brief Parses a CIDR block or an address range
+ *
+ * Accepted forms are `10.0.0.0/16`, `fd00::/120`, `10.0.0.1-10.0.3.255`,
+ * `10.0.0.1-50` (last octet only) and `fd00::1-fd00::ff`. IPv4 blocks of /30
+ * and wider leave out their network and broadcast addresses like fping -g
+ * does.
+ *
+ * @param[in] spec Destination as given on the command line
+ * @param[out] range Parsed block, only set if true is returned
+ *
+ * @return false if spec is not a block or range, e.g. a plain address or a
+ * hostname that happens to contain a dash
+ *
+ * @throw std::invalid_argument if spec is a malformed or empty block or range,
+ * or expands to more than max_range_size addresses
+ */
+bool parse_address_range(const std::string &spec, Address_Range &range);
+
+/**
+ * @brief Address at a position within a range
+ */
+Socket_Address range_address(const Address_Range &range, uint64_t index);
+
+/**
+ * @brief Pseudo random walk visiting every index below a size exactly once
+ *
+ * Iterates the multiplicative group modulo the smallest prime p above the
+ * size: starting from a random element, each step multiplies by a random
+ * generator of the group, which visits all of 1..p-1 before returning to the
+ * start. Elements beyond the size are skipped, which costs little because p
+ * is close to the size. Consecutive indices come out far apart, so a sweep
+ * does not probe one subnet after another, yet the walk needs O(1) memory.
+ */
+class Cyclic_Permutation {
+public:
+  /**
+   * @brief Construct a walk over 0..size-1
+   *
+   * @param[in] size Number of indices, at most max_range_size
+   * @param[in] seed Selects the generator and the starting element
+   */
+  Cyclic_Permutation(uint64_t size = 0, uint64_t seed = 0);
+
+  /**
+   * @brief Next index of the walk
+   *
+   * @param[out] index Set unless the walk is complete
+   *
+   * @return false once every index was returned
+   */
+  bool next(uint64_t &index);
+
+private:
+  uint64_t size_;
+  uint64_t prime_ = 2;
+  uint64_t generator_ = 1;
+  uint64_t start_ = 1;
+  // Zero until the walk started
+  uint64_t current_ = 0;
+  bool done_ = false;
+};
+
+/**
+ * @brief Produces the addresses of a list of ranges one at a time
+ *
+ * Only the ranges themselves are stored, so sweeping a /8 costs as much
+ * memory as sweeping a /30. The combined ranges are walked either in order or
+ * in a permuted order, and can be striped over several generators so that
+ * worker threads split one sweep between them.
+ */
+class Target_Generator {
+public:
+  Target_Generator() = default;
+
+  /**
+   * @brief Appends a range, only allowed before the first call to next()
+   *
+   * @throw std::invalid_argument if the combined ranges exceed
+   * max_range_size addresses
+   */
+  void add(const Address_Range &range);
+
+  /**
+   * @brief Starts the walk over every range added so far
+   *
+   * @param[in] permute Visit addresses in a pseudo random order
+   * @param[in] seed Seed of the permutation, generators sharing it walk the
+   * same order
+   * @param[in] shard Stripe of the walk this generator yields
+   * @param[in] shard_count Number of stripes the walk is split into
+   */
+  void start(bool permute, uint64_t seed = 0, size_t shard = 0,
+             size_t shard_count = 1);
+
+  /**
+   * @brief Next address of the walk
+   *
+   * @param[out] address Address to probe
+   * @param[out] range Index of the range it belongs to
+   *
+   * @return false once the walk is complete
+   */
+  bool next(Socket_Address &address, size_t &range);
+
+  const std::vector<Address_Range> &ranges() const { return ranges_; }
+  uint64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  std::vector<Address_Range> ranges_;
+  // Index of the first address of every range, in ascending order
+  std::vector<uint64_t> offsets_;
+  uint64_t size_ = 0;
+  bool permute_ = false;
+  Cyclic_Permutation permutation_;
+  // Position of the walk, in order or within the permutation
+  uint64_t position_ = 0;
+  size_t shard_ = 0;
+  size_t shard_count_ = 1;
+};
+} // namespace pico_ping
@@ -0,0 +1,179 @@
+/**
+ * @file timer_wheel.cpp
+ * @ingroup Ping_Service
+ * @brief Hierarchical timer wheel for per-probe deadlines
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace pico_ping {
+
+// Furthest a deadline can lie ahead, in ticks, while still hashing into the
+// top level without wrapping onto the current slot
+static constexpr uint64_t max_delta = (uint64_t(1) << 32) - 1;
+
+Timer_Wheel::Timer_Wheel(size_t capacity, nanoseconds tick,
+                         time_point<steady_clock> start)
+    : nodes_(capacity), tick_(tick), start_(start) {
+  if (tick <= nanoseconds(0)) {
+    throw std::invalid_argument("Timer wheel tick must be positive");
+  }
+  if (capacity >= no_node) {
+    throw std::invalid_argument("Timer wheel capacity is too large");
+  }
+  heads_.fill(no_node);
+  occupied_.fill(0);
+
+  // Chain every node onto the free list, lowest index first
+  for (size_t i = capacity; i-- > 0;) {
+    nodes_[i].next = free_;
+    free_ = static_cast<uint32_t>(i);
+  }
+}
+
+Timer_Wheel::Handle Timer_Wheel::arm(time_point<steady_clock> deadline,
+                                     uint64_t cookie) {
+  if (free_ == no_node) {
+    return invalid_handle;
+  }
+  auto index = free_;
+  auto &node = nodes_[index];
+  free_ = node.next;
+
+  // Round up so a timer never fires before its deadline
+  uint64_t expires = 0;
+  if (deadline > start_) {
+    auto elapsed = (deadline - start_).count();
+    expires = static_cast<uint64_t>((elapsed + tick_.count() - 1) /
+                                    tick_.count());
+  }
+  node.expires = std::clamp(expires, current_ + 1, current_ + max_delta);
+  node.cookie = cookie;
+  insert(index);
+  ++size_;
+  return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+bool Timer_Wheel::cancel(Handle handle) {
+  auto index = static_cast<uint32_t>(handle);
+  if (index >= nodes_.size()) {
+    return false;
+  }
+  auto &node = nodes_[index];
+  if (node.generation != static_cast<uint32_t>(handle >> 32) ||
+      node.slot == no_node) {
+    return false;
+  }
+  release(index);
+  return true;
+}
+
+time_point<steady_clock> Timer_Wheel::next_deadline() const {
+  auto earliest = UINT64_MAX;
+  for (unsigned level = 0; level < level_count; ++level) {
+    auto shift = level * slot_bits;
+    auto position = current_ >> shift;
+
+    // The current slot of every level was already cascaded or fired, so the
+    // search starts at the next one and ends on the current one again
+    for (uint64_t distance = 1; distance <= slot_count; ++distance) {
+      auto slot = level * slot_count + ((position + distance) & slot_mask);
+      auto word = occupied_[slot / 64];
+      if (word == 0) {
+        // Skip the rest of an empty word
+        distance += 63 - slot % 64;
+        continue;
+      }
+      if (word & (uint64_t(1) << (slot % 64))) {
+        earliest = std::min(earliest, (position + distance) << shift);
+        break;
+      }
+    }
+  }
+  return start_ + tick_ * static_cast<nanoseconds::rep>(earliest);
+}
+
+uint64_t Timer_Wheel::tick_of(time_point<steady_clock> time) const {
+  if (time <= start_) {
+    return 0;
+  }
+  return static_cast<uint64_t>((time - start_) / tick_);
+}
+
+void Timer_Wheel::insert(uint32_t index) {
+  auto &node = nodes_[index];
+  auto delta = node.expires > current_ ? node.expires - current_ : 0;
+
+  unsigned level = 0;
+  while (level + 1 < level_count &&
+         delta >= (uint64_t(1) << ((level + 1) * slot_bits))) {
+    ++level;
+  }
+  auto slot = static_cast<uint32_t>(
+      level * slot_count + ((node.expires >> (level * slot_bits)) & slot_mask));
+
+  node.slot = slot;
+  node.prev = no_node;
+  node.next = heads_[slot];
+  if (node.next != no_node) {
+    nodes_[node.next].prev = index;
+  }
+  heads_[slot] = index;
+  occupied_[slot / 64] |= uint64_t(1) << (slot % 64);
+}
+
+void Timer_Wheel::unlink(uint32_t index) {
+  auto &node = nodes_[index];
+  if (node.prev != no_node) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    heads_[node.slot] = node.next;
+    if (node.next == no_node) {
+      occupied_[node.slot / 64] &= ~(uint64_t(1) << (node.slot % 64));
+    }
+  }
+  if (node.next != no_node) {
+    nodes_[node.next].prev = node.prev;
+  }
+}
+
+void Timer_Wheel::release(uint32_t index) {
+  unlink(index);
+  auto &node = nodes_[index];
+  node.slot = no_node;
+  // Zero is skipped so a handle is never equal to invalid_handle
+  if (++node.generation == 0) {
+    node.generation = 1;
+  }
+  node.next = free_;
+  free_ = index;
+  --size_;
+}
+
+void Timer_Wheel::cascade(unsigned level) {
+  auto shift = level * slot_bits;
+  auto position = (current_ >> shift) & slot_mask;
+
+  // Timers due within the span of this slot move down to the level below
+  auto slot = level * slot_count + position;
+  auto index = heads_[slot];
+  heads_[slot] = no_node;
+  occupied_[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+  while (index != no_node) {
+    auto next = nodes_[index].next;
+    insert(index);
+    index = next;
+  }
+
+  if (position == 0 && level + 1 < level_count) {
+    cascade(level + 1);
+  }
+}
+} // namespace pico_ping
@@ -0,0 +1,161 @@
+/**
+ * @file timer_wheel.h
+ * @ingroup Ping_Service
+ * @brief Hierarchical timer wheel for per-probe deadlines
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Fixed capacity set of deadlines with O(1) arm, cancel and expiry
+ *
+ * Deadlines are rounded up to whole ticks and hashed into one of four levels
+ * of 256 slots, each level covering 256 times the span of the one below. A
+ * deadline lands in the lowest level whose span reaches it; whenever the
+ * lowest level wraps, the next slot of the level above is cascaded down, so
+ * every timer is moved at most three times before it fires.
+ *
+ * Timers live in a node pool allocated at construction and are linked into
+ * their slot by index, so nothing is allocated after construction and a slot
+ * of timers sharing a tick is expired as one batch. Handles carry a
+ * generation, which makes cancelling a timer that already fired a no-op even
+ * once its node was reused.
+ */
+class Timer_Wheel {
+public:
+  using Handle = uint64_t;
+  /// Never returned by arm()
+  static constexpr Handle invalid_handle = 0;
+
+  /**
+   * @brief Construct an empty wheel
+   *
+   * @param[in] capacity Maximum number of timers armed at once
+   * @param[in] tick Resolution deadlines are rounded up to
+   * @param[in] start Time point of tick zero
+   */
+  Timer_Wheel(size_t capacity = 0, nanoseconds tick = milliseconds(1),
+              time_point<steady_clock> start = steady_clock::now());
+
+  /**
+   * @brief Arms a timer
+   *
+   * Deadlines that already passed fire on the next call to expire(). Deadlines
+   * beyond the span of the wheel are clamped to its last tick.
+   *
+   * @param[in] deadline Time point the timer fires at, at most one tick late
+   * @param[in] cookie Value passed back when the timer fires
+   *
+   * @return Handle for cancel() or invalid_handle if the wheel is full
+   */
+  Handle arm(time_point<steady_clock> deadline, uint64_t cookie);
+
+  /**
+   * @brief Disarms a timer
+   *
+   * @param[in] handle Handle returned by arm()
+   *
+   * @return false if the timer already fired or was cancelled
+   */
+  bool cancel(Handle handle);
+
+  /**
+   * @brief Fires every timer whose tick has passed
+   *
+   * @param[in] now Time point to advance the wheel to
+   * @param[in] fire Called with the cookie of each expired timer, may arm and
+   * cancel timers
+   *
+   * @return Number of timers fired
+   */
+  template <typename Callback>
+  size_t expire(time_point<steady_clock> now, Callback &&fire) {
+    auto target = tick_of(now);
+    size_t fired = 0;
+    while (current_ < target) {
+      // Nothing to cascade or fire, skip the idle ticks at once
+      if (size_ == 0) {
+        current_ = target;
+        break;
+      }
+      ++current_;
+      if ((current_ & slot_mask) == 0) {
+        cascade(1);
+      }
+
+      auto &head = heads_[current_ & slot_mask];
+      while (head != no_node) {
+        auto index = head;
+        auto cookie = nodes_[index].cookie;
+        release(index);
+        ++fired;
+        fire(cookie);
+      }
+    }
+    return fired;
+  }
+
+  /**
+   * @brief Earliest time point at which expire() may have work to do
+   *
+   * Exact for timers on the lowest level, otherwise the time the slot holding
+   * the earliest timer is cascaded, which is never later than its deadline.
+   * Only meaningful when the wheel is not empty.
+   */
+  time_point<steady_clock> next_deadline() const;
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return nodes_.size(); }
+  nanoseconds tick() const { return tick_; }
+
+private:
+  static constexpr unsigned level_count = 4;
+  static constexpr unsigned slot_bits = 8;
+  static constexpr uint64_t slot_count = 1 << slot_bits;
+  static constexpr uint64_t slot_mask = slot_count - 1;
+  static constexpr uint32_t no_node = UINT32_MAX;
+
+  struct Node {
+    uint64_t cookie = 0;
+    uint64_t expires = 0;
+    uint32_t next = no_node;
+    uint32_t prev = no_node;
+    // Incremented on release so stale handles no longer match
+    uint32_t generation = 1;
+    // Index into heads_, no_node while the node is free
+    uint32_t slot = no_node;
+  };
+
+  uint64_t tick_of(time_point<steady_clock> time) const;
+  void insert(uint32_t index);
+  void unlink(uint32_t index);
+  void release(uint32_t index);
+  void cascade(unsigned level);
+
+  std::vector<Node> nodes_;
+  // First node of every slot, level by level
+  std::array<uint32_t, level_count * slot_count> heads_;
+  // Set bit per non-empty slot, so the next deadline is found without
+  // walking the slots
+  std::array<uint64_t, level_count * slot_count / 64> occupied_;
+  uint32_t free_ = no_node;
+  size_t size_ = 0;
+  nanoseconds tick_;
+  time_point<steady_clock> start_;
+  // Last tick that was expired
+  uint64_t current_ = 0;
+};
+} // namespace pico_ping
@@ -0,0 +1,58 @@
+/**
+ * @file transport.cpp
+ * @ingroup Ping_Service
+ * @brief Interface through which a Ping_Service exchanges echo packets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <unistd.h>
+
+#include <iostream>
+#include <stdexcept>
+
+// Utility include that has all relevant linux network header files
+#include "linux_socket_incl.h"
+#include "batch_io.h"
+#include "transport.h"
+#include "uring_io.h"
+
+namespace pico_ping {
+
+Transport_Socket Icmp_Transport::open(int family, size_t batch_size,
+                                      size_t packet_size,
+                                      size_t control_size) {
+  int protocol = IPPROTO_ICMP;
+  if (family == AF_INET6) {
+    protocol = IPPROTO_ICMPV6;
+  }
+  Transport_Socket socket;
+  socket.sock = ::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         protocol);
+
+  // If socket is already used, or permissions are not correct throw
+  if (socket.sock < 0) {
+    throw std::runtime_error("Unable to create socket");
+  }
+
+  try {
+    if (backend_ == IO_Backend::io_uring) {
+      socket.io =
+          Uring_IO::create(socket.sock, batch_size, packet_size, control_size);
+      if (socket.io == nullptr) {
+        std::cerr << "io_uring unavailable, falling back to epoll\n";
+      }
+    }
+    if (socket.io == nullptr) {
+      socket.io = std::make_unique<Batch_IO>(socket.sock, batch_size,
+                                             packet_size, control_size);
+    }
+  } catch (...) {
+    close(socket.sock);
+    throw;
+  }
+  return socket;
+}
+} // namespace pico_ping
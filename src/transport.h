@@ -0,0 +1,85 @@
+/**
+ * @file transport.h
+ * @ingroup Ping_Service
+ * @brief Interface through which a Ping_Service exchanges echo packets
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "packet_io.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Mechanism used to exchange packets with the kernel
+ */
+enum class IO_Backend {
+  epoll,   ///< sendmmsg and recvmmsg driven by socket readiness
+  io_uring ///< Batched submissions and a multishot receive on an io_uring
+};
+
+/**
+ * @brief Endpoint of one address family opened by a Transport
+ */
+struct Transport_Socket {
+  // Kernel ICMP socket, owned by the caller. -1 if the transport has none,
+  // error queue features like transmit timestamps are then unavailable
+  int sock = -1;
+  // Sends echo requests and reads replies, signals through its event_fd
+  std::unique_ptr<Packet_IO> io;
+};
+
+/**
+ * @brief Source of the sockets a Ping_Service probes through
+ *
+ * The service builds echo requests and matches replies itself, a transport
+ * only decides where the packets go. Implementations must allow open to be
+ * called from several worker threads at once.
+ */
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  /**
+   * @brief Opens an endpoint sending ICMP echo requests of one family
+   *
+   * @param[in] family AF_INET or AF_INET6
+   * @param[in] batch_size Number of datagrams per system call
+   * @param[in] packet_size Largest datagram that is sent or received
+   * @param[in] control_size Bytes of ancillary data kept per received
+   * datagram, zero if none is needed
+   *
+   * @throw std::runtime_error if the endpoint cannot be created
+   */
+  virtual Transport_Socket open(int family, size_t batch_size,
+                                size_t packet_size, size_t control_size) = 0;
+};
+
+/**
+ * @brief Unprivileged ICMP datagram sockets, the transport used by default
+ *
+ * The kernel fills in the echo identifier and checksum and only hands back
+ * replies to this socket's own requests.
+ */
+class Icmp_Transport : public Transport {
+public:
+  explicit Icmp_Transport(IO_Backend backend = IO_Backend::epoll)
+      : backend_(backend) {}
+
+  /**
+   * @throw std::runtime_error if the socket cannot be created, e.g. when the
+   * group is outside net.ipv4.ping_group_range
+   */
+  Transport_Socket open(int family, size_t batch_size, size_t packet_size,
+                        size_t control_size) override;
+
+private:
+  IO_Backend backend_;
+};
+} // namespace pico_ping
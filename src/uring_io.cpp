@@ -0,0 +1,369 @@
+/**
+ * @file uring_io.cpp
+ * @ingroup Ping_Service
+ * @brief Packet I/O backend built on io_uring
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "uring_io.h"
+
+namespace pico_ping {
+
+// Buffer group the multishot receive selects its buffers from
+static constexpr uint16_t buffer_group = 0;
+// Completions with this user data belong to the receive, others are sends
+static constexpr uint64_t receive_tag = ~uint64_t(0);
+
+static size_t round_up_pow2(size_t value) {
+  size_t size = 1;
+  while (size < value) {
+    size <<= 1;
+  }
+  return size;
+}
+
+std::unique_ptr<Uring_IO> Uring_IO::create(int sock, size_t batch_size,
+                                           size_t packet_size,
+                                           size_t control_size) {
+  std::unique_ptr<Uring_IO> io(
+      new Uring_IO(sock, batch_size, packet_size, control_size));
+  if (!io->setup() || !io->arm_receive()) {
+    return nullptr;
+  }
+  return io;
+}
+
+Uring_IO::Uring_IO(int sock, size_t batch_size, size_t packet_size,
+                   size_t control_size)
+    : sock_(sock), batch_size_(std::max(batch_size, size_t(1))),
+      packet_size_(packet_size), control_size_(control_size) {
+  // Enough buffers that replies keep landing while a few batches are handled
+  buf_count_ =
+      static_cast<unsigned>(std::min(round_up_pow2(batch_size_ * 4 + 256),
+                                     size_t(32768)));
+
+  std::memset(&recv_template_, 0, sizeof(recv_template_));
+  recv_template_.msg_namelen = sizeof(Socket_Address);
+  recv_template_.msg_controllen = control_size_;
+  buf_size_ = sizeof(struct io_uring_recvmsg_out) +
+              recv_template_.msg_namelen + recv_template_.msg_controllen +
+              packet_size_;
+  buffers_.resize(buf_count_ * buf_size_);
+
+  send_buffers_.resize(batch_size_ * packet_size_);
+  // The second io vector of each send references the tail of a datagram
+  send_iovs_.assign(batch_size_ * 2, {});
+  send_addrs_.resize(batch_size_);
+  send_msgs_.assign(batch_size_, {});
+  send_cookies_.resize(batch_size_);
+  sent_cookies_.resize(batch_size_);
+  for (size_t i = 0; i < batch_size_; ++i) {
+    send_iovs_[i * 2].iov_base = send_buffers_.data() + i * packet_size_;
+    send_msgs_[i].msg_iov = &send_iovs_[i * 2];
+    send_msgs_[i].msg_iovlen = 2;
+    send_msgs_[i].msg_name = &send_addrs_[i];
+    send_msgs_[i].msg_namelen = sizeof(send_addrs_[i]);
+  }
+
+  completions_ = Ring_Queue<Completion>(buf_count_);
+  received_.resize(batch_size_);
+  received_headers_.assign(batch_size_, {});
+  received_buffers_.resize(batch_size_);
+}
+
+Uring_IO::~Uring_IO() {
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+  if (buf_ring_ != nullptr) {
+    munmap(buf_ring_, buf_ring_size_);
+  }
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (sq_map_ != nullptr) {
+    munmap(sq_map_, sq_map_size_);
+  }
+}
+
+bool Uring_IO::setup() {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = buf_count_ * 2;
+
+  auto entries = static_cast<unsigned>(round_up_pow2(batch_size_ + 1));
+  ring_fd_ =
+      static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd_ < 0) {
+    return false;
+  }
+
+  // Older kernels map the rings separately and may drop completions
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    return false;
+  }
+
+  sq_map_size_ =
+      std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+               params.cq_off.cqes +
+                   params.cq_entries * sizeof(struct io_uring_cqe));
+  sq_map_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_map_ == MAP_FAILED) {
+    sq_map_ = nullptr;
+    return false;
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+  auto base = static_cast<unsigned char *>(sq_map_);
+  sq_head_ = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(base + params.cq_off.cqes);
+
+  // The buffer ring has to be page aligned, so it is mapped rather than
+  // allocated
+  buf_ring_size_ = buf_count_ * sizeof(struct io_uring_buf);
+  void *ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  buf_ring_ = static_cast<struct io_uring_buf_ring *>(ring);
+
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = buf_count_;
+  reg.bgid = buffer_group;
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    return false;
+  }
+
+  // Hand every buffer to the kernel
+  for (unsigned i = 0; i < buf_count_; ++i) {
+    auto &buf = ring_entries()[i];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_.data() + i * buf_size_);
+    buf.len = static_cast<uint32_t>(buf_size_);
+    buf.bid = static_cast<uint16_t>(i);
+  }
+  buf_tail_ = static_cast<uint16_t>(buf_count_);
+  __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  return true;
+}
+
+// The flexible array in io_uring_buf_ring is preceded by an empty struct,
+// which has a size in C++, so the entries are addressed from the ring start
+struct io_uring_buf *Uring_IO::ring_entries() {
+  return reinterpret_cast<struct io_uring_buf *>(buf_ring_);
+}
+
+struct io_uring_sqe *Uring_IO::next_sqe() {
+  unsigned tail = *sq_tail_ + sq_pending_++;
+  unsigned index = tail & *sq_mask_;
+  sq_array_[index] = index;
+
+  auto sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+bool Uring_IO::enter(unsigned to_submit, unsigned min_complete) {
+  // Publish the filled entries before the kernel looks at them
+  if (sq_pending_ > 0) {
+    __atomic_store_n(sq_tail_, *sq_tail_ + sq_pending_, __ATOMIC_RELEASE);
+    sq_pending_ = 0;
+  }
+
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags,
+                 nullptr, 0) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Uring_IO::arm_receive() {
+  auto sqe = next_sqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = sock_;
+  sqe->addr = reinterpret_cast<uint64_t>(&recv_template_);
+  sqe->len = 1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = receive_tag;
+
+  receive_armed_ = true;
+  if (!enter(1, 0)) {
+    return false;
+  }
+
+  // Kernels without multishot receives fail the request right away
+  reap();
+  return receive_supported_;
+}
+
+void Uring_IO::reap() {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; ++head) {
+    const auto &cqe = cqes_[head & *cq_mask_];
+
+    if (cqe.user_data == receive_tag) {
+      // Running out of buffers ends the multishot receive, rearm later
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        receive_armed_ = false;
+      }
+      if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+        receive_supported_ = false;
+      }
+      if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        completions_.push(
+            {static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT),
+             static_cast<uint32_t>(cqe.res)});
+      }
+      continue;
+    }
+
+    // Sends complete in the order the kernel transmitted them
+    ++sends_completed_;
+    if (cqe.res < 0) {
+      ++send_failures_;
+    } else {
+      sent_cookies_[sent_count_++] = send_cookies_[cqe.user_data];
+    }
+  }
+
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+void Uring_IO::recycle_buffers() {
+  unsigned mask = buf_count_ - 1;
+  for (size_t i = 0; i < received_count_; ++i) {
+    auto bid = received_buffers_[i];
+    auto &buf = ring_entries()[(buf_tail_ + i) & mask];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_.data() + bid * buf_size_);
+    buf.len = static_cast<uint32_t>(buf_size_);
+    buf.bid = bid;
+  }
+  buf_tail_ = static_cast<uint16_t>(buf_tail_ + received_count_);
+  __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  received_count_ = 0;
+}
+
+void Uring_IO::queue(const void *head, size_t head_length, const void *tail,
+                     size_t tail_length, const Socket_Address &dest,
+                     uint64_t cookie) {
+  head_length = std::min(head_length, packet_size_);
+  tail_length = std::min(tail_length, packet_size_ - head_length);
+
+  auto iov = &send_iovs_[queued_ * 2];
+  std::memcpy(iov[0].iov_base, head, head_length);
+  iov[0].iov_len = head_length;
+  iov[1].iov_base = const_cast<void *>(tail);
+  iov[1].iov_len = tail_length;
+  send_addrs_[queued_] = dest;
+  send_msgs_[queued_].msg_namelen = address_length(dest);
+  send_cookies_[queued_] = cookie;
+  ++queued_;
+}
+
+size_t Uring_IO::flush() {
+  sent_count_ = 0;
+  send_failures_ = 0;
+  sends_completed_ = 0;
+  if (queued_ == 0) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < queued_; ++i) {
+    auto sqe = next_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sock_;
+    sqe->addr = reinterpret_cast<uint64_t>(&send_msgs_[i]);
+    sqe->len = 1;
+    sqe->user_data = i;
+  }
+
+  // One system call submits the batch and collects its completions
+  auto pending = static_cast<unsigned>(queued_);
+  bool ok = enter(pending, pending);
+  reap();
+  while (ok && sends_completed_ < queued_) {
+    ok = enter(0, static_cast<unsigned>(queued_ - sends_completed_));
+    reap();
+  }
+
+  // Sends whose completion never arrived count as failed
+  size_t failed = send_failures_ + (queued_ - sends_completed_);
+  queued_ = 0;
+  return failed;
+}
+
+size_t Uring_IO::receive() {
+  recycle_buffers();
+  reap();
+  if (!receive_armed_ && receive_supported_) {
+    arm_receive();
+  }
+
+  size_t name_offset = sizeof(struct io_uring_recvmsg_out);
+  size_t control_offset = name_offset + recv_template_.msg_namelen;
+  size_t payload_offset = control_offset + recv_template_.msg_controllen;
+
+  size_t count = 0;
+  while (count < batch_size_ && !completions_.empty()) {
+    auto completion = completions_.front();
+    completions_.pop();
+
+    auto buf = buffers_.data() + completion.buffer * buf_size_;
+    auto out = reinterpret_cast<const struct io_uring_recvmsg_out *>(buf);
+    size_t available =
+        completion.length > payload_offset ? completion.length - payload_offset
+                                           : 0;
+
+    auto &header = received_headers_[count];
+    header.msg_control = buf + control_offset;
+    header.msg_controllen = out->controllen;
+
+    received_[count] = {
+        buf + payload_offset, std::min<size_t>(out->payloadlen, available),
+        reinterpret_cast<const Socket_Address *>(buf + name_offset),
+        &header};
+    received_buffers_[count] = completion.buffer;
+    ++count;
+  }
+
+  received_count_ = count;
+  return count;
+}
+} // namespace pico_ping
@@ -0,0 +1,180 @@
+/**
+ * @file uring_io.h
+ * @ingroup Ping_Service
+ * @brief Packet I/O backend built on io_uring
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+#include "packet_io.h"
+#include "ring_queue.h"
+
+namespace pico_ping {
+
+/**
+ * @brief Packet I/O backend keeping a multishot receive armed on an io_uring
+ *
+ * Replies land in a ring of provided buffers registered with the kernel, so
+ * once the receive is armed every reply is picked up from the completion queue
+ * without a system call. Sends are queued as SENDMSG submissions and a whole
+ * batch is submitted, and its completions collected, with a single
+ * io_uring_enter. The ring descriptor is readable whenever completions are
+ * waiting, which is what event_fd returns.
+ *
+ * Uses raw system calls so no liburing is needed. Requires multishot
+ * receives and provided buffer rings, available since Linux 6.0.
+ */
+class Uring_IO : public Packet_IO {
+public:
+  /**
+   * @brief Set up a ring for the given socket if the kernel supports it
+   *
+   * @param[in] sock Socket to send and receive on, not owned
+   * @param[in] batch_size Number of datagrams per submission or receive
+   * @param[in] packet_size Largest datagram that is sent or received
+   * @param[in] control_size Bytes of ancillary data kept per received
+   * datagram, zero if none is needed
+   *
+   * @return Backend or nullptr if io_uring or a required feature is missing
+   */
+  static std::unique_ptr<Uring_IO> create(int sock, size_t batch_size,
+                                          size_t packet_size,
+                                          size_t control_size = 0);
+  ~Uring_IO();
+
+  Uring_IO(const Uring_IO &) = delete;
+  Uring_IO &operator=(const Uring_IO &) = delete;
+
+  using Packet_IO::queue;
+  void queue(const void *head, size_t head_length, const void *tail,
+             size_t tail_length, const Socket_Address &dest,
+             uint64_t cookie) override;
+  bool full() const override { return queued_ == batch_size_; }
+  size_t flush() override;
+  size_t sent_count() const override { return sent_count_; }
+  uint64_t sent_cookie(size_t index) const override {
+    return sent_cookies_[index];
+  }
+  size_t receive() override;
+  Received_Packet packet(size_t index) const override {
+    return received_[index];
+  }
+  size_t batch_size() const override { return batch_size_; }
+  bool receive_pending() const override { return !completions_.empty(); }
+  int event_fd() const override { return ring_fd_; }
+
+private:
+  /**
+   * @brief A receive completion waiting to be handed out
+   */
+  struct Completion {
+    uint16_t buffer;
+    uint32_t length;
+  };
+
+  Uring_IO(int sock, size_t batch_size, size_t packet_size,
+           size_t control_size);
+
+  /**
+   * @brief Creates and maps the rings and registers the receive buffers
+   *
+   * @return false if the kernel lacks a required feature
+   */
+  bool setup();
+
+  /**
+   * @brief Entries of the provided buffer ring
+   */
+  struct io_uring_buf *ring_entries();
+
+  /**
+   * @brief Claims the next submission queue entry, cleared
+   */
+  struct io_uring_sqe *next_sqe();
+
+  /**
+   * @brief Submits pending entries and waits for completions
+   *
+   * @return false if io_uring_enter failed
+   */
+  bool enter(unsigned to_submit, unsigned min_complete);
+
+  /**
+   * @brief Submits the multishot receive and checks it was accepted
+   *
+   * @return false if the kernel rejected it
+   */
+  bool arm_receive();
+
+  /**
+   * @brief Consumes every completion in the completion queue
+   */
+  void reap();
+
+  /**
+   * @brief Hands the buffers of the last receive back to the kernel
+   */
+  void recycle_buffers();
+
+  int sock_;
+  int ring_fd_ = -1;
+  size_t batch_size_;
+  size_t packet_size_;
+  size_t control_size_;
+
+  // Mapped submission and completion rings
+  void *sq_map_ = nullptr;
+  size_t sq_map_size_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned *cq_mask_;
+  struct io_uring_cqe *cqes_;
+  unsigned sq_pending_ = 0;
+
+  // Provided buffer ring the multishot receive picks buffers from
+  struct io_uring_buf_ring *buf_ring_ = nullptr;
+  size_t buf_ring_size_ = 0;
+  unsigned buf_count_;
+  size_t buf_size_;
+  uint16_t buf_tail_ = 0;
+  std::vector<unsigned char> buffers_;
+  struct msghdr recv_template_;
+  bool receive_armed_ = false;
+  bool receive_supported_ = true;
+
+  // Send slots, laid out like the sendmmsg backend
+  std::vector<unsigned char> send_buffers_;
+  std::vector<struct iovec> send_iovs_;
+  std::vector<Socket_Address> send_addrs_;
+  std::vector<struct msghdr> send_msgs_;
+  std::vector<uint64_t> send_cookies_;
+  std::vector<uint64_t> sent_cookies_;
+  size_t queued_ = 0;
+  size_t sent_count_ = 0;
+  size_t send_failures_ = 0;
+  size_t sends_completed_ = 0;
+
+  // Receive completions not yet handed out and the batch last handed out
+  Ring_Queue<Completion> completions_;
+  std::vector<Received_Packet> received_;
+  std::vector<struct msghdr> received_headers_;
+  std::vector<uint16_t> received_buffers_;
+  size_t received_count_ = 0;
+};
+} // namespace pico_ping
@@ -0,0 +1,110 @@
+/**
+ * @file virtual_clock.cpp
+ * @ingroup Ping_Service
+ * @brief Simulated time that jumps straight to the next timer deadline
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include "event_fd.h"
+#include "virtual_clock.h"
+
+namespace pico_ping {
+
+int Virtual_Clock::add_timer() {
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to create virtual timer");
+  }
+  timers_.push_back({fd, false, false, now_});
+  return fd;
+}
+
+void Virtual_Clock::remove_timer(int timer) {
+  timers_.erase(
+      std::remove_if(timers_.begin(), timers_.end(),
+                     [timer](const Timer &t) { return t.fd == timer; }),
+      timers_.end());
+}
+
+Virtual_Clock::Timer *Virtual_Clock::find(int timer) {
+  for (auto &t : timers_) {
+    if (t.fd == timer) {
+      return &t;
+    }
+  }
+  return nullptr;
+}
+
+void Virtual_Clock::fire(Timer &timer) {
+  timer.armed = false;
+  timer.fired = true;
+  if (!signal_eventfd(timer.fd)) {
+    throw std::runtime_error("Unable to fire virtual timer");
+  }
+}
+
+// Only timers that fired can hold an expiration, which saves a system call
+// on most rearms. The loop may have read it already
+void Virtual_Clock::clear(Timer &timer) {
+  if (timer.fired) {
+    uint64_t expirations;
+    if (!read_eventfd(timer.fd, expirations) && errno != EAGAIN) {
+      throw std::runtime_error("Unable to clear virtual timer");
+    }
+    timer.fired = false;
+  }
+}
+
+void Virtual_Clock::arm_timer(int timer, time_point<steady_clock> deadline) {
+  auto t = find(timer);
+  if (t == nullptr) {
+    return;
+  }
+  clear(*t);
+  t->armed = true;
+  t->deadline = deadline;
+  if (deadline <= now_) {
+    fire(*t);
+  }
+}
+
+void Virtual_Clock::disarm_timer(int timer) {
+  auto t = find(timer);
+  if (t == nullptr) {
+    return;
+  }
+  clear(*t);
+  t->armed = false;
+}
+
+bool Virtual_Clock::advance() {
+  auto next = time_point<steady_clock>::max();
+  for (const auto &t : timers_) {
+    if (t.armed) {
+      next = std::min(next, t.deadline);
+    }
+  }
+  if (next == time_point<steady_clock>::max()) {
+    return false;
+  }
+
+  now_ = std::max(now_, next);
+  ++advances_;
+  for (auto &t : timers_) {
+    if (t.armed && t.deadline <= now_) {
+      fire(t);
+    }
+  }
+  return true;
+}
+} // namespace pico_ping
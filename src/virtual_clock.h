@@ -0,0 +1,116 @@
+/**
+ * @file virtual_clock.h
+ * @ingroup Ping_Service
+ * @brief Simulated time that jumps straight to the next timer deadline
+ *
+ * Copyright (c) 2020 Patrick Servello (patrick.servello@gmail.com)
+ *
+ * Distributed under the Apache license and can be found in LICENSE.txt
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace pico_ping {
+
+/**
+ * @brief Clock and timers of an event driven simulation
+ *
+ * Stands in for CLOCK_MONOTONIC and its timerfds. Time only moves when
+ * advance is called, which jumps to the earliest armed deadline and signals
+ * every timer due by then, so hours of probing run as fast as the code
+ * handling them. Timers are eventfds that become readable when they fire,
+ * which lets an Event_Loop watch them exactly like timerfds: reading one
+ * consumes the expiration. Time points are steady_clock ones, so the code
+ * being simulated needs no changes beyond asking this clock for the time.
+ *
+ * Not thread safe, a clock drives a single event loop.
+ */
+class Virtual_Clock {
+public:
+  /**
+   * @brief Construct a clock standing still at start
+   */
+  explicit Virtual_Clock(time_point<steady_clock> start = steady_clock::now())
+      : start_(start), now_(start) {}
+
+  Virtual_Clock(const Virtual_Clock &) = delete;
+  Virtual_Clock &operator=(const Virtual_Clock &) = delete;
+
+  time_point<steady_clock> now() const { return now_; }
+
+  /**
+   * @brief Simulated time passed since construction
+   */
+  nanoseconds elapsed() const { return now_ - start_; }
+
+  /**
+   * @brief Number of times advance moved the clock forward
+   */
+  uint64_t advances() const { return advances_; }
+
+  /**
+   * @brief Creates a disarmed timer
+   *
+   * @return eventfd owned by the caller, who calls remove_timer before
+   * closing it
+   *
+   * @throw std::runtime_error if the eventfd cannot be created
+   */
+  int add_timer();
+
+  /**
+   * @brief Forgets a timer, unknown descriptors are ignored
+   */
+  void remove_timer(int timer);
+
+  /**
+   * @brief Arms a timer to fire once at an absolute deadline
+   *
+   * Deadlines that are not in the future fire immediately. Like rearming a
+   * timerfd this clears an expiration that was not read yet.
+   *
+   * @throw std::runtime_error if the timer's eventfd cannot be accessed
+   */
+  void arm_timer(int timer, time_point<steady_clock> deadline);
+
+  /**
+   * @brief Stops a timer from firing and clears an unread expiration
+   *
+   * @throw std::runtime_error if the timer's eventfd cannot be read
+   */
+  void disarm_timer(int timer);
+
+  /**
+   * @brief Moves time to the earliest deadline and fires every due timer
+   *
+   * @return false if no timer is armed, time then stands still
+   *
+   * @throw std::runtime_error if a timer's eventfd cannot be written
+   */
+  bool advance();
+
+private:
+  struct Timer {
+    int fd;
+    bool armed;
+    // Fired since last armed, the expiration may not have been read yet
+    bool fired;
+    time_point<steady_clock> deadline;
+  };
+
+  Timer *find(int timer);
+  void fire(Timer &timer);
+  void clear(Timer &timer);
+
+  time_point<steady_clock> start_;
+  time_point<steady_clock> now_;
+  uint64_t advances_ = 0;
+  // Few timers exist, a scan beats keeping them ordered
+  std::vector<Timer> timers_;
+};
+} // namespace pico_ping
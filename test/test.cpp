@@ -9,10 +9,46 @@
  */
 
 #define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
 #include "argv_argc_utility.hpp"
+#include "async_writer.h"
+#include "batch_io.h"
 #include "catch.hpp"
 #include "cli.h"
+#include "echo_socket.h"
+#include "event_loop.h"
+#include "kernel_timestamps.h"
+#include "output_buffer.h"
+#include "pacer.h"
+#include "payload_stamp.h"
+#include "ping_executor.h"
 #include "ping_service.h"
+#include "ping_workers.h"
+#include "probe_engine.h"
+#include "probe_record.h"
+#include "probe_window.h"
+#include "resolver.h"
+#include "ring_queue.h"
+#include "rtt_stats.h"
+#include "simulated_network.h"
+#include "target_file.h"
+#include "target_generator.h"
+#include "timer_wheel.h"
+#include "uring_io.h"
+#include "virtual_clock.h"
 
 using namespace pico_ping;
 
@@ -27,7 +63,7 @@ TEST_CASE("Testing Command line parsing") {
     REQUIRE_NOTHROW(cli::get_input(argc, actual_argv));
 
     cli::command_parameters res = cli::get_input(argc, actual_argv);
-    REQUIRE(res.host == "8.8.8.8");
+    REQUIRE(res.hosts.front() == "8.8.8.8");
   }
 
   SECTION("Valid positional destination parameter with valid short optional") {
@@ -39,7 +75,7 @@ TEST_CASE("Testing Command line parsing") {
     REQUIRE_NOTHROW(cli::get_input(argc, actual_argv));
 
     cli::command_parameters res = cli::get_input(argc, actual_argv);
-    REQUIRE(res.host == "8.8.8.8");
+    REQUIRE(res.hosts.front() == "8.8.8.8");
     REQUIRE(res.timeout.count() == 5);
   }
 
@@ -52,10 +88,24 @@ TEST_CASE("Testing Command line parsing") {
     REQUIRE_NOTHROW(cli::get_input(argc, actual_argv));
 
     cli::command_parameters res = cli::get_input(argc, actual_argv);
-    REQUIRE(res.host == "8.8.8.8");
+    REQUIRE(res.hosts.front() == "8.8.8.8");
     REQUIRE(res.timeout.count() == 5);
   }
 
+  SECTION("Multiple positional destination parameters") {
+    Argv argv({"test", "8.8.8.8", "1.1.1.1", "-W", "2", "9.9.9.9"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.hosts.size() == 3);
+    REQUIRE(res.hosts[0] == "8.8.8.8");
+    REQUIRE(res.hosts[1] == "1.1.1.1");
+    REQUIRE(res.hosts[2] == "9.9.9.9");
+    REQUIRE(res.timeout.count() == 2);
+  }
+
   SECTION(
       "Missing positional destination parameter with valid short optional") {
     Argv argv({"test", "-W", "5"});
@@ -66,6 +116,172 @@ TEST_CASE("Testing Command line parsing") {
     REQUIRE_THROWS_AS(cli::get_input(argc, actual_argv), std::invalid_argument);
   }
 
+  SECTION("Packet I/O backend selection") {
+    Argv argv({"test", "8.8.8.8", "--io", "uring"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.io_backend == "uring");
+  }
+
+  SECTION("Unknown packet I/O backend") {
+    Argv argv({"test", "8.8.8.8", "--io", "kqueue"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    REQUIRE_THROWS_AS(cli::get_input(argc, actual_argv), std::invalid_argument);
+  }
+
+  SECTION("Kernel timestamp flag") {
+    Argv argv({"test", "8.8.8.8", "-K"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.kernel_timestamps);
+  }
+
+  SECTION("Microsecond probe interval") {
+    Argv argv({"test", "8.8.8.8", "-i", "0.000250"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.interval == microseconds(250));
+    REQUIRE_FALSE(res.flood);
+  }
+
+  SECTION("Flood mode defaults to a short interval") {
+    Argv argv({"test", "8.8.8.8", "-f"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.flood);
+    REQUIRE(res.interval == milliseconds(10));
+  }
+
+  SECTION("Interval below a microsecond") {
+    Argv argv({"test", "8.8.8.8", "-i", "0.0000001"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    REQUIRE_THROWS_AS(cli::get_input(argc, actual_argv), std::invalid_argument);
+  }
+
+  SECTION("Payload stamp flag") {
+    Argv argv({"test", "8.8.8.8", "--stamp"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.stamp_payload);
+  }
+
+  SECTION("Payload size and pattern") {
+    Argv argv({"test", "8.8.8.8", "-s", "1400", "-p", "ff00A5"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.payload_size == 1400);
+    REQUIRE(res.pattern == std::vector<unsigned char>{0xff, 0x00, 0xa5});
+  }
+
+  SECTION("Malformed payload pattern") {
+    Argv argv({"test", "8.8.8.8", "-p", "0g"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    REQUIRE_THROWS_AS(cli::get_input(argc, actual_argv), std::invalid_argument);
+  }
+
+  SECTION("Payload larger than a datagram") {
+    Argv argv({"test", "8.8.8.8", "-s", "65508"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    REQUIRE_THROWS_AS(cli::get_input(argc, actual_argv), std::invalid_argument);
+  }
+
+  SECTION("Hostname re-resolution interval") {
+    Argv argv({"test", "google.com", "--dns-ttl", "30"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.dns_ttl == seconds(30));
+  }
+
+  SECTION("Worker thread count") {
+    Argv argv({"test", "8.8.8.8", "1.1.1.1", "-T", "2"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.threads == 2);
+  }
+
+  SECTION("Probe count, permuted sweep and comma separated lists") {
+    Argv argv({"test", "10.0.0.0/30,10.0.1.1-5", "::1", "-c", "3",
+               "--permute"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.hosts == std::vector<std::string>{"10.0.0.0/30",
+                                                  "10.0.1.1-5", "::1"});
+    REQUIRE(res.count == 3);
+    REQUIRE(res.permute);
+  }
+
+  SECTION("Target file without positional destinations") {
+    Argv argv({"test", "-F", "targets.txt"});
+
+    char **actual_argv = argv.argv();
+    auto argc = argv.argc();
+
+    cli::command_parameters res = cli::get_input(argc, actual_argv);
+    REQUIRE(res.hosts.empty());
+    REQUIRE(res.target_file == "targets.txt");
+  }
+
+  SECTION("Output formats") {
+    Argv json({"test", "8.8.8.8", "-o", "json"});
+    REQUIRE(cli::get_input(json.argc(), json.argv()).output_format == "json");
+
+    Argv text({"test", "8.8.8.8"});
+    REQUIRE(cli::get_input(text.argc(), text.argv()).output_format == "text");
+
+    Argv unknown({"test", "8.8.8.8", "--output", "xml"});
+    REQUIRE_THROWS_AS(cli::get_input(unknown.argc(), unknown.argv()),
+                      std::invalid_argument);
+  }
+
+  SECTION("Zero count and empty list entries throw") {
+    Argv zero({"test", "8.8.8.8", "-c", "0"});
+    REQUIRE_THROWS_AS(cli::get_input(zero.argc(), zero.argv()),
+                      std::invalid_argument);
+
+    Argv empty({"test", "8.8.8.8,,1.1.1.1"});
+    REQUIRE_THROWS_AS(cli::get_input(empty.argc(), empty.argv()),
+                      std::invalid_argument);
+  }
+
   SECTION("Invalid short optional") {
     Argv argv({"test", "-L", "5"});
 
@@ -117,4 +333,1633 @@ TEST_CASE("Testing Ping_Service constructor") {
   SECTION("Testing that blank parameter throws proper exception") {
     REQUIRE_THROWS_AS(Ping_Service("", timeout), std::invalid_argument);
   }
-}
\ No newline at end of file
+
+  SECTION("Testing that several valid targets do not throw an exception") {
+    std::vector<std::string> hosts = {"8.8.8.8", "1.1.1.1", "google.com"};
+    REQUIRE_NOTHROW(Ping_Service(hosts, timeout));
+  }
+
+  SECTION("Testing that one invalid target among several throws") {
+    std::vector<std::string> hosts = {"8.8.8.8", "8.8.8.257"};
+    REQUIRE_THROWS_AS(Ping_Service(hosts, timeout), std::invalid_argument);
+  }
+
+  SECTION("Testing that a valid IPv6 address does not throw an exception") {
+    REQUIRE_NOTHROW(Ping_Service("::1", timeout));
+  }
+
+  SECTION("Testing that invalid IPv6 address throws proper exception") {
+    REQUIRE_THROWS_AS(Ping_Service("2001:db8::g", timeout),
+                      std::invalid_argument);
+  }
+
+  SECTION("Testing that mixed IPv4 and IPv6 targets do not throw") {
+    std::vector<std::string> hosts = {"127.0.0.1", "::1"};
+    REQUIRE_NOTHROW(Ping_Service(hosts, timeout));
+  }
+
+  SECTION("Testing that an oversized payload throws proper exception") {
+    Ping_Options options;
+    options.payload_size = max_payload_size + 1;
+    REQUIRE_THROWS_AS(Ping_Service({"127.0.0.1"}, timeout, options),
+                      std::invalid_argument);
+  }
+
+  SECTION("Testing that a payload too small for a stamp throws") {
+    Ping_Options options;
+    options.stamp_payload = true;
+    options.payload_size = payload_stamp_size - 1;
+    REQUIRE_THROWS_AS(Ping_Service({"127.0.0.1"}, timeout, options),
+                      std::invalid_argument);
+  }
+
+  SECTION("Testing that an empty target list throws proper exception") {
+    REQUIRE_THROWS_AS(Ping_Service(std::vector<std::string>{}, timeout),
+                      std::invalid_argument);
+  }
+}
+
+TEST_CASE("Testing Probe_Window matching") {
+  auto now = steady_clock::now();
+  time_point<steady_clock> sent;
+
+  SECTION("Capacity is rounded up to a power of two") {
+    REQUIRE(Probe_Window(10).capacity() == 16);
+    REQUIRE(Probe_Window(1 << 20).capacity() == 1 << 16);
+  }
+
+  SECTION("First reply matches and returns the logged send time") {
+    Probe_Window window(4);
+    auto tag = window.log_sent(now);
+    REQUIRE(tag == 1);
+    REQUIRE(window.complete(1, sent) == Reply_Match::matched);
+    REQUIRE(sent == now);
+  }
+
+  SECTION("Second reply to the same probe is a duplicate") {
+    Probe_Window window(4);
+    window.log_sent(now);
+    window.complete(1, sent);
+    REQUIRE(window.complete(1, sent) == Reply_Match::duplicate);
+  }
+
+  SECTION("Reply after the probe expired is late") {
+    Probe_Window window(4);
+    auto tag = window.log_sent(now);
+    REQUIRE(window.expire(tag));
+    REQUIRE_FALSE(window.expire(tag));
+    REQUIRE(window.complete(1, sent) == Reply_Match::late);
+  }
+
+  SECTION("Answered probes do not expire") {
+    Probe_Window window(4);
+    auto tag = window.log_sent(now);
+    window.complete(1, sent);
+    REQUIRE_FALSE(window.expire(tag));
+  }
+
+  SECTION("Reply to a probe whose slot was reused is stale") {
+    Probe_Window window(4);
+    auto first = window.log_sent(now);
+    for (int i = 0; i < 4; ++i) {
+      window.log_sent(now);
+    }
+    REQUIRE(window.complete(static_cast<uint16_t>(first), sent) ==
+            Reply_Match::stale);
+    REQUIRE_FALSE(window.expire(first));
+    REQUIRE(window.complete(5, sent) == Reply_Match::matched);
+  }
+
+  SECTION("Reply to a sequence that was never sent is stale") {
+    Probe_Window window(4);
+    REQUIRE(window.complete(3, sent) == Reply_Match::stale);
+  }
+}
+
+TEST_CASE("Testing kernel timestamp RTT") {
+  double rtt = 0;
+
+  SECTION("Software timestamps are used when hardware ones are missing") {
+    Kernel_Time sent{1000000, 0};
+    Kernel_Time received{3500000, 0};
+    REQUIRE(kernel_rtt(sent, received, rtt));
+    REQUIRE(rtt == Approx(2.5));
+  }
+
+  SECTION("Hardware timestamps are preferred when both sides have one") {
+    Kernel_Time sent{1000000, 5000000};
+    Kernel_Time received{9000000, 6000000};
+    REQUIRE(kernel_rtt(sent, received, rtt));
+    REQUIRE(rtt == Approx(1.0));
+  }
+
+  SECTION("No RTT without a common timestamp source") {
+    Kernel_Time sent{0, 5000000};
+    Kernel_Time received{9000000, 0};
+    REQUIRE_FALSE(kernel_rtt(sent, received, rtt));
+  }
+
+  SECTION("Service can be constructed with kernel timestamps enabled") {
+    Ping_Options options;
+    options.kernel_timestamps = true;
+    REQUIRE_NOTHROW(Ping_Service({"127.0.0.1"}, seconds(1), options));
+  }
+}
+
+TEST_CASE("Testing Event_Loop dispatch") {
+  Event_Loop loop;
+
+  SECTION("Readable descriptor invokes its handler") {
+    int fd = eventfd(0, EFD_NONBLOCK);
+    int calls = 0;
+    loop.add(fd, EPOLLIN, [&](uint32_t events) {
+      uint64_t value;
+      REQUIRE(read(fd, &value, sizeof(value)) == sizeof(value));
+      REQUIRE((events & EPOLLIN) != 0);
+      ++calls;
+    });
+
+    uint64_t one = 1;
+    REQUIRE(write(fd, &one, sizeof(one)) == sizeof(one));
+    REQUIRE(loop.run_once(100) == 1);
+    REQUIRE(calls == 1);
+    REQUIRE(loop.run_once(0) == 0);
+  }
+
+  SECTION("Timers fire in deadline order") {
+    std::vector<int> fired;
+    int late = loop.add_timer([&] { fired.push_back(2); });
+    int early = loop.add_timer([&] { fired.push_back(1); });
+
+    auto now = steady_clock::now();
+    loop.arm_timer(late, now + milliseconds(20));
+    loop.arm_timer(early, now + milliseconds(5));
+
+    while (fired.size() < 2) {
+      loop.run_once(100);
+    }
+    REQUIRE(fired == std::vector<int>{1, 2});
+  }
+
+  SECTION("Disarmed timers do not fire") {
+    int calls = 0;
+    int timer = loop.add_timer([&] { ++calls; });
+    loop.arm_timer(timer, steady_clock::now() + milliseconds(5));
+    loop.disarm_timer(timer);
+    REQUIRE(loop.run_once(20) == 0);
+    REQUIRE(calls == 0);
+  }
+}
+
+// Sends one echo with a referenced payload to loopback through a backend and
+// waits for its reply
+static bool echo_over_loopback(Packet_IO &io, int family = AF_INET) {
+  Socket_Address dest;
+  std::memset(&dest, 0, sizeof(dest));
+  if (family == AF_INET6) {
+    dest.v6.sin6_family = AF_INET6;
+    dest.v6.sin6_addr = in6addr_loopback;
+  } else {
+    dest.v4.sin_family = AF_INET;
+    dest.v4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+
+  struct icmphdr header;
+  std::memset(&header, 0, sizeof(header));
+  header.type = family == AF_INET6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+  header.un.echo.sequence = 42;
+  unsigned char payload[32];
+  std::memset(payload, 0xa5, sizeof(payload));
+  io.queue(&header, sizeof(header), payload, sizeof(payload), dest, 7);
+  if (io.flush() != 0 || io.sent_count() != 1 || io.sent_cookie(0) != 7) {
+    return false;
+  }
+
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    if (io.receive() > 0) {
+      auto reply = io.packet(0);
+      struct icmphdr echoed;
+      std::memcpy(&echoed, reply.data, sizeof(echoed));
+      return echoed.type ==
+                 (family == AF_INET6 ? ICMP6_ECHO_REPLY : ICMP_ECHOREPLY) &&
+             echoed.un.echo.sequence == 42 &&
+             reply.length == sizeof(header) + sizeof(payload) &&
+             std::memcmp(reply.data + sizeof(header), payload,
+                         sizeof(payload)) == 0 &&
+             same_host(*reply.from, dest);
+    }
+    struct pollfd pfd = {io.event_fd(), POLLIN, 0};
+    poll(&pfd, 1, 100);
+  }
+  return false;
+}
+
+TEST_CASE("Testing packet I/O backends over loopback") {
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_ICMP);
+  REQUIRE(sock >= 0);
+
+  SECTION("sendmmsg and recvmmsg backend") {
+    Batch_IO io(sock, 8, 64);
+    REQUIRE(echo_over_loopback(io));
+  }
+
+  SECTION("io_uring backend when the kernel supports it") {
+    auto io = Uring_IO::create(sock, 8, 64);
+    if (io != nullptr) {
+      REQUIRE(echo_over_loopback(*io));
+    }
+  }
+
+  SECTION("Service falls back cleanly whichever backend is requested") {
+    Ping_Options options;
+    options.io_backend = IO_Backend::io_uring;
+    REQUIRE_NOTHROW(Ping_Service({"127.0.0.1"}, seconds(1), options));
+  }
+
+  close(sock);
+}
+
+TEST_CASE("Testing ICMPv6 echo over loopback") {
+  int sock = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_ICMPV6);
+  REQUIRE(sock >= 0);
+
+  SECTION("sendmmsg and recvmmsg backend") {
+    Batch_IO io(sock, 8, 64);
+    REQUIRE(echo_over_loopback(io, AF_INET6));
+  }
+
+  SECTION("io_uring backend when the kernel supports it") {
+    auto io = Uring_IO::create(sock, 8, 64);
+    if (io != nullptr) {
+      REQUIRE(echo_over_loopback(*io, AF_INET6));
+    }
+  }
+
+  close(sock);
+}
+
+// Waits until the resolver has finished the expected number of lookups
+static std::vector<Resolution> wait_for_resolutions(Resolver &resolver,
+                                                    size_t expected) {
+  std::vector<Resolution> results;
+  for (int attempt = 0; attempt < 50 && results.size() < expected;
+       ++attempt) {
+    struct pollfd pfd = {resolver.event_fd(), POLLIN, 0};
+    poll(&pfd, 1, 100);
+    resolver.collect(results);
+  }
+  return results;
+}
+
+TEST_CASE("Testing Resolver") {
+  Resolver resolver(seconds(60), 4);
+
+  SECTION("Hostname syntax is checked without a lookup") {
+    REQUIRE(valid_hostname("google.com"));
+    REQUIRE(valid_hostname("a-b.example_c.org."));
+    REQUIRE_FALSE(valid_hostname(""));
+    REQUIRE_FALSE(valid_hostname(".com"));
+    REQUIRE_FALSE(valid_hostname("google..com"));
+    REQUIRE_FALSE(valid_hostname("-google.com"));
+    REQUIRE_FALSE(valid_hostname("google-.com"));
+    REQUIRE_FALSE(valid_hostname(std::string(64, 'a') + ".com"));
+  }
+
+  SECTION("Hosts file names resolve to loopback") {
+    resolver.resolve("localhost");
+    auto results = wait_for_resolutions(resolver, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0].host == "localhost");
+    REQUIRE(results[0].resolved);
+    auto text = address_to_string(results[0].address);
+    REQUIRE((text == "127.0.0.1" || text == "::1"));
+  }
+
+  SECTION("Cached answers are delivered without a lookup") {
+    resolver.resolve("localhost");
+    REQUIRE(wait_for_resolutions(resolver, 1).size() == 1);
+
+    resolver.resolve("localhost");
+    std::vector<Resolution> results;
+    REQUIRE(resolver.collect(results) == 1);
+    REQUIRE(results[0].resolved);
+  }
+
+  SECTION("Unknown names fail") {
+    resolver.resolve("nonexistent.invalid");
+    auto results = wait_for_resolutions(resolver, 1);
+    REQUIRE(results.size() == 1);
+    REQUIRE_FALSE(results[0].resolved);
+  }
+}
+
+TEST_CASE("Testing Socket_Address") {
+  Socket_Address v4, v6, other;
+  std::memset(&v4, 0, sizeof(v4));
+  std::memset(&v6, 0, sizeof(v6));
+  std::memset(&other, 0, sizeof(other));
+  v4.v4.sin_family = AF_INET;
+  inet_pton(AF_INET, "192.0.2.1", &v4.v4.sin_addr);
+  v6.v6.sin6_family = AF_INET6;
+  inet_pton(AF_INET6, "2001:db8::1", &v6.v6.sin6_addr);
+
+  SECTION("Both families format in their numeric form") {
+    REQUIRE(address_to_string(v4) == "192.0.2.1");
+    REQUIRE(address_to_string(v6) == "2001:db8::1");
+  }
+
+  SECTION("Lengths follow the family") {
+    REQUIRE(address_length(v4) == sizeof(struct sockaddr_in));
+    REQUIRE(address_length(v6) == sizeof(struct sockaddr_in6));
+  }
+
+  SECTION("Ports do not affect host equality") {
+    other = v6;
+    other.v6.sin6_port = htons(7);
+    REQUIRE(same_host(v6, other));
+    REQUIRE(Address_Hash()(v6) == Address_Hash()(other));
+    REQUIRE_FALSE(same_host(v4, v6));
+  }
+}
+
+TEST_CASE("Testing Pacer token bucket") {
+  auto start = steady_clock::now();
+  Pacer pacer(microseconds(100), 8);
+  pacer.start(start);
+
+  SECTION("First token is available immediately") {
+    REQUIRE(pacer.take(start, 10) == 1);
+    REQUIRE(pacer.take(start, 10) == 0);
+    REQUIRE(pacer.next_deadline() == start + microseconds(100));
+  }
+
+  SECTION("Tokens accrue one per period") {
+    REQUIRE(pacer.take(start + microseconds(450), 10) == 5);
+    REQUIRE(pacer.next_deadline() == start + microseconds(500));
+  }
+
+  SECTION("Late takes do not shift the schedule") {
+    REQUIRE(pacer.take(start + microseconds(150), 10) == 2);
+    REQUIRE(pacer.take(start + microseconds(299), 10) == 1);
+    REQUIRE(pacer.next_deadline() == start + microseconds(300));
+  }
+
+  SECTION("Tokens beyond the burst are dropped") {
+    REQUIRE(pacer.take(start + milliseconds(10), 100) == 8);
+    REQUIRE(pacer.take(start + milliseconds(10), 100) == 0);
+  }
+
+  SECTION("Untaken tokens are kept for later") {
+    REQUIRE(pacer.take(start + microseconds(350), 2) == 2);
+    REQUIRE(pacer.take(start + microseconds(350), 10) == 2);
+  }
+}
+
+TEST_CASE("Testing payload stamps") {
+  unsigned char payload[payload_stamp_size];
+  Payload_Stamp written{7, steady_clock::now()};
+  write_payload_stamp(payload, written);
+
+  SECTION("Stamp round trips through the payload") {
+    Payload_Stamp read;
+    REQUIRE(read_payload_stamp(payload, sizeof(payload), read));
+    REQUIRE(read.target == 7);
+    REQUIRE(read.sent == written.sent);
+  }
+
+  SECTION("Truncated payload has no stamp") {
+    Payload_Stamp read;
+    REQUIRE_FALSE(read_payload_stamp(payload, sizeof(payload) - 1, read));
+  }
+
+  SECTION("Foreign payload has no stamp") {
+    unsigned char foreign[] = "PingPongPingPong";
+    Payload_Stamp read;
+    REQUIRE_FALSE(read_payload_stamp(foreign, payload_stamp_size, read));
+  }
+}
+
+TEST_CASE("Testing echo packet layout") {
+  Echo_Socket v4, v6;
+  v6.family = AF_INET6;
+  v6.echo_request = ICMP6_ECHO_REQUEST;
+  v6.echo_reply = ICMP6_ECHO_REPLY;
+
+  SECTION("Payloads repeat their pattern") {
+    auto payload = echo_payload(12);
+    REQUIRE(std::string(payload.begin(), payload.end()) == "PingPongPing");
+    payload = echo_payload(5, {0xab, 0xcd});
+    REQUIRE(payload ==
+            std::vector<unsigned char>{0xab, 0xcd, 0xab, 0xcd, 0xab});
+  }
+
+  SECTION("Only echo replies of the socket's family carry a sequence") {
+    icmphdr header;
+    write_echo_request(reinterpret_cast<unsigned char *>(&header), v4, 42);
+    REQUIRE(header.type == ICMP_ECHO);
+    REQUIRE(header.un.echo.sequence == 42);
+
+    Received_Packet reply{reinterpret_cast<unsigned char *>(&header),
+                          sizeof(header), nullptr, nullptr};
+    uint16_t sequence = 0;
+    REQUIRE_FALSE(read_echo_reply(v4, reply, sequence));
+    header.type = ICMP_ECHOREPLY;
+    REQUIRE(read_echo_reply(v4, reply, sequence));
+    REQUIRE(sequence == 42);
+    REQUIRE_FALSE(read_echo_reply(v6, reply, sequence));
+    reply.length = sizeof(header) - 1;
+    REQUIRE_FALSE(read_echo_reply(v4, reply, sequence));
+  }
+}
+
+TEST_CASE("Testing streaming RTT statistics") {
+  Rtt_Stats stats;
+
+  SECTION("Nothing recorded reports zeros") {
+    REQUIRE(stats.min() == 0);
+    REQUIRE(stats.percentile(0.5) == 0);
+    REQUIRE(stats.loss() == 0);
+  }
+
+  SECTION("Moments match the closed form of a uniform sequence") {
+    for (int rtt = 1; rtt <= 100; ++rtt) {
+      stats.record_rtt(rtt);
+    }
+    REQUIRE(stats.received() == 100);
+    REQUIRE(stats.min() == 1);
+    REQUIRE(stats.max() == 100);
+    REQUIRE(stats.mean() == Approx(50.5));
+    REQUIRE(stats.mdev() == Approx(std::sqrt((100.0 * 100 - 1) / 12)));
+  }
+
+  SECTION("Percentiles stay within the histogram precision") {
+    for (int rtt = 1; rtt <= 1000; ++rtt) {
+      stats.record_rtt(rtt / 10.0);
+    }
+    REQUIRE(stats.percentile(0.5) == Approx(50).epsilon(0.04));
+    REQUIRE(stats.percentile(0.9) == Approx(90).epsilon(0.04));
+    REQUIRE(stats.percentile(0.99) == Approx(99).epsilon(0.04));
+    REQUIRE(stats.percentile(0.999) == Approx(99.9).epsilon(0.04));
+    REQUIRE(stats.percentile(1) <= stats.max());
+  }
+
+  SECTION("Sub millisecond and very long RTTs are kept apart") {
+    stats.record_rtt(0.05);
+    stats.record_rtt(3600000);
+    REQUIRE(stats.percentile(0.5) == Approx(0.05).epsilon(0.04));
+    REQUIRE(stats.percentile(1) == 3600000);
+  }
+
+  SECTION("Merging equals recording every sample in one instance") {
+    Rtt_Stats first, second;
+    for (int rtt = 1; rtt <= 100; ++rtt) {
+      stats.record_rtt(rtt);
+      (rtt % 3 ? first : second).record_rtt(rtt);
+    }
+    first.record_lost();
+    first.merge(second);
+    REQUIRE(first.received() == 100);
+    REQUIRE(first.lost() == 1);
+    REQUIRE(first.min() == 1);
+    REQUIRE(first.max() == 100);
+    REQUIRE(first.mean() == Approx(stats.mean()));
+    REQUIRE(first.mdev() == Approx(stats.mdev()));
+    REQUIRE(first.percentile(0.9) == stats.percentile(0.9));
+  }
+
+  SECTION("Loss counts probes without a reply") {
+    for (int i = 0; i < 4; ++i) {
+      stats.record_sent();
+    }
+    stats.record_rtt(1);
+    stats.record_duplicate();
+    stats.record_lost();
+    REQUIRE(stats.transmitted() == 4);
+    REQUIRE(stats.duplicates() == 1);
+    REQUIRE(stats.lost() == 1);
+    REQUIRE(stats.loss() == Approx(0.75));
+  }
+}
+
+TEST_CASE("Testing sharded workers") {
+  seconds timeout(1);
+
+  SECTION("No more shards than hosts are created") {
+    std::vector<std::string> hosts = {"127.0.0.1", "::1"};
+    Ping_Workers workers(hosts, timeout, {}, 4);
+    REQUIRE(workers.size() == 2);
+  }
+
+  SECTION("Blocks and ranges are striped over every shard") {
+    std::vector<std::string> hosts = {"127.0.0.1", "127.0.1.0/30"};
+    Ping_Workers workers(hosts, timeout, {}, 3);
+    REQUIRE(workers.size() == 3);
+  }
+
+  SECTION("Zero workers throws proper exception") {
+    REQUIRE_THROWS_AS(Ping_Workers({"127.0.0.1"}, timeout, {}, 0),
+                      std::invalid_argument);
+  }
+
+  SECTION("Service running on one thread is stopped from another") {
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.output_fd = -1;
+    Ping_Service service({"127.0.0.1"}, timeout, options);
+
+    std::thread stopper([&service] {
+      std::this_thread::sleep_for(milliseconds(100));
+      service.stop();
+    });
+    service.run();
+    stopper.join();
+
+    std::ostringstream summary;
+    service.print_summary(summary);
+    REQUIRE(summary.str().find("127.0.0.1 ping statistics") !=
+            std::string::npos);
+    REQUIRE(summary.str().find("\n0 packets transmitted") == std::string::npos);
+  }
+}
+
+TEST_CASE("Testing Ring_Queue ordering") {
+  Ring_Queue<int> queue(3);
+
+  REQUIRE(queue.empty());
+  REQUIRE(queue.push(1));
+  REQUIRE(queue.push(2));
+  REQUIRE(queue.push(3));
+  REQUIRE(queue.full());
+  REQUIRE_FALSE(queue.push(4));
+
+  REQUIRE(queue.front() == 1);
+  queue.pop();
+  REQUIRE(queue.push(4));
+
+  for (int expected = 2; expected <= 4; ++expected) {
+    REQUIRE(queue.front() == expected);
+    queue.pop();
+  }
+  REQUIRE(queue.empty());
+}
+
+TEST_CASE("Testing Timer_Wheel expiry") {
+  auto start = steady_clock::now();
+  std::vector<uint64_t> fired;
+  auto record = [&fired](uint64_t cookie) { fired.push_back(cookie); };
+
+  SECTION("Timers fire once their tick has passed and never early") {
+    Timer_Wheel wheel(8, milliseconds(1), start);
+    wheel.arm(start + microseconds(2500), 1);
+    REQUIRE(wheel.next_deadline() == start + milliseconds(3));
+    REQUIRE(wheel.expire(start + milliseconds(2), record) == 0);
+    REQUIRE(wheel.expire(start + milliseconds(3), record) == 1);
+    REQUIRE(fired == std::vector<uint64_t>{1});
+    REQUIRE(wheel.empty());
+  }
+
+  SECTION("Cancelled timers do not fire and stale handles are rejected") {
+    Timer_Wheel wheel(1, milliseconds(1), start);
+    auto handle = wheel.arm(start + milliseconds(5), 1);
+    REQUIRE(wheel.arm(start + milliseconds(5), 2) ==
+            Timer_Wheel::invalid_handle);
+    REQUIRE(wheel.cancel(handle));
+    REQUIRE_FALSE(wheel.cancel(handle));
+
+    // The reused node must not be cancelled through the old handle
+    wheel.arm(start + milliseconds(5), 3);
+    REQUIRE_FALSE(wheel.cancel(handle));
+    wheel.expire(start + milliseconds(10), record);
+    REQUIRE(fired == std::vector<uint64_t>{3});
+  }
+
+  SECTION("Distant timers cascade down and fire in deadline order") {
+    Timer_Wheel wheel(16, milliseconds(1), start);
+    std::vector<milliseconds> deadlines = {
+        milliseconds(70000), milliseconds(300), milliseconds(255),
+        milliseconds(256),   milliseconds(65536), milliseconds(1),
+        milliseconds(20000000)};
+    for (size_t i = 0; i < deadlines.size(); ++i) {
+      wheel.arm(start + deadlines[i], i);
+    }
+
+    // Stepping through next_deadline() fires every timer on time
+    while (!wheel.empty()) {
+      auto next = wheel.next_deadline();
+      auto before = fired.size();
+      wheel.expire(next, record);
+      for (auto i = before; i < fired.size(); ++i) {
+        REQUIRE(start + deadlines[fired[i]] == next);
+      }
+    }
+    REQUIRE(fired == std::vector<uint64_t>{5, 2, 3, 1, 4, 0, 6});
+  }
+
+  SECTION("One expire call fires every due timer in a batch") {
+    Timer_Wheel wheel(1000, milliseconds(1), start);
+    for (uint64_t i = 0; i < 1000; ++i) {
+      wheel.arm(start + milliseconds(i % 500), i);
+    }
+    REQUIRE(wheel.expire(start + seconds(1), record) == 1000);
+    REQUIRE(wheel.empty());
+  }
+}
+
+TEST_CASE("Testing CIDR and range expansion") {
+  Address_Range range;
+
+  SECTION("Plain addresses and hostnames are not ranges") {
+    REQUIRE_FALSE(parse_address_range("10.0.0.1", range));
+    REQUIRE_FALSE(parse_address_range("my-host.example.com", range));
+  }
+
+  SECTION("IPv4 blocks leave out network and broadcast addresses") {
+    REQUIRE(parse_address_range("10.1.2.77/24", range));
+    REQUIRE(range.size == 254);
+    REQUIRE(address_to_string(range_address(range, 0)) == "10.1.2.1");
+    REQUIRE(address_to_string(range_address(range, 253)) == "10.1.2.254");
+
+    REQUIRE(parse_address_range("10.1.2.4/31", range));
+    REQUIRE(range.size == 2);
+    REQUIRE(parse_address_range("10.1.2.4/32", range));
+    REQUIRE(range.size == 1);
+  }
+
+  SECTION("Ranges by full address or last octet") {
+    REQUIRE(parse_address_range("10.0.0.250-10.0.1.5", range));
+    REQUIRE(range.size == 12);
+    REQUIRE(address_to_string(range_address(range, 6)) == "10.0.1.0");
+
+    REQUIRE(parse_address_range("10.0.0.1-50", range));
+    REQUIRE(range.size == 50);
+  }
+
+  SECTION("IPv6 blocks and ranges") {
+    REQUIRE(parse_address_range("fd00::/120", range));
+    REQUIRE(range.size == 256);
+    REQUIRE(address_to_string(range_address(range, 255)) == "fd00::ff");
+
+    REQUIRE(parse_address_range("fd00::ffff-fd00::1:1", range));
+    REQUIRE(range.size == 3);
+    REQUIRE(address_to_string(range_address(range, 1)) == "fd00::1:0");
+  }
+
+  SECTION("Malformed, empty or oversized ranges throw") {
+    for (auto spec : {"10.0.0.0/33", "10.0.0.0/", "10.0.0.5-1", "10.0.0.1-::1",
+                      "fd00::/64", "fd00::-x", "10.0.0.1-256"}) {
+      REQUIRE_THROWS_AS(parse_address_range(spec, range),
+                        std::invalid_argument);
+    }
+  }
+
+  SECTION("Permutation visits every index exactly once") {
+    for (uint64_t size : {1, 2, 3, 10, 1000}) {
+      Cyclic_Permutation permutation(size, 42);
+      std::vector<int> seen(size);
+      uint64_t index;
+      while (permutation.next(index)) {
+        REQUIRE(index < size);
+        ++seen[index];
+      }
+      REQUIRE(std::all_of(seen.begin(), seen.end(),
+                          [](int count) { return count == 1; }));
+    }
+  }
+
+  SECTION("Generator yields every address once, in order or permuted") {
+    Target_Generator generator;
+    parse_address_range("10.0.0.0/30", range);
+    generator.add(range);
+    parse_address_range("10.0.1.1-3", range);
+    generator.add(range);
+    REQUIRE(generator.size() == 5);
+
+    for (bool permute : {false, true}) {
+      generator.start(permute, 7);
+      std::vector<std::string> addresses;
+      Socket_Address address;
+      size_t index;
+      while (generator.next(address, index)) {
+        REQUIRE(index == (address_to_string(address) < "10.0.1" ? 0u : 1u));
+        addresses.push_back(address_to_string(address));
+      }
+      if (!permute) {
+        REQUIRE(addresses.front() == "10.0.0.1");
+      }
+      std::sort(addresses.begin(), addresses.end());
+      REQUIRE(addresses == std::vector<std::string>{"10.0.0.1", "10.0.0.2",
+                                                    "10.0.1.1", "10.0.1.2",
+                                                    "10.0.1.3"});
+    }
+  }
+
+  SECTION("Shards sharing a seed split the walk between them") {
+    Target_Generator generators[3];
+    std::vector<std::string> addresses;
+    for (size_t shard = 0; shard < 3; ++shard) {
+      parse_address_range("10.0.0.0/28", range);
+      generators[shard].add(range);
+      generators[shard].start(true, 11, shard, 3);
+      Socket_Address address;
+      size_t index;
+      while (generators[shard].next(address, index)) {
+        addresses.push_back(address_to_string(address));
+      }
+    }
+    std::sort(addresses.begin(), addresses.end());
+    REQUIRE(addresses.size() == 14);
+    REQUIRE(std::unique(addresses.begin(), addresses.end()) ==
+            addresses.end());
+  }
+
+  SECTION("A counted sweep finishes on its own") {
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.count = 2;
+    options.output_fd = -1;
+    Ping_Service service({"127.0.0.1", "127.0.1.0/29"}, seconds(1), options);
+    service.run();
+
+    std::ostringstream summary;
+    service.print_summary(summary);
+    REQUIRE(summary.str().find("127.0.1.0/29 ping statistics ---\n"
+                               "6 of 6 addresses probed, 6 alive\n"
+                               "12 packets transmitted, 12 received") !=
+            std::string::npos);
+    REQUIRE(summary.str().find("127.0.0.1 ping statistics ---\n"
+                               "2 packets transmitted") != std::string::npos);
+  }
+}
+
+TEST_CASE("Testing target file ingestion") {
+  uint32_t address;
+
+  SECTION("IPv4 literals are parsed strictly") {
+    std::string good = "192.168.1.254";
+    REQUIRE(parse_ipv4(good.data(), good.data() + good.size(), address));
+    REQUIRE(address == htonl(0xc0a801fe));
+    for (std::string bad : {"1.2.3", "1.2.3.4.", "1.2.3.256", "1.2.3.0004",
+                            "1..2.3", "0x1.2.3.4", ""}) {
+      REQUIRE_FALSE(parse_ipv4(bad.data(), bad.data() + bad.size(), address));
+    }
+  }
+
+  // Removed again when the section is done
+  std::string path = "pico_ping_targets.txt";
+  std::ofstream(path) << "# fleet\n10.0.0.1\n\n  ::1 \t\r\n"
+                      << "host-a.example.com # web\n10.1.0.0/30\n"
+                      << "10.0.0.999\nnot a host\n10.0.0.9";
+
+  auto read_all = [](Target_File &file) {
+    std::vector<std::string> entries;
+    Target_Entry entry;
+    while (file.next(entry) == Target_File::Status::entry) {
+      entries.push_back(entry.resolved ? address_to_string(entry.address)
+                                       : entry.host);
+    }
+    return entries;
+  };
+
+  SECTION("Mapped file yields every entry and counts malformed lines") {
+    Target_File file(path);
+    REQUIRE(file.event_fd() == -1);
+    REQUIRE(read_all(file) ==
+            std::vector<std::string>{"10.0.0.1", "::1", "host-a.example.com",
+                                     "10.1.0.1", "10.1.0.2", "10.0.0.9"});
+    REQUIRE(file.at_end());
+    REQUIRE(file.skipped() == 2);
+  }
+
+  SECTION("Stripes split the entries between them") {
+    Target_File first(path, 0, 2), second(path, 1, 2);
+    auto entries = read_all(first);
+    REQUIRE(entries.size() == 3);
+    auto rest = read_all(second);
+    entries.insert(entries.end(), rest.begin(), rest.end());
+    REQUIRE(entries.size() == 6);
+    REQUIRE(second.skipped() == 0);
+  }
+
+  SECTION("Missing files throw") {
+    REQUIRE_THROWS_AS(Target_File("no/such/file"), std::invalid_argument);
+  }
+
+  SECTION("Streams are read as input arrives") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    Target_File file("/dev/fd/" + std::to_string(fds[0]));
+    close(fds[0]);
+    REQUIRE(file.event_fd() >= 0);
+
+    Target_Entry entry;
+    REQUIRE(file.next(entry) == Target_File::Status::pending);
+    REQUIRE(write(fds[1], "10.0.0.1\n10.0.0.", 16) == 16);
+    file.fill();
+    REQUIRE(file.next(entry) == Target_File::Status::entry);
+    REQUIRE(address_to_string(entry.address) == "10.0.0.1");
+    REQUIRE(file.next(entry) == Target_File::Status::pending);
+
+    // The last line needs no newline once the writer is gone
+    REQUIRE(write(fds[1], "2", 1) == 1);
+    close(fds[1]);
+    file.fill();
+    file.fill();
+    REQUIRE(file.next(entry) == Target_File::Status::entry);
+    REQUIRE(address_to_string(entry.address) == "10.0.0.2");
+    REQUIRE(file.next(entry) == Target_File::Status::end);
+  }
+
+  SECTION("A service sweeps the file and finishes") {
+    std::ofstream(path) << "127.0.0.1\n127.0.2.0/30\n::1\n";
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.target_file = path;
+    options.output_fd = -1;
+    Ping_Service service(std::vector<std::string>{}, seconds(1), options);
+    service.run();
+
+    std::ostringstream summary;
+    service.print_summary(summary);
+    REQUIRE(summary.str().find(path + " ping statistics ---\n"
+                               "4 addresses probed, 4 alive\n") !=
+            std::string::npos);
+  }
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Testing the simulated network") {
+  Network_Profile profile;
+  profile.latency = milliseconds(5);
+  Socket_Address dest;
+  std::memset(&dest, 0, sizeof(dest));
+  dest.v4.sin_family = AF_INET;
+  REQUIRE(inet_pton(AF_INET, "192.0.2.7", &dest.v4.sin_addr) == 1);
+  icmphdr request{};
+  request.type = ICMP_ECHO;
+
+  // Sends count requests and collects every reply arriving within a second
+  auto exchange = [&](Simulated_IO &io, size_t count) {
+    std::vector<uint16_t> replies;
+    for (size_t i = 0; i < count; ++i) {
+      if (io.full()) {
+        io.flush();
+      }
+      request.un.echo.sequence = static_cast<uint16_t>(i);
+      io.queue(&request, sizeof(request), dest, i);
+    }
+    io.flush();
+
+    pollfd ready{io.event_fd(), POLLIN, 0};
+    while (io.in_flight() > 0 && poll(&ready, 1, 1000) == 1) {
+      for (size_t i = io.receive(); i-- > 0;) {
+        auto reply = io.packet(i);
+        icmphdr header;
+        std::memcpy(&header, reply.data, sizeof(header));
+        REQUIRE(header.type == ICMP_ECHOREPLY);
+        REQUIRE(reply.length == sizeof(request));
+        REQUIRE(address_to_string(*reply.from) == "192.0.2.7");
+        replies.insert(replies.begin(), header.un.echo.sequence);
+      }
+    }
+    return replies;
+  };
+
+  SECTION("Every request is answered once its latency has passed") {
+    Simulated_IO io(AF_INET, profile, 16, sizeof(request), 1);
+    auto sent = steady_clock::now();
+    request.un.echo.sequence = 1;
+    io.queue(&request, sizeof(request), dest, 42);
+    io.flush();
+    REQUIRE(io.sent_count() == 1);
+    REQUIRE(io.sent_cookie(0) == 42);
+    REQUIRE(io.receive() == 0);
+
+    pollfd ready{io.event_fd(), POLLIN, 0};
+    REQUIRE(poll(&ready, 1, 1000) == 1);
+    REQUIRE(io.receive() == 1);
+    REQUIRE(steady_clock::now() - sent >= profile.latency);
+    REQUIRE(io.counters().delivered == 1);
+  }
+
+  SECTION("Loss is random but repeats with the seed") {
+    profile.latency = nanoseconds(0);
+    profile.loss = 0.5;
+    Simulated_IO first(AF_INET, profile, 16, sizeof(request), 7);
+    Simulated_IO second(AF_INET, profile, 16, sizeof(request), 7);
+    auto replies = exchange(first, 1000);
+    REQUIRE(replies == exchange(second, 1000));
+    REQUIRE(replies.size() == 1000 - first.counters().lost);
+    REQUIRE(first.counters().lost > 400);
+    REQUIRE(first.counters().lost < 600);
+  }
+
+  SECTION("Duplicated replies arrive twice") {
+    profile.duplicate = 1;
+    Simulated_IO io(AF_INET, profile, 16, sizeof(request), 1);
+    REQUIRE(exchange(io, 10).size() == 20);
+    REQUIRE(io.counters().duplicated == 10);
+  }
+
+  SECTION("Reordered replies are overtaken by later ones") {
+    profile.reorder = 0.2;
+    Simulated_IO io(AF_INET, profile, 16, sizeof(request), 3);
+    auto replies = exchange(io, 100);
+    REQUIRE(replies.size() == 100);
+    REQUIRE(io.counters().reordered > 0);
+    REQUIRE_FALSE(std::is_sorted(replies.begin(), replies.end()));
+  }
+
+  SECTION("Latency distributions stay around their mean") {
+    profile.latency = milliseconds(20);
+    profile.jitter = milliseconds(5);
+    for (auto model : {Latency_Model::uniform, Latency_Model::normal}) {
+      profile.latency_model = model;
+      Simulated_IO io(AF_INET, profile, 16, sizeof(request), 1);
+      auto sent = steady_clock::now();
+      REQUIRE(exchange(io, 50).size() == 50);
+      auto elapsed = steady_clock::now() - sent;
+      REQUIRE(elapsed >= milliseconds(15));
+      REQUIRE(elapsed < milliseconds(500));
+    }
+  }
+
+  SECTION("Replies beyond the capacity are dropped") {
+    profile.capacity = 8;
+    Simulated_IO io(AF_INET, profile, 16, sizeof(request), 1);
+    REQUIRE(exchange(io, 16).size() == 8);
+    REQUIRE(io.counters().overflowed == 8);
+  }
+
+  SECTION("Out of range probabilities throw") {
+    profile.loss = 1.5;
+    REQUIRE_THROWS_AS(Simulated_IO(AF_INET, profile, 16, sizeof(request), 1),
+                      std::invalid_argument);
+  }
+
+  SECTION("A service sweeps addresses no real host answers") {
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.count = 2;
+    options.output_fd = -1;
+    options.transport = std::make_shared<Simulated_Network>(profile);
+    Ping_Service service({"198.51.100.0/28", "2001:db8::1"}, seconds(1),
+                         options);
+    service.run();
+
+    std::ostringstream summary;
+    service.print_summary(summary);
+    REQUIRE(summary.str().find("198.51.100.0/28 ping statistics ---\n"
+                               "14 of 14 addresses probed, 14 alive\n"
+                               "28 packets transmitted, 28 received") !=
+            std::string::npos);
+    REQUIRE(summary.str().find("2001:db8::1 ping statistics ---\n"
+                               "2 packets transmitted, 2 received") !=
+            std::string::npos);
+  }
+
+  SECTION("Unresolvable hosts finish as failed") {
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.count = 2;
+    options.output_fd = -1;
+    options.transport = std::make_shared<Simulated_Network>(profile);
+    Ping_Service service({"192.0.2.1", "nonexistent-host.invalid"},
+                         seconds(1), options);
+    service.run();
+    REQUIRE(service.unresolved() == 1);
+    std::ostringstream summary;
+    service.print_summary(summary);
+    REQUIRE(summary.str().find("192.0.2.1 ping statistics ---\n"
+                               "2 packets transmitted, 2 received") !=
+            std::string::npos);
+
+    Ping_Service alone({"nonexistent-host.invalid"}, seconds(1), options);
+    alone.run();
+    REQUIRE(alone.unresolved() == 1);
+  }
+}
+
+TEST_CASE("Testing virtual clock simulation") {
+  auto clock = std::make_shared<Virtual_Clock>();
+  auto start = clock->now();
+
+  SECTION("Time jumps to the earliest deadline and fires what is due") {
+    int early = clock->add_timer(), late = clock->add_timer();
+    clock->arm_timer(late, start + hours(2));
+    clock->arm_timer(early, start + hours(1));
+
+    pollfd ready[2] = {{early, POLLIN, 0}, {late, POLLIN, 0}};
+    REQUIRE(clock->advance());
+    REQUIRE(clock->elapsed() == hours(1));
+    REQUIRE(poll(ready, 2, 0) == 1);
+    REQUIRE(ready[0].revents == POLLIN);
+
+    // Rearming clears the expiration that was not read
+    clock->arm_timer(early, start + hours(3));
+    REQUIRE(poll(ready, 2, 0) == 0);
+    REQUIRE(clock->advance());
+    REQUIRE(clock->elapsed() == hours(2));
+    clock->disarm_timer(early);
+    REQUIRE_FALSE(clock->advance());
+    REQUIRE(clock->elapsed() == hours(2));
+
+    // Deadlines that passed fire right away
+    clock->arm_timer(early, start);
+    REQUIRE(poll(ready, 1, 0) == 1);
+
+    for (int timer : {early, late}) {
+      clock->remove_timer(timer);
+      close(timer);
+    }
+  }
+
+  SECTION("An event loop runs a day of timers without waiting") {
+    Event_Loop loop(clock.get());
+    std::vector<nanoseconds> fired;
+    int timer = 0;
+    timer = loop.add_timer([&] {
+      fired.push_back(clock->elapsed());
+      if (fired.size() < 24) {
+        loop.arm_timer(timer, clock->now() + hours(1));
+      }
+    });
+    loop.arm_timer(timer, start + hours(1));
+
+    auto begin = steady_clock::now();
+    while (fired.size() < 24) {
+      loop.run_once(1000);
+    }
+    REQUIRE(steady_clock::now() - begin < seconds(1));
+    REQUIRE(fired.back() == hours(24));
+  }
+
+  SECTION("A simulated sweep is faster than real time and repeatable") {
+    Network_Profile profile;
+    profile.latency_model = Latency_Model::exponential;
+    profile.latency = milliseconds(50);
+    profile.jitter = milliseconds(100);
+    profile.loss = 0.2;
+    profile.seed = 5;
+
+    auto sweep = [&] {
+      auto clock = std::make_shared<Virtual_Clock>();
+      Ping_Options options;
+      options.interval = seconds(10);
+      options.count = 3;
+      options.output_fd = -1;
+      options.clock = clock;
+      options.transport = std::make_shared<Simulated_Network>(profile, clock);
+      Ping_Service service({"10.9.0.0/28"}, seconds(1), options);
+
+      auto begin = steady_clock::now();
+      service.run();
+      REQUIRE(steady_clock::now() - begin < seconds(5));
+      REQUIRE(clock->elapsed() >= seconds(20));
+
+      std::ostringstream summary;
+      service.print_summary(summary);
+      return summary.str();
+    };
+
+    auto summary = sweep();
+    REQUIRE(summary.find("14 of 14 addresses probed") != std::string::npos);
+    REQUIRE(summary.find("42 packets transmitted") != std::string::npos);
+    REQUIRE(summary == sweep());
+  }
+
+  SECTION("Workers cannot share a virtual clock") {
+    Ping_Options options;
+    options.clock = clock;
+    REQUIRE_THROWS_AS(Ping_Workers({"10.9.0.0/28"}, seconds(1), options, 2),
+                      std::invalid_argument);
+  }
+}
+
+TEST_CASE("Testing buffered output") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  auto drain = [&] {
+    std::string text;
+    char chunk[4096];
+    pollfd ready{fds[0], POLLIN, 0};
+    while (poll(&ready, 1, 0) == 1) {
+      auto got = read(fds[0], chunk, sizeof(chunk));
+      if (got <= 0) {
+        break;
+      }
+      text.append(chunk, static_cast<size_t>(got));
+    }
+    return text;
+  };
+
+  SECTION("Numbers and text are formatted like the stream they replace") {
+    Output_Buffer output(fds[1]);
+    output.number(64)
+        .text(" bytes from ")
+        .text("10.0.0.1")
+        .text(": icmp_seq=")
+        .number(65535)
+        .text(" time=")
+        .fixed(0.125)
+        .character(' ')
+        .fixed(12.3456, 3)
+        .character('\n');
+    REQUIRE(drain().empty());
+    output.flush();
+    REQUIRE(drain() == "64 bytes from 10.0.0.1: icmp_seq=65535 time=0.12 "
+                       "12.346\n");
+    REQUIRE(output.size() == 0);
+  }
+
+  SECTION("A full buffer is written before a line that does not fit") {
+    Output_Buffer output(fds[1], 64);
+    output.text(std::string(50, 'a')).character('\n');
+    output.reserve(20);
+    REQUIRE(drain() == std::string(50, 'a') + "\n");
+    output.text(std::string(100, 'b'));
+    output.flush();
+    REQUIRE(drain() == std::string(100, 'b'));
+  }
+
+  SECTION("A service writes its lines once per batch of events") {
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.count = 2;
+    options.output_fd = fds[1];
+    options.transport = std::make_shared<Simulated_Network>();
+    Ping_Service service({"192.0.2.1", "2001:db8::7"}, seconds(1), options);
+    service.run();
+
+    auto lines = drain();
+    for (auto expected :
+         {"64 bytes from 192.0.2.1: icmp_seq=1 time=", "\n",
+          "64 bytes from 2001:db8::7: icmp_seq=2 time="}) {
+      REQUIRE(lines.find(expected) != std::string::npos);
+    }
+    REQUIRE(std::count(lines.begin(), lines.end(), '\n') == 4);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_CASE("Testing machine readable output") {
+  // Every other probe is lost, so replies and timeouts both show up
+  Network_Profile profile;
+  profile.loss = 0.5;
+  profile.seed = 3;
+  Ping_Options options;
+  options.interval = milliseconds(10);
+  options.count = 8;
+  options.clock = std::make_shared<Virtual_Clock>();
+  options.transport =
+      std::make_shared<Simulated_Network>(profile, options.clock);
+
+  char path[] = "/tmp/pico_ping_records_XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  unlink(path);
+  options.output_fd = fd;
+  auto written = [&] {
+    std::string text(static_cast<size_t>(lseek(fd, 0, SEEK_END)), '\0');
+    REQUIRE(pread(fd, &text[0], text.size(), 0) ==
+            static_cast<ssize_t>(text.size()));
+    return text;
+  };
+
+  SECTION("JSON lines carry one object per probe") {
+    options.output_format = Output_Format::json;
+    Ping_Service service({"192.0.2.1"}, seconds(1), options);
+    service.run();
+
+    auto lines = written();
+    REQUIRE(std::count(lines.begin(), lines.end(), '\n') == 8);
+    REQUIRE(lines.rfind("{\"target\":0,\"host\":\"192.0.2.1\",\"address\":"
+                        "\"192.0.2.1\",\"seq\":",
+                        0) == 0);
+    REQUIRE(lines.find("\"status\":\"reply\",\"bytes\":64,") !=
+            std::string::npos);
+    REQUIRE(lines.find("\"status\":\"timeout\",\"bytes\":null,") !=
+            std::string::npos);
+    // The simulated network carries no hop limit
+    REQUIRE(lines.find("\"ttl\":null}\n") != std::string::npos);
+  }
+
+  SECTION("CSV starts with a header row") {
+    options.output_format = Output_Format::csv;
+    Ping_Service service({"192.0.2.1"}, seconds(1), options);
+    service.run();
+
+    auto lines = written();
+    REQUIRE(lines.rfind("target,host,address,seq,status,bytes,sent_ns,"
+                        "received_ns,rtt_ms,wire_rtt_ms,ttl\n0,192.0.2.1,"
+                        "192.0.2.1,1,",
+                        0) == 0);
+    REQUIRE(std::count(lines.begin(), lines.end(), '\n') == 9);
+    REQUIRE(lines.find(",timeout,,") != std::string::npos);
+  }
+
+  SECTION("Binary records can be scanned in place") {
+    options.output_format = Output_Format::binary;
+    Ping_Service service({"192.0.2.1", "2001:db8::7"}, seconds(1), options);
+    service.run();
+
+    auto size = static_cast<size_t>(lseek(fd, 0, SEEK_END));
+    REQUIRE(size == sizeof(Probe_Record_Header) + 16 * sizeof(Probe_Record));
+    auto mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    REQUIRE(mapped != MAP_FAILED);
+
+    auto header = static_cast<const Probe_Record_Header *>(mapped);
+    REQUIRE(std::memcmp(header->magic, probe_record_magic, 8) == 0);
+    REQUIRE(header->version == probe_record_version);
+    REQUIRE(header->record_size == sizeof(Probe_Record));
+
+    auto records = reinterpret_cast<const Probe_Record *>(header + 1);
+    size_t replies = 0, timeouts = 0;
+    for (size_t i = 0; i < 16; ++i) {
+      const auto &record = records[i];
+      REQUIRE(record.sent_ns > 0);
+      if (record.status == static_cast<uint8_t>(Probe_Status::timeout)) {
+        REQUIRE(record.received_ns == 0);
+        ++timeouts;
+      } else {
+        REQUIRE(record.received_ns >= record.sent_ns);
+        ++replies;
+      }
+      REQUIRE(record.target < 2);
+      REQUIRE(record.family == (record.target == 0 ? 4 : 6));
+      REQUIRE(record.sequence >= 1);
+      REQUIRE(record.sequence <= 8);
+    }
+    REQUIRE(records[0].address[0] == 192);
+    REQUIRE(records[0].address[3] == 1);
+    REQUIRE(replies > 0);
+    REQUIRE(timeouts > 0);
+    munmap(mapped, size);
+  }
+
+  SECTION("Loopback replies report their TTL") {
+    Ping_Options loopback;
+    loopback.interval = milliseconds(10);
+    loopback.count = 2;
+    loopback.output_fd = fd;
+    loopback.output_format = Output_Format::csv;
+    Ping_Service service({"127.0.0.1"}, seconds(1), loopback);
+    service.run();
+
+    auto lines = written();
+    REQUIRE(lines.find(",reply,64,") != std::string::npos);
+    REQUIRE(lines.substr(lines.size() - 4) == ",64\n");
+  }
+  close(fd);
+}
+
+TEST_CASE("Testing asynchronous output") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  fcntl(fds[1], F_SETPIPE_SZ, 4096);
+  std::string read_back;
+  auto read_all = [&] {
+    char chunk[4096];
+    ssize_t got;
+    while ((got = read(fds[0], chunk, sizeof(chunk))) > 0) {
+      read_back.append(chunk, static_cast<size_t>(got));
+    }
+  };
+
+  // Chunks of varying size wrap around the small ring at every offset
+  std::string expected;
+  for (size_t i = 0; i < 2000; ++i) {
+    expected += std::to_string(i) + std::string(i % 37, 'x') + "\n";
+  }
+
+  SECTION("Blocking pushes arrive whole and in order") {
+    std::thread reader(read_all);
+    {
+      Async_Writer writer(fds[1], 256);
+      REQUIRE(writer.capacity() == 256);
+      size_t begin = 0;
+      while (begin < expected.size()) {
+        auto end = std::min(expected.find('\n', begin + 100), expected.size());
+        REQUIRE(writer.push({expected.data() + begin, end - begin}));
+        begin = end;
+      }
+      writer.sync();
+      auto counters = writer.counters();
+      REQUIRE(counters.written == expected.size());
+      REQUIRE(counters.dropped == 0);
+      REQUIRE(counters.waits > 0);
+    }
+    close(fds[1]);
+    reader.join();
+    REQUIRE(read_back == expected);
+  }
+
+  SECTION("Dropping pushes never wait and are counted") {
+    size_t queued = 0, dropped = 0;
+    {
+      // Nobody reads until every push went in, so the pipe and ring fill up
+      Async_Writer writer(fds[1], 1024, Backpressure::drop);
+      std::string line(100, 'd');
+      line.back() = '\n';
+      for (size_t i = 0; i < 200; ++i) {
+        (writer.push(line) ? queued : dropped) += line.size();
+      }
+      auto counters = writer.counters();
+      REQUIRE(dropped > 0);
+      REQUIRE(counters.dropped == dropped);
+      REQUIRE(counters.dropped_batches == dropped / line.size());
+      REQUIRE(counters.waits == 0);
+
+      std::thread reader(read_all);
+      writer.sync();
+      REQUIRE(writer.counters().written == queued);
+      close(fds[1]);
+      reader.join();
+    }
+    REQUIRE(read_back.size() == queued);
+    REQUIRE(std::count(read_back.begin(), read_back.end(), '\n') ==
+            static_cast<long>(queued / 100));
+  }
+
+  SECTION("A service writes through its writer thread") {
+    std::thread reader(read_all);
+    Ping_Options options;
+    options.interval = milliseconds(10);
+    options.count = 3;
+    options.output_fd = fds[1];
+    options.output_queue_size = 64;
+    options.transport = std::make_shared<Simulated_Network>();
+    options.clock = std::make_shared<Virtual_Clock>();
+    {
+      Ping_Service service({"192.0.2.1", "192.0.2.2"}, seconds(1), options);
+      service.run();
+      REQUIRE(service.output_counters().written > 0);
+      REQUIRE(service.output_counters().dropped == 0);
+    }
+    close(fds[1]);
+    reader.join();
+    REQUIRE(std::count(read_back.begin(), read_back.end(), '\n') == 6);
+  }
+  close(fds[0]);
+}
+
+TEST_CASE("Testing the embeddable probe engine") {
+  auto address = [](const char *text) {
+    Socket_Address addr;
+    std::memset(&addr, 0, sizeof(addr));
+    if (inet_pton(AF_INET, text, &addr.v4.sin_addr) == 1) {
+      addr.v4.sin_family = AF_INET;
+    } else {
+      addr.v6.sin6_family = AF_INET6;
+      inet_pton(AF_INET6, text, &addr.v6.sin6_addr);
+    }
+    return addr;
+  };
+  Network_Profile profile;
+  profile.latency = milliseconds(20);
+  Engine_Options options;
+  options.clock = std::make_shared<Virtual_Clock>();
+
+  SECTION("Results are queued for polling with their id and context") {
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Probe_Engine engine(options);
+    int contexts[3];
+    std::vector<uint64_t> ids;
+    for (auto text : {"192.0.2.1", "192.0.2.2", "2001:db8::7"}) {
+      ids.push_back(engine.submit(address(text), seconds(1),
+                                  &contexts[ids.size()]));
+    }
+    REQUIRE(engine.in_flight() == 3);
+    engine.run();
+    REQUIRE(engine.in_flight() == 0);
+
+    std::vector<Probe_Result> results;
+    REQUIRE(engine.poll(results) == 3);
+    REQUIRE(engine.poll(results) == 0);
+    for (const auto &result : results) {
+      auto i = std::find(ids.begin(), ids.end(), result.id) - ids.begin();
+      REQUIRE(i < 3);
+      REQUIRE(result.context == &contexts[i]);
+      REQUIRE(result.status == Probe_Status::reply);
+      REQUIRE(result.rtt.count() == Approx(20));
+      REQUIRE(result.length == 64);
+    }
+    REQUIRE(results.back().address.any.sa_family == AF_INET6);
+  }
+
+  SECTION("Lost probes time out after their own timeout") {
+    profile.loss = 1;
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Probe_Engine engine(options);
+    auto slow = engine.submit(address("192.0.2.1"), seconds(3));
+    auto fast = engine.submit(address("192.0.2.2"), milliseconds(500));
+    engine.run();
+
+    std::vector<Probe_Result> results;
+    REQUIRE(engine.poll(results) == 2);
+    REQUIRE(results[0].id == fast);
+    REQUIRE(results[1].id == slow);
+    REQUIRE(results[1].status == Probe_Status::timeout);
+    REQUIRE(duration_cast<milliseconds>(options.clock->elapsed()).count() ==
+            Approx(3000).margin(2));
+  }
+
+  SECTION("Callbacks may submit the next probe") {
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    options.max_in_flight = 1;
+    std::vector<Probe_Result> results;
+    Probe_Engine *running = nullptr;
+    options.on_result = [&](const Probe_Result &result) {
+      results.push_back(result);
+      if (results.size() < 5) {
+        REQUIRE(running->submit(result.address, seconds(1)) !=
+                Probe_Engine::no_probe);
+      }
+    };
+    Probe_Engine engine(options);
+    running = &engine;
+    REQUIRE(engine.submit(address("192.0.2.1"), seconds(1)) != 0);
+    // One probe in flight at most
+    REQUIRE(engine.submit(address("192.0.2.1"), seconds(1)) ==
+            Probe_Engine::no_probe);
+    engine.run();
+
+    REQUIRE(results.size() == 5);
+    REQUIRE(results[4].id == 5);
+    REQUIRE(duration_cast<milliseconds>(options.clock->elapsed()).count() ==
+            Approx(100).margin(1));
+    std::vector<Probe_Result> queued;
+    REQUIRE(engine.poll(queued) == 0);
+  }
+
+  SECTION("Loopback replies carry their TTL") {
+    Probe_Engine engine;
+    engine.submit(address("127.0.0.1"), seconds(1));
+    engine.run();
+    std::vector<Probe_Result> results;
+    REQUIRE(engine.poll(results) == 1);
+    REQUIRE(results[0].status == Probe_Status::reply);
+    REQUIRE(results[0].ttl == 64);
+  }
+
+  SECTION("Out of range options throw") {
+    options.max_in_flight = 65537;
+    REQUIRE_THROWS_AS(Probe_Engine(options), std::invalid_argument);
+    options.max_in_flight = 16;
+    options.payload_size = 8;
+    REQUIRE_THROWS_AS(Probe_Engine(options), std::invalid_argument);
+  }
+
+  SECTION("A service reports every outcome to its observer") {
+    Ping_Options service_options;
+    service_options.interval = milliseconds(10);
+    service_options.count = 4;
+    service_options.output_fd = -1;
+    service_options.clock = options.clock;
+    profile.loss = 0.5;
+    service_options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    size_t replies = 0, timeouts = 0;
+    service_options.on_probe = [&](const Probe_Event &event) {
+      REQUIRE(event.address == "192.0.2.1");
+      (event.status == Probe_Status::timeout ? timeouts : replies) += 1;
+    };
+    Ping_Service service({"192.0.2.1"}, seconds(1), service_options);
+    service.run();
+    REQUIRE(replies + timeouts == 4);
+    REQUIRE(replies > 0);
+    REQUIRE(timeouts > 0);
+  }
+}
+
+// Pings until a reply arrives, backing off between attempts
+static Ping_Session ping_with_retries(Ping_Executor &executor,
+                                      Socket_Address target, int &attempts,
+                                      Ping_Reply &reply) {
+  for (auto backoff = milliseconds(100); attempts < 5; backoff *= 2) {
+    ++attempts;
+    reply = co_await executor.ping(target, milliseconds(500));
+    if (reply) {
+      co_return;
+    }
+    co_await executor.sleep(backoff);
+  }
+}
+
+static Ping_Session empty_session(Ping_Executor &) { co_return; }
+
+static Ping_Session heap_session() { co_return; }
+
+static Ping_Session failing_session(Ping_Executor &executor) {
+  co_await executor.sleep(milliseconds(10));
+  throw std::runtime_error("Session failed.");
+}
+
+TEST_CASE("Testing coroutine ping sessions") {
+  Socket_Address target;
+  std::memset(&target, 0, sizeof(target));
+  target.v4.sin_family = AF_INET;
+  inet_pton(AF_INET, "192.0.2.1", &target.v4.sin_addr);
+  Network_Profile profile;
+  profile.latency = milliseconds(20);
+  Engine_Options options;
+  options.clock = std::make_shared<Virtual_Clock>();
+
+  SECTION("Thousands of sessions retry without allocating frames") {
+    profile.loss = 0.5;
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    // Fewer slots than sessions, the rest wait for one to free up
+    options.max_in_flight = 256;
+    Ping_Executor executor(options, 2000);
+    std::vector<int> attempts(2000);
+    std::vector<Ping_Reply> replies(2000);
+    for (size_t i = 0; i < attempts.size(); ++i) {
+      executor.spawn(
+          ping_with_retries(executor, target, attempts[i], replies[i]));
+    }
+    REQUIRE(executor.sessions() == 2000);
+    executor.run();
+
+    REQUIRE(executor.sessions() == 0);
+    REQUIRE(executor.heap_frames() == 0);
+    REQUIRE(executor.engine().in_flight() == 0);
+    size_t retried = 0;
+    for (size_t i = 0; i < attempts.size(); ++i) {
+      REQUIRE((replies[i] || attempts[i] == 5));
+      if (replies[i]) {
+        REQUIRE(replies[i].rtt.count() == Approx(20));
+      }
+      retried += attempts[i] > 1;
+    }
+    REQUIRE(retried > 0);
+  }
+
+  SECTION("Timeouts resume the session after its backoff") {
+    profile.loss = 1;
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Ping_Executor executor(options);
+    int attempts = 0;
+    Ping_Reply reply;
+    reply.status = Probe_Status::reply;
+    executor.spawn(ping_with_retries(executor, target, attempts, reply));
+    executor.run();
+
+    REQUIRE(attempts == 5);
+    REQUIRE(reply.status == Probe_Status::timeout);
+    REQUIRE(!reply);
+    // Five timeouts of 500ms and backoffs of 100ms doubling each time
+    REQUIRE(duration_cast<milliseconds>(options.clock->elapsed()).count() ==
+            Approx(5600).margin(10));
+  }
+
+  SECTION("Frames too large for the pool come from the heap") {
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Ping_Executor executor(options, 4, 16);
+    int attempts = 0;
+    Ping_Reply reply;
+    executor.spawn(ping_with_retries(executor, target, attempts, reply));
+    executor.run();
+    REQUIRE(reply);
+    REQUIRE(executor.heap_frames() == 1);
+  }
+
+  SECTION("Frames come from the pool of the session's executor") {
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Ping_Executor first(options, 4);
+    auto second = std::make_unique<Ping_Executor>(options, 4);
+    first.spawn(empty_session(first));
+    auto unspawned = empty_session(*second);
+    second.reset();
+    first.run();
+    REQUIRE(first.heap_frames() == 0);
+    REQUIRE(first.sessions() == 0);
+
+    // Sessions without an executor parameter live on the heap
+    first.spawn(heap_session());
+    first.run();
+    REQUIRE(first.heap_frames() == 0);
+  }
+
+  SECTION("Sessions are limited and their exceptions escape run") {
+    options.transport =
+        std::make_shared<Simulated_Network>(profile, options.clock);
+    Ping_Executor executor(options, 2);
+    int attempts = 0;
+    Ping_Reply reply;
+    executor.spawn(ping_with_retries(executor, target, attempts, reply));
+    executor.spawn(failing_session(executor));
+    REQUIRE_THROWS_AS(executor.spawn(failing_session(executor)),
+                      std::runtime_error);
+    REQUIRE_THROWS_WITH(executor.run(), "Session failed.");
+    // The ping still in flight is freed with the executor
+    REQUIRE(executor.sessions() == 1);
+    REQUIRE_THROWS_AS(Ping_Executor(options, 0), std::invalid_argument);
+  }
+}